@@ -0,0 +1,476 @@
+/* Standard includes. */
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+/* FreeRTOS includes. */
+#include "FreeRTOS_old.h"
+#include "verios.h"
+#include "task.h"
+#include "schedule.h"
+#include "verios_util.h"
+#include "event_group.h"
+#include "portmacro.h"
+
+/*******************************************************************************
+* STATIC FUNCTION DECLARATIONS
+*******************************************************************************/
+
+static OSBool_t _OS_event_group_met(uint32_t group_bits, uint32_t wait_bits, uint32_t options);
+
+static void _OS_event_group_enqueue(EventGroup_t *group, TCB_t *tcb);
+
+static void _OS_event_group_dequeue(EventGroup_t *group, TCB_t *tcb);
+
+static void _OS_event_group_refresh(EventGroup_t *group, WaitList_t *waitlist);
+
+static uint32_t _OS_event_group_check(EventGroup_t *group, WaitList_t *waitlist, 
+            TCB_t **woken, int *num_woken);
+
+/*******************************************************************************
+* Event Group Create (API FUNCTION)
+*
+*   group_ptr = A pointer to an EvGroup_t reference for the group we will create
+*
+* PURPOSE :
+*
+*   Create an event group with all of its bits clear
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*******************************************************************************/
+
+int OS_event_group_create(EvGroup_t *group_ptr)
+{
+    EventGroup_t *group;
+    int bit;
+
+    group = malloc(sizeof(EventGroup_t));
+    if(group == NULL) {
+        return OS_ERROR_EVENT_GROUP_ALLOC;
+    }
+
+    group->bits = 0;
+    for(bit = 0; bit < OS_EVENT_GROUP_BITS; ++bit) {
+        _OS_list_header_init(&(group->bit_waiters[bit]));
+    }
+    group->waiting_bits = 0;
+    _OS_list_header_init(&(group->any_waiters));
+    group->any_bits = 0;
+    vPortCPUInitializeMutex(&(group->mux));
+
+    *group_ptr = (void *)group;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Event Group Delete (API FUNCTION)
+*
+*   group_ptr = A pointer to the EvGroup_t reference for the group to delete
+*
+* PURPOSE :
+*
+*   Destroy an event group and free its associated data
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES:
+*******************************************************************************/
+
+int OS_event_group_delete(EvGroup_t *group_ptr)
+{
+    EventGroup_t *group;
+    int bit;
+
+    if(group_ptr == NULL || *group_ptr == NULL) {
+        return OS_ERROR_INVALID_EVENT_GROUP;
+    }
+    group = (EventGroup_t *)(*group_ptr);
+
+    portENTER_CRITICAL(&(group->mux));
+    for(bit = 0; bit < OS_EVENT_GROUP_BITS; ++bit) {
+        OS_schedule_waitlist_empty(&(group->bit_waiters[bit]));
+    }
+    OS_schedule_waitlist_empty(&(group->any_waiters));
+    portEXIT_CRITICAL(&(group->mux));
+
+    free(group);
+    *group_ptr = NULL;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Event Group Wait (API FUNCTION)
+*
+*   event_group = The group to wait on
+*   bits = The bits to wait for
+*   options = OS_EVENT_WAIT_ALL to wait for every bit instead of any one, and
+*       OS_EVENT_WAIT_CLEAR_ON_EXIT to clear the bits once the wait is met
+*   timeout = The most ticks to wait. 0 never blocks, OS_NO_TIMEOUT waits forever
+*   result = If not NULL, gets the group's bits when the wait ended, before
+*       any clearing
+*
+* PURPOSE :
+*
+*   Block until bits of an event group are set. The condition is kept in the
+*   task's block record, and the task that sets the bits checks it and wakes
+*   the task
+*
+* RETURN :
+*
+*   Return OS_ERROR_EVENT_BITS_UNAVAILABLE if timeout was 0 and the condition
+*   wasn't met, OS_ERROR_TIMER_EXPIRED if the timeout passed, another error
+*   message, or 0 (OS_NO_ERROR) if the condition was met
+*
+* NOTES:
+*
+*   Only a task the setter woke has its condition met. Any other wakeup puts
+*   the task back to wait for the rest of its timeout
+*******************************************************************************/
+
+int OS_event_group_wait(EvGroup_t event_group, uint32_t bits, uint32_t options,
+            TickType_t timeout, uint32_t *result)
+{
+    EventGroup_t *group = (EventGroup_t *)event_group;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    TimeOut_t time_out;
+    OSBool_t waited = OS_FALSE;
+    uint32_t group_bits;
+    int ret_val;
+
+    if(group == NULL) {
+        return OS_ERROR_INVALID_EVENT_GROUP;
+    }
+    if(bits == 0 || (bits & ~OS_EVENT_GROUP_MASK) != 0) {
+        return OS_ERROR_INVALID_EVENT_BITS;
+    }
+
+    portENTER_CRITICAL(&(group->mux));
+    while(OS_TRUE) {
+        group_bits = group->bits;
+        if(_OS_event_group_met(group_bits, bits, options) == OS_TRUE) {
+            if((options & OS_EVENT_WAIT_CLEAR_ON_EXIT) != 0) {
+                group->bits &= ~bits;
+            }
+            ret_val = OS_NO_ERROR;
+            break;
+        }
+        if(timeout == 0) {
+            ret_val = OS_ERROR_EVENT_BITS_UNAVAILABLE;
+            break;
+        }
+
+        /* Track the deadline so a wakeup that didn't meet us only costs the
+        ticks it used */
+        if(waited == OS_FALSE) {
+            OS_set_timeout_state(&time_out);
+        }
+        else if(OS_schedule_check_for_timeout(&time_out, &timeout) == OS_TRUE) {
+            ret_val = OS_ERROR_TIMER_EXPIRED;
+            break;
+        }
+
+        cur_tcb->block_record.event_bits = bits;
+        cur_tcb->block_record.event_options = options;
+
+        /* Leave the ready list before dropping the mux so the bits can't be missed */
+        _OS_event_group_enqueue(group, cur_tcb);
+        ret_val = OS_schedule_block_current_task(timeout);
+        if(ret_val != OS_NO_ERROR) {
+            _OS_event_group_dequeue(group, cur_tcb);
+            portEXIT_CRITICAL(&(group->mux));
+            return ret_val;
+        }
+        portEXIT_CRITICAL(&(group->mux));
+
+        portYIELD_WITHIN_API();
+
+        /* If the timeout woke us we are still on a waitlist */
+        portENTER_CRITICAL(&(group->mux));
+        if(cur_tcb->block_record.waitlist != NULL) {
+            _OS_event_group_dequeue(group, cur_tcb);
+        }
+        else if(cur_tcb->block_record.granted == OS_TRUE) {
+            /* The setter met our condition and already cleared our bits */
+            group_bits = cur_tcb->block_record.event_result;
+            ret_val = OS_NO_ERROR;
+            break;
+        }
+        waited = OS_TRUE;
+    }
+    portEXIT_CRITICAL(&(group->mux));
+
+    if(result != NULL) {
+        *result = group_bits;
+    }
+    return ret_val;
+}
+
+/*******************************************************************************
+* Event Group Set Bits (API FUNCTION)
+*
+*   event_group = The group to set bits in
+*   bits = The bits to set
+*   result = If not NULL, gets the group's bits after waiters cleared theirs
+*
+* PURPOSE :
+*
+*   Set bits of an event group and wake every task whose condition is now met
+*
+* RETURN :
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES:
+*
+*   Only the tasks bucketed under a newly set bit, and the wait-any tasks on
+*   several bits if one of their bits was set, are looked at. Bits that met
+*   tasks waiting with OS_EVENT_WAIT_CLEAR_ON_EXIT are cleared once every
+*   task of the pass has been checked, so all of them see the same bits. The
+*   woken tasks are resumed after the mux is released, and a pass that woke
+*   OS_EVENT_GROUP_WAKE_BATCH tasks is followed by another
+*******************************************************************************/
+
+int OS_event_group_set_bits(EvGroup_t event_group, uint32_t bits, uint32_t *result)
+{
+    EventGroup_t *group = (EventGroup_t *)event_group;
+    TCB_t *woken[OS_EVENT_GROUP_WAKE_BATCH];
+    int num_woken;
+    uint32_t new_bits, scan_bits, clear_bits, group_bits;
+    int bit, i;
+
+    if(group == NULL) {
+        return OS_ERROR_INVALID_EVENT_GROUP;
+    }
+    if((bits & ~OS_EVENT_GROUP_MASK) != 0) {
+        return OS_ERROR_INVALID_EVENT_BITS;
+    }
+
+    portENTER_CRITICAL(&(group->mux));
+    new_bits = bits & ~group->bits;
+    group->bits |= bits;
+    while(OS_TRUE) {
+        num_woken = 0;
+        clear_bits = 0;
+
+        /* A blocked task's bucket bit was clear, so only buckets of bits that
+        were clear until now can hold tasks this set meets */
+        scan_bits = new_bits & group->bits & group->waiting_bits;
+        while(scan_bits != 0 && num_woken < OS_EVENT_GROUP_WAKE_BATCH) {
+            bit = __builtin_ctz(scan_bits);
+            scan_bits &= scan_bits - 1;
+            clear_bits |= _OS_event_group_check(group, &(group->bit_waiters[bit]), 
+                    woken, &num_woken);
+        }
+
+        if((bits & group->any_bits) != 0 && num_woken < OS_EVENT_GROUP_WAKE_BATCH) {
+            clear_bits |= _OS_event_group_check(group, &(group->any_waiters), 
+                    woken, &num_woken);
+        }
+
+        group->bits &= ~clear_bits;
+        group_bits = group->bits;
+        portEXIT_CRITICAL(&(group->mux));
+
+        for(i = 0; i < num_woken; ++i) {
+            OS_schedule_resume_task(woken[i]);
+        }
+        if(num_woken < OS_EVENT_GROUP_WAKE_BATCH) {
+            break;
+        }
+        portENTER_CRITICAL(&(group->mux));
+    }
+
+    if(result != NULL) {
+        *result = group_bits;
+    }
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Event Group Clear Bits (API FUNCTION)
+*
+*   event_group = The group to clear bits in
+*   bits = The bits to clear
+*   prev_bits = If not NULL, gets the group's bits before they were cleared
+*
+* PURPOSE :
+*
+*   Clear bits of an event group
+*
+* RETURN :
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES:
+*
+*   Clearing bits can't meet any condition, so no waiters are looked at
+*******************************************************************************/
+
+int OS_event_group_clear_bits(EvGroup_t event_group, uint32_t bits, uint32_t *prev_bits)
+{
+    EventGroup_t *group = (EventGroup_t *)event_group;
+
+    if(group == NULL) {
+        return OS_ERROR_INVALID_EVENT_GROUP;
+    }
+    if((bits & ~OS_EVENT_GROUP_MASK) != 0) {
+        return OS_ERROR_INVALID_EVENT_BITS;
+    }
+
+    portENTER_CRITICAL(&(group->mux));
+    if(prev_bits != NULL) {
+        *prev_bits = group->bits;
+    }
+    group->bits &= ~bits;
+    portEXIT_CRITICAL(&(group->mux));
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Event Group Get Bits (API FUNCTION)
+*
+*   event_group = The group to read
+*
+* PURPOSE :
+*
+*   Read the current bits of an event group
+*
+* RETURN :
+*
+*   The group's bits, or 0 for an invalid group
+*
+* NOTES:
+*******************************************************************************/
+
+uint32_t OS_event_group_get_bits(EvGroup_t event_group)
+{
+    EventGroup_t *group = (EventGroup_t *)event_group;
+
+    if(group == NULL) {
+        return 0;
+    }
+    return group->bits;
+}
+
+/*******************************************************************************
+* STATIC FUNCTION DEFINITIONS
+*******************************************************************************/
+
+/**
+ * True if group_bits meet a wait for wait_bits with the given options
+ */
+static OSBool_t _OS_event_group_met(uint32_t group_bits, uint32_t wait_bits, uint32_t options)
+{
+    if((options & OS_EVENT_WAIT_ALL) != 0) {
+        return ((group_bits & wait_bits) == wait_bits) ? OS_TRUE : OS_FALSE;
+    }
+    return ((group_bits & wait_bits) != 0) ? OS_TRUE : OS_FALSE;
+}
+
+/**
+ * Put a task whose condition isn't met on the waitlist of a bit it is still
+ * missing, or on any_waiters if it waits for any one of several bits
+ */
+static void _OS_event_group_enqueue(EventGroup_t *group, TCB_t *tcb)
+{
+    uint32_t wait_bits = tcb->block_record.event_bits;
+    int bit;
+
+    if((tcb->block_record.event_options & OS_EVENT_WAIT_ALL) != 0) {
+        bit = __builtin_ctz(wait_bits & ~group->bits);
+    }
+    else if((wait_bits & (wait_bits - 1)) == 0) {
+        bit = __builtin_ctz(wait_bits);
+    }
+    else {
+        _OS_waitlist_append(tcb, &(group->any_waiters), &(group->mux));
+        group->any_bits |= wait_bits;
+        return;
+    }
+
+    _OS_waitlist_append(tcb, &(group->bit_waiters[bit]), &(group->mux));
+    group->waiting_bits |= (uint32_t)1 << bit;
+}
+
+/**
+ * Take a task off whichever of the group's waitlists it is on
+ */
+static void _OS_event_group_dequeue(EventGroup_t *group, TCB_t *tcb)
+{
+    WaitList_t *waitlist = tcb->block_record.waitlist;
+
+    _OS_waitlist_remove(tcb);
+    if(waitlist->num_tasks == 0) {
+        _OS_event_group_refresh(group, waitlist);
+    }
+}
+
+/**
+ * Bring waiting_bits or any_bits up to date with what the waitlist holds.
+ * A deleted task leaves its waitlist without the group seeing it, so the
+ * bits may be stale until the list is next walked
+ */
+static void _OS_event_group_refresh(EventGroup_t *group, WaitList_t *waitlist)
+{
+    uint32_t bit;
+    TCB_t *tcb;
+
+    if(waitlist == &(group->any_waiters)) {
+        group->any_bits = 0;
+        for(tcb = waitlist->head_ptr; tcb != NULL; tcb = tcb->block_record.waitlist_next_ptr) {
+            group->any_bits |= tcb->block_record.event_bits;
+        }
+        return;
+    }
+
+    bit = (uint32_t)1 << (waitlist - group->bit_waiters);
+    if(waitlist->num_tasks == 0) {
+        group->waiting_bits &= ~bit;
+    }
+    else {
+        group->waiting_bits |= bit;
+    }
+}
+
+/**
+ * Pop the tasks on the waitlist whose condition the group's bits now meet
+ * into woken, stopping once OS_EVENT_GROUP_WAKE_BATCH tasks are there. A
+ * wait-all task that is still missing bits moves to the bucket of one of
+ * them. Returns the bits met tasks want cleared on exit
+ */
+static uint32_t _OS_event_group_check(EventGroup_t *group, WaitList_t *waitlist, 
+            TCB_t **woken, int *num_woken)
+{
+    TCB_t *tcb = waitlist->head_ptr;
+    TCB_t *next_tcb;
+    uint32_t clear_bits = 0;
+
+    while(tcb != NULL && *num_woken < OS_EVENT_GROUP_WAKE_BATCH) {
+        next_tcb = tcb->block_record.waitlist_next_ptr;
+        if(_OS_event_group_met(group->bits, tcb->block_record.event_bits,
+                tcb->block_record.event_options) == OS_TRUE) {
+            _OS_waitlist_remove(tcb);
+            tcb->block_record.event_result = group->bits;
+            tcb->block_record.granted = OS_TRUE;
+            if((tcb->block_record.event_options & OS_EVENT_WAIT_CLEAR_ON_EXIT) != 0) {
+                clear_bits |= tcb->block_record.event_bits;
+            }
+            woken[(*num_woken)++] = tcb;
+        }
+        else if(waitlist != &(group->any_waiters)) {
+            _OS_waitlist_remove(tcb);
+            _OS_event_group_enqueue(group, tcb);
+        }
+        tcb = next_tcb;
+    }
+    _OS_event_group_refresh(group, waitlist);
+    return clear_bits;
+}
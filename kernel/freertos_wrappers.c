@@ -44,6 +44,40 @@ BaseType_t xTaskCreatePinnedToCore(	TaskFunction_t pvTaskCode,
 	return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
 }
 
+#if( configSUPPORT_STATIC_ALLOCATION == 1 && OS_STATIC_TASK_WRAPPERS == 1 )
+/* The kernel's TCB lives in the caller's StaticTask_t, so it has to fit. The
+array size goes negative and the build fails if it doesn't */
+typedef char OS_static_task_fits_tcb_t[(sizeof(StaticTask_t) >= sizeof(TCB_t)) ? 1 : -1];
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(	TaskFunction_t pvTaskCode,
+											const char * const pcName,
+											const uint32_t ulStackDepth,
+											void * const pvParameters,
+											UBaseType_t uxPriority,
+											StackType_t * const pxStackBuffer,
+											StaticTask_t * const pxTaskBuffer,
+											const BaseType_t xCoreID){
+    const int core_ID = ((xCoreID >= 2 || xCoreID < 0) ? CORE_NO_AFFINITY : xCoreID);
+	int tid;
+	int res;
+
+    res = OS_task_create_static((TaskFunc_t) pvTaskCode,
+							 pvParameters,
+							 pcName,
+							 (TaskPrio_t)uxPriority,
+							 ulStackDepth,
+							 pxStackBuffer,
+							 (TCB_t *)pxTaskBuffer,
+							 0,
+							 core_ID,
+							 &tid);
+	if(res == 0){
+		return (TaskHandle_t)pxTaskBuffer;
+	}
+	return NULL;
+}
+#endif /* configSUPPORT_STATIC_ALLOCATION && OS_STATIC_TASK_WRAPPERS */
+
 BaseType_t xTaskCreateRestricted( const TaskParameters_t * const pxTaskDefinition, TaskHandle_t *pxCreatedTask ){
 	configASSERT(0 == 1);
 	return 0;
@@ -185,29 +219,39 @@ void vTaskGetRunTimeStats( char *pcWriteBuffer){
 } 
 
 BaseType_t xTaskNotify( TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction ){
-	configASSERT(0 == 1);
-	return -1;
+	if(_OS_task_notify((TCB_t *)xTaskToNotify, ulValue, (OSNotifyAction_t)eAction, NULL) != OS_NO_ERROR){
+		return pdFAIL;
+	}
+	return pdPASS;
 }
 
 BaseType_t xTaskNotifyFromISR( TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction, BaseType_t *pxHigherPriorityTaskWoken ){
-	configASSERT(0 == 1);
-	return -1;
+	OSBool_t higher_prio_woken = OS_FALSE;
+	int res = _OS_task_notify_from_ISR((TCB_t *)xTaskToNotify, ulValue, (OSNotifyAction_t)eAction, NULL, &higher_prio_woken);
+	if(pxHigherPriorityTaskWoken != NULL && higher_prio_woken == OS_TRUE){
+		*pxHigherPriorityTaskWoken = pdTRUE;
+	}
+	if(res != OS_NO_ERROR){
+		return pdFAIL;
+	}
+	return pdPASS;
 }
 
 BaseType_t xTaskNotifyWait( uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit, uint32_t *pulNotificationValue, TickType_t xTicksToWait ){
-	configASSERT(0 == 1);
-	return -1;
+	if(OS_task_notify_wait(ulBitsToClearOnEntry, ulBitsToClearOnExit, pulNotificationValue, xTicksToWait) != OS_NO_ERROR){
+		return pdFALSE;
+	}
+	return pdTRUE;
 }
 
 #define xTaskNotifyGive( xTaskToNotify ) xTaskNotify( ( xTaskToNotify ), 0, eIncrement )
 
 void vTaskNotifyGiveFromISR( TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken ){
-	configASSERT(0 == 1);
+	xTaskNotifyFromISR(xTaskToNotify, 0, eIncrement, pxHigherPriorityTaskWoken);
 }
 
 uint32_t ulTaskNotifyTake( BaseType_t xClearCountOnExit, TickType_t xTicksToWait ){
-	configASSERT(0 == 1);
-	return 0;
+	return OS_task_notify_take((xClearCountOnExit != pdFALSE) ? OS_TRUE : OS_FALSE, xTicksToWait);
 }
 
 BaseType_t xTaskIncrementTick( void ){
@@ -296,12 +340,14 @@ void vTaskSetTaskNumber( TaskHandle_t xTask, const UBaseType_t uxHandle ) {
 }
 
 void vTaskStepTick( const TickType_t xTicksToJump ){
-	configASSERT(0 == 1);
+	OS_schedule_step_tick(xTicksToJump);
 }
 
 eSleepModeStatus eTaskConfirmSleepModeStatus( void ){
-	configASSERT(0 == 1);
-	return eAbortSleep;
+	if(OS_schedule_confirm_sleep_mode_status() == OS_SLEEP_ABORT) {
+		return eAbortSleep;
+	}
+	return eStandardSleep;
 }
 
 void *pvTaskIncrementMutexHeldCount( void ){
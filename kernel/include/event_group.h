@@ -0,0 +1,69 @@
+#ifndef OS_EVENT_GROUP_H
+#define OS_EVENT_GROUP_H
+
+#include "verios.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+
+/* An event group has 24 usable bits, the same as a FreeRTOS event group */
+#define OS_EVENT_GROUP_BITS 24
+#define OS_EVENT_GROUP_MASK (((uint32_t)1 << OS_EVENT_GROUP_BITS) - 1)
+
+/* Options of OS_event_group_wait. Without OS_EVENT_WAIT_ALL, any one of the
+bits is enough */
+#define OS_EVENT_WAIT_ALL ((uint32_t)1 << 0)
+#define OS_EVENT_WAIT_CLEAR_ON_EXIT ((uint32_t)1 << 1)
+
+/* Most tasks a set wakes per hold of the group's mux. They are resumed once
+the mux is released, and the set takes another pass if the batch filled */
+#define OS_EVENT_GROUP_WAKE_BATCH 8
+
+/*******************************************************************************
+* TYPEDEFS AND DATA STRUCTURES
+*******************************************************************************/
+
+/* The handle for API usage */
+typedef void * EvGroup_t;
+
+/**
+ * An event group. Blocked tasks are bucketed by a bit whose setting could 
+ * meet their condition, so setting bits only looks at the tasks in those 
+ * bits' buckets. A wait-all task waits in the bucket of a bit it is still
+ * missing, and a wait-any task on a single bit in that bit's bucket. Wait-any
+ * tasks on several bits share any_waiters
+ */
+typedef struct OSEventGroup {
+    volatile uint32_t bits;
+
+    WaitList_t bit_waiters[OS_EVENT_GROUP_BITS];
+    /* Bits whose bucket has tasks */
+    uint32_t waiting_bits;
+
+    WaitList_t any_waiters;
+    /* Every bit some task in any_waiters waits for. May have extra bits set 
+    until the list is next walked */
+    uint32_t any_bits;
+
+    portMUX_TYPE mux;
+} EventGroup_t;
+
+/*******************************************************************************
+* FUNCTION HEADERS
+*******************************************************************************/
+
+int OS_event_group_create(EvGroup_t *group_ptr);
+
+int OS_event_group_delete(EvGroup_t *group_ptr);
+
+int OS_event_group_wait(EvGroup_t event_group, uint32_t bits, uint32_t options, 
+            TickType_t timeout, uint32_t *result);
+
+int OS_event_group_set_bits(EvGroup_t event_group, uint32_t bits, uint32_t *result);
+
+int OS_event_group_clear_bits(EvGroup_t event_group, uint32_t bits, uint32_t *prev_bits);
+
+uint32_t OS_event_group_get_bits(EvGroup_t event_group);
+
+#endif /* OS_EVENT_GROUP_H */
@@ -29,6 +29,15 @@
 
 #define tskIDLE_PRIORITY OS_IDLE_PRIORITY
 
+/* A TCB_t embeds the task's message queue and block record on top of what a
+FreeRTOS TCB holds, so it outgrows ESP-IDF's StaticTask_t. The static create
+wrappers are only built when this is set to 1 along with a StaticTask_t big
+enough to hold a TCB_t, which is checked at compile time. Otherwise create 
+static tasks with OS_task_create_static and a real TCB_t */
+#ifndef OS_STATIC_TASK_WRAPPERS
+    #define OS_STATIC_TASK_WRAPPERS 0
+#endif /* OS_STATIC_TASK_WRAPPERS */
+
 typedef void * TaskHandle_t;
 
 typedef BaseType_t (*TaskHookFunction_t)( void * );
@@ -113,6 +122,29 @@ static inline IRAM_ATTR BaseType_t xTaskCreate(
 	return xTaskCreatePinnedToCore( pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask, tskNO_AFFINITY );
 }
 
+#if( configSUPPORT_STATIC_ALLOCATION == 1 && OS_STATIC_TASK_WRAPPERS == 1 )
+TaskHandle_t xTaskCreateStaticPinnedToCore(	TaskFunction_t pvTaskCode,
+											const char * const pcName,
+											const uint32_t ulStackDepth,
+											void * const pvParameters,
+											UBaseType_t uxPriority,
+											StackType_t * const pxStackBuffer,
+											StaticTask_t * const pxTaskBuffer,
+											const BaseType_t xCoreID);
+
+static inline IRAM_ATTR TaskHandle_t xTaskCreateStatic(
+			TaskFunction_t pvTaskCode,
+			const char * const pcName,
+			const uint32_t ulStackDepth,
+			void * const pvParameters,
+			UBaseType_t uxPriority,
+			StackType_t * const pxStackBuffer,
+			StaticTask_t * const pxTaskBuffer)
+{
+	return xTaskCreateStaticPinnedToCore( pvTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, pxStackBuffer, pxTaskBuffer, tskNO_AFFINITY );
+}
+#endif /* configSUPPORT_STATIC_ALLOCATION && OS_STATIC_TASK_WRAPPERS */
+
 BaseType_t xTaskCreateRestricted( const TaskParameters_t * const pxTaskDefinition, TaskHandle_t *pxCreatedTask );
 
 void vTaskAllocateMPURegions( TaskHandle_t xTask, const MemoryRegion_t * const pxRegions );
@@ -7,7 +7,28 @@
 * MACROS
 *******************************************************************************/
 
+/* Size of the first message slab. Later slabs double the total up to a cap */
 #define OS_MSG_POOL_INITIAL_SIZE 8
+#define OS_MSG_POOL_MAX_SLAB_SIZE 128
+
+/* Free messages in the depot above which completely free slabs are released */
+#define OS_MSG_POOL_TRIM_WATERMARK 64
+
+/* Free messages each core may cache, and how many move to or from the depot 
+at once when a cache runs empty or goes over its size */
+#define OS_MSG_CACHE_SIZE 16
+#define OS_MSG_CACHE_BATCH 8
+
+/* Fixed size messages up to this many bytes are copied inline, not with memcpy */
+#define OS_MSG_INLINE_COPY_SIZE 16
+
+/* Wait flags of an OS_MSG_QUEUE_MODE_SPSC queue */
+#define OS_MSG_QUEUE_SENDER_WAITING ((uint32_t)1 << 0)
+#define OS_MSG_QUEUE_RECEIVER_WAITING ((uint32_t)1 << 1)
+
+/* Loan flags of a fixed size queue */
+#define OS_MSG_QUEUE_SLOT_LOANED ((uint32_t)1 << 0)
+#define OS_MSG_QUEUE_SLOT_PEEKED ((uint32_t)1 << 1)
 
 /*******************************************************************************
 * TYPEDEFS AND DATA STRUCTURES
@@ -18,31 +39,90 @@ typedef void * MsgQueue_t;
 
 typedef struct OSMessage Message_t;
 
+typedef struct OSMsgSlab MsgSlab_t;
+
 struct OSMessage {
     TCB_t *sender;
     void *contents;
 
     Message_t *next_ptr;
+
+    /* The slab this message was allocated in */
+    MsgSlab_t *slab;
+};
+
+/* A single allocation of messages. The messages follow the header */
+struct OSMsgSlab {
+    MsgSlab_t *next_ptr;
+    int num_messages;
+    /* Messages of this slab that are in the depot, and their free list */
+    int num_free;
+    Message_t *free_ptr;
 };
 
+/* How a message queue stores its messages */
+typedef enum {
+    /* Messages are Message_t nodes from the global message pool */
+    OS_MSG_QUEUE_MODE_LINKED,
+    /* Messages are stored in a ring of slots allocated with the queue */
+    OS_MSG_QUEUE_MODE_RING,
+    /* A ring with one sender and one receiver that sends and receives 
+    without locking. The mux is only taken to block or wake */
+    OS_MSG_QUEUE_MODE_SPSC
+} OSMsgQueueMode_t;
+
 typedef struct OSMessageQueue {
     int max_messages;
     int num_messages;
 
+    OSMsgQueueMode_t mode;
+
     WaitList_t send_waiters;
     WaitList_t reveive_waiters;
 
+    /* Used in OS_MSG_QUEUE_MODE_LINKED */
     Message_t *head_ptr;
     Message_t *tail_ptr;
 
+    /* Used in the ring modes. Messages are read from slot ring_head and 
+    written to slot ring_tail. An SPSC ring has one spare slot so that a 
+    full ring can be told apart from an empty one without a shared count */
+    uint8_t *ring;
+    int ring_slots;
+
+    /* Bytes copied per message, and the word aligned stride between slots. 
+    Pointer queues store the message pointer itself, so copy_items is false */
+    int item_size;
+    int slot_size;
+    OSBool_t copy_items;
+    volatile int ring_head;
+    volatile int ring_tail;
+
+    /* OS_MSG_QUEUE_*_WAITING flags of an SPSC queue. Only set or cleared 
+    while holding mux, but read without it */
+    volatile uint32_t spsc_waiting;
+
+    /* OS_MSG_QUEUE_SLOT_* flags. A loaned tail slot or peeked head slot is 
+    being used in place and belongs to the task that loaned or peeked it */
+    volatile uint32_t loan_flags;
+
+    /* The queue set this queue belongs to, or NULL */
+    QueueSet_t *queue_set;
+
     portMUX_TYPE mux;
 } MessageQueue_t;
 
+/* The shared depot of free messages */
 typedef struct OSMessagePool {
+    int num_free;
+    MsgSlab_t *slab_list;
+} MessagePool_t;
+
+/* A core's private stack of free messages */
+typedef struct OSMessageCache {
     int num_messages;
     Message_t *head_ptr;
-    Message_t *tail_ptr;
-} MessagePool_t;
+} MessageCache_t;
 
 /*******************************************************************************
 * FUNCTION HEADERS
@@ -56,8 +136,39 @@ void _OS_msg_queue_init(MessageQueue_t * queue, int queue_size);
 
 int OS_msg_queue_create(MsgQueue_t * queue_ptr, int queue_size);
 
+int OS_msg_queue_create_ring(MsgQueue_t * queue_ptr, int queue_size);
+
+int OS_msg_queue_create_spsc(MsgQueue_t * queue_ptr, int queue_size);
+
+int OS_msg_queue_create_fixed(MsgQueue_t * queue_ptr, int queue_size, int item_size, 
+            OSMsgQueueMode_t mode);
+
+int OS_msg_queue_delete(MsgQueue_t queue);
+
 int OS_msg_queue_try_send(MsgQueue_t queue, const void * const data);
 
 int OS_msg_queue_try_receive(MsgQueue_t queue, void ** data);
 
+int OS_msg_queue_send_copy(MsgQueue_t queue, TickType_t timeout, const void * const item);
+
+int OS_msg_queue_receive_copy(MsgQueue_t queue, TickType_t timeout, void * const item);
+
+int OS_msg_queue_try_send_copy(MsgQueue_t queue, const void * const item);
+
+int OS_msg_queue_try_receive_copy(MsgQueue_t queue, void * const item);
+
+int OS_msg_queue_loan(MsgQueue_t queue, TickType_t timeout, void ** slot);
+
+int OS_msg_queue_loan_commit(MsgQueue_t queue);
+
+int OS_msg_queue_peek(MsgQueue_t queue, TickType_t timeout, void ** slot);
+
+int OS_msg_queue_peek_release(MsgQueue_t queue);
+
+int OS_msg_queue_send_batch(MsgQueue_t queue, TickType_t timeout, const void * const items, 
+            int num_items, int *num_sent);
+
+int OS_msg_queue_receive_batch(MsgQueue_t queue, TickType_t timeout, void * const items, 
+            int max_items, int *num_received);
+
 #endif /* OS_MSG_QUEUE_H */
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef OS_QUEUE_SET_H
+#define OS_QUEUE_SET_H
+
+#include "verios.h"
+#include "msg_queue.h"
+#include "sem.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+
+/*******************************************************************************
+* TYPEDEFS AND DATA STRUCTURES
+*******************************************************************************/
+
+/* The handles for application usage */
+typedef void * QSet_t;
+
+/* A member of a queue set. Either a MsgQueue_t or a Sem_t */
+typedef void * QSetMember_t;
+
+/**
+ * A queue set. Every message sent to a member queue and every release of a
+ * member semaphore pushes that member onto the ready ring, so a waiting task
+ * learns which member to read in O(1) without polling all of them
+ */
+struct OSQueueSet {
+    /* Members in the order they became ready. One entry per message or unit */
+    QSetMember_t *ready;
+    int ready_slots;
+    int ready_head;
+    int ready_tail;
+    int num_ready;
+
+    int num_members;
+
+    /* Ready slots promised to the members. Each member holds at most its 
+    capacity in events, so posts never find the ring full */
+    int reserved;
+
+    /* Tasks blocked in OS_queue_set_select */
+    WaitList_t waiters;
+
+    portMUX_TYPE mux;
+};
+
+/*******************************************************************************
+* FUNCTION HEADERS
+*******************************************************************************/
+
+int OS_queue_set_create(QSet_t *set_ptr, int set_size);
+
+int OS_queue_set_delete(QSet_t set);
+
+int OS_queue_set_add_queue(QSet_t set, MsgQueue_t queue);
+
+int OS_queue_set_add_sem(QSet_t set, Sem_t semaphore, int max_count);
+
+int OS_queue_set_remove_queue(QSet_t set, MsgQueue_t queue);
+
+int OS_queue_set_remove_sem(QSet_t set, Sem_t semaphore);
+
+int OS_queue_set_select(QSet_t set, TickType_t timeout, QSetMember_t *member);
+
+void _OS_queue_set_post(QueueSet_t *queue_set, QSetMember_t member, int count);
+
+void _OS_queue_set_remove_member(QueueSet_t *queue_set, QSetMember_t member, int capacity);
+
+#endif /* OS_QUEUE_SET_H */
@@ -0,0 +1,67 @@
+#ifndef OS_RWLOCK_H
+#define OS_RWLOCK_H
+
+#include "verios.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+
+/* A reader-writer lock's state word holds its reader count above two flag 
+bits. OS_RWLOCK_WAITERS sends every lock and unlock down the slow path */
+#define OS_RWLOCK_WRITER ((uint32_t)1 << 0)
+#define OS_RWLOCK_WAITERS ((uint32_t)1 << 1)
+#define OS_RWLOCK_READER_SHIFT 2
+#define OS_RWLOCK_READER_ONE ((uint32_t)1 << OS_RWLOCK_READER_SHIFT)
+#define OS_RWLOCK_READERS(state) ((int)((state) >> OS_RWLOCK_READER_SHIFT))
+
+/* Most waiters an unlock pops per hold of the lock's mux. They are resumed 
+once the mux is released, and larger reader batches take several passes */
+#define OS_RWLOCK_GRANT_BATCH 8
+
+/*******************************************************************************
+* TYPEDEFS AND DATA STRUCTURES
+*******************************************************************************/
+
+/* The handle for API usage */
+typedef void * RWLock_t;
+
+/**
+ * A reader-writer lock. Any number of readers or a single writer may hold it.
+ * A writer's unlock lets in every waiting reader at once before the next 
+ * writer, so readers never starve. With writer preference, new readers also 
+ * queue behind waiting writers, so writers never starve either
+ */
+typedef struct OSReadWriteLock {
+    /* The reader count and OS_RWLOCK_* flags. Only changed with 
+    uxPortCompareSet. OS_RWLOCK_WAITERS is only changed while holding mux */
+    volatile uint32_t state;
+
+    /* The task holding the write lock. Only valid with OS_RWLOCK_WRITER set */
+    TCB_t *writer;
+
+    OSBool_t writer_preference;
+
+    WaitList_t read_waiters;
+    WaitList_t write_waiters;
+
+    portMUX_TYPE mux;
+} ReadWriteLock_t;
+
+/*******************************************************************************
+* FUNCTION HEADERS
+*******************************************************************************/
+
+int OS_rwlock_create(RWLock_t *rwlock_ptr, OSBool_t writer_preference);
+
+int OS_rwlock_delete(RWLock_t *rwlock_ptr);
+
+int OS_rwlock_read_lock(RWLock_t rwlock, TickType_t timeout);
+
+int OS_rwlock_read_unlock(RWLock_t rwlock);
+
+int OS_rwlock_write_lock(RWLock_t rwlock, TickType_t timeout);
+
+int OS_rwlock_write_unlock(RWLock_t rwlock);
+
+#endif /* OS_RWLOCK_H */
@@ -9,7 +9,53 @@
 * MACROS
 *******************************************************************************/
 
-#define OS_PRIO_MAP_SIZE (OS_MAX_PRIORITIES / 8)
+/* Number of priorities tracked by a single word of the ready priority bitmap */
+#define OS_PRIO_MAP_WORD_BITS 32
+
+/* Number of words in the ready priority bitmap. Must fit in the summary word */
+#define OS_PRIO_MAP_SIZE (OS_MAX_PRIORITIES / OS_PRIO_MAP_WORD_BITS)
+
+#if (OS_PRIO_MAP_SIZE > OS_PRIO_MAP_WORD_BITS)
+    #error OS_MAX_PRIORITIES is too large for a two level priority bitmap
+#endif
+
+/* Index of the most significant set bit in a non-zero 32 bit word */
+#define OS_PRIO_MAP_HIGHEST_BIT(word) (31 - __builtin_clz((word)))
+
+/* Each core has its own ready queue. Tasks with no affinity share one extra queue */
+#define OS_READY_QUEUE_SHARED portNUM_PROCESSORS
+#define OS_NUM_READY_QUEUES (portNUM_PROCESSORS + 1)
+
+/**
+ * Delayed tasks are kept in a hierarchical timing wheel. Each level has 32 
+ * slots and one slot of level N spans 32^N ticks, so four levels cover delays
+ * of up to 2^20 ticks. Anything further out waits on a separate far list
+ */
+#define OS_DELAY_WHEEL_LEVELS 4
+#define OS_DELAY_WHEEL_SLOT_BITS 5
+#define OS_DELAY_WHEEL_SLOTS (1 << OS_DELAY_WHEEL_SLOT_BITS)
+#define OS_DELAY_WHEEL_SLOT_MASK (OS_DELAY_WHEEL_SLOTS - 1)
+#define OS_DELAY_WHEEL_SHIFT(level) ((level) * OS_DELAY_WHEEL_SLOT_BITS)
+#define OS_DELAY_WHEEL_RANGE ((TickType_t)1 << OS_DELAY_WHEEL_SHIFT(OS_DELAY_WHEEL_LEVELS))
+
+/* Set to 0 to stop counting acquisitions and contentions on scheduler locks */
+#ifndef OS_SCHEDULE_LOCK_STATS
+    #define OS_SCHEDULE_LOCK_STATS 1
+#endif /* OS_SCHEDULE_LOCK_STATS */
+
+#define OS_SCHEDULE_LOCK_INITIALIZER { .mux = portMUX_INITIALIZER_UNLOCKED }
+
+/* Idle only suppresses the tick if it expects to sleep for at least this many ticks */
+#ifndef OS_IDLE_TIME_BEFORE_SLEEP
+    #ifdef configEXPECTED_IDLE_TIME_BEFORE_SLEEP
+        #define OS_IDLE_TIME_BEFORE_SLEEP configEXPECTED_IDLE_TIME_BEFORE_SLEEP
+    #else
+        #define OS_IDLE_TIME_BEFORE_SLEEP 2
+    #endif
+#endif /* OS_IDLE_TIME_BEFORE_SLEEP */
+
+/* The core whose tick interrupt moves the tick counter forward */
+#define OS_TICK_CORE_ID 0
 
 /*******************************************************************************
 * TYPEDEFS AND DATA STRUCTURES
@@ -23,12 +69,49 @@ typedef struct OSTaskListHeader DeletionList_t;
 typedef struct OSTaskListHeader DelayedList_t;
 typedef struct OSTaskListHeader SuspendedList_t;
 
+/**
+ * A ready queue holds one round robin list per priority along with the 
+ * two level bitmap of which priorities in those lists are in use
+ */
+typedef struct OSReadyQueue {
+    uint32_t priorities_summary;
+    uint32_t priorities_map[OS_PRIO_MAP_SIZE];
+    ReadyList_t lists[OS_MAX_PRIORITIES];
+} ReadyQueue_t;
+
+/**
+ * A spinlock guarding one part of the scheduler state.
+ * See schedule.c for what each lock guards and the order they are taken in
+ */
+typedef struct OSScheduleLock {
+    portMUX_TYPE mux;
+#if OS_SCHEDULE_LOCK_STATS
+    /* Number of times the lock was taken */
+    volatile uint32_t acquisitions;
+    /* Number of times the lock was already held by another core when taken */
+    volatile uint32_t contentions;
+#endif /* OS_SCHEDULE_LOCK_STATS */
+} SchedLock_t;
+
+/* A snapshot of the counters of a single scheduler lock */
+typedef struct OSScheduleLockStats {
+    uint32_t acquisitions;
+    uint32_t contentions;
+} SchedLockStats_t;
+
 typedef enum {
     OS_SCHEDULE_STATE_STOPPED,
     OS_SCHEDULE_STATE_RUNNING,
     OS_SCHEDULE_STATE_SUSPENDED
 } OSScheduleState_t;
 
+typedef enum {
+    /* Something became ready since the sleep was planned. Don't sleep */
+    OS_SLEEP_ABORT,
+    /* Sleep for no longer than the expected idle time */
+    OS_SLEEP_STANDARD
+} OSSleepStatus_t;
+
 /* Stolen from FreeRTOS. Create my own version later */
 typedef struct xTIME_OUT
 {
@@ -54,7 +137,7 @@ void OS_schedule_switch_context(void);
 
 int OS_schedule_add_task(TCB_t *new_tcb);
 
-int OS_schedule_remove_task(TCB_t *old_tcb);
+int OS_schedule_remove_task(TCB_t *old_tcb, OSBool_t *reclaim);
 
 int OS_schedule_delay_task(TCB_t *tcb, TickType_t tick_delay);
 
@@ -62,6 +145,10 @@ int OS_schedule_suspend_task(TCB_t *tcb);
 
 int OS_schedule_resume_task(TCB_t *tcb);
 
+int OS_schedule_block_current_task(TickType_t timeout);
+
+OSBool_t OS_schedule_unblock_task(TCB_t *tcb);
+
 int OS_schedule_change_task_prio(TCB_t *tcb, TaskPrio_t new_prio);
 
 void OS_schedule_raise_priority_mutex_holder(TCB_t *mutex_holder);
@@ -74,6 +161,10 @@ void OS_schedule_waitlist_empty(WaitList_t *waitlist);
 
 OSBool_t OS_schedule_process_tick(void);
 
+OSBool_t OS_schedule_process_ticks(TickType_t ticks);
+
+TCB_t* OS_schedule_pop_deleted_task(void);
+
 TCB_t* OS_schedule_get_idle_tcb(int core_ID);
 
 TCB_t* OS_schedule_get_current_tcb(void);
@@ -84,6 +175,17 @@ OSScheduleState_t OS_schedule_get_state(void);
 
 TickType_t OS_schedule_get_tick_count(void);
 
+TickType_t OS_schedule_get_expected_idle_time(void);
+
+OSSleepStatus_t OS_schedule_confirm_sleep_mode_status(void);
+
+void OS_schedule_step_tick(TickType_t ticks);
+
+void OS_schedule_get_lock_stats(SchedLockStats_t *ready_stats, SchedLockStats_t *delayed_stats, 
+        SchedLockStats_t *suspended_stats, SchedLockStats_t *deletion_stats);
+
+void OS_schedule_reset_lock_stats(void);
+
 void * OS_schedule_increment_task_mutex_count(void);
 
 void OS_set_timeout_state( TimeOut_t * const pxTimeOut );
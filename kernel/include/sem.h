@@ -7,6 +7,24 @@
 * MACROS
 *******************************************************************************/
 
+/* Set in a mutex's owner word while tasks are blocked on it. TCBs are word 
+aligned, so bit 0 of the owner's address is always free */
+#define OS_MUTEX_WAITERS ((uint32_t)1)
+#define OS_MUTEX_OWNER(owner_word) ((TCB_t *)((owner_word) & ~OS_MUTEX_WAITERS))
+
+/* A semaphore's state word holds its count above two flag bits. A release 
+only takes the semaphore's mux when a flag is set */
+#define OS_SEM_WAITERS ((uint32_t)1 << 0)
+#define OS_SEM_IN_SET ((uint32_t)1 << 1)
+#define OS_SEM_FLAGS (OS_SEM_WAITERS | OS_SEM_IN_SET)
+#define OS_SEM_COUNT_SHIFT 2
+#define OS_SEM_COUNT_ONE ((uint32_t)1 << OS_SEM_COUNT_SHIFT)
+#define OS_SEM_COUNT(state) ((int)((state) >> OS_SEM_COUNT_SHIFT))
+#define OS_SEM_MAX_VALUE ((int)(UINT32_MAX >> OS_SEM_COUNT_SHIFT))
+
+/* The adaptive spin budget never shrinks below this many cycles */
+#define OS_SYNC_SPIN_MIN_CYCLES 64
+
 /*******************************************************************************
 * TYPEDEFS AND DATA STRUCTURES
 *******************************************************************************/
@@ -15,14 +33,69 @@
 typedef void * Sem_t;
 typedef void * Mux_t;
 
+/* Counters of how takes that found the object unavailable were resolved */
+typedef struct OSSyncSpinStats {
+    /* Takes that spun waiting for the other core */
+    uint32_t spins;
+    /* Spins that got the object without blocking */
+    uint32_t spin_successes;
+    /* Takes that had to block */
+    uint32_t blocks;
+} SyncSpinStats_t;
+
+/**
+ * Spin-then-block settings of a semaphore or mutex. A take spins for up to
+ * budget cycles while the other core could release the object, and only 
+ * then blocks. The budget doubles after a successful spin and halves after 
+ * a failed one, between OS_SYNC_SPIN_MIN_CYCLES and max_cycles
+ */
+typedef struct OSSyncSpin {
+    /* 0 disables spinning */
+    uint32_t max_cycles;
+    volatile uint32_t budget;
+    SyncSpinStats_t stats;
+} SyncSpin_t;
+
 /* The main structure for a semaphore */
 typedef struct OSSemaphore {
-    int value;
+    /* The count and OS_SEM_* flags. Only changed with uxPortCompareSet. Flags 
+    are only changed while holding mux, the count may change without it */
+    volatile uint32_t state;
     WaitList_t waiters;
 
+    /* The queue set this semaphore belongs to, or NULL, and the most units
+    it may count while in the set */
+    QueueSet_t *queue_set;
+    int set_max_count;
+
+    SyncSpin_t spin;
+
+    /* Releases give their unit straight to the highest priority waiter 
+    instead of raising the count. See OS_sem_set_handoff */
+    OSBool_t handoff;
+
     portMUX_TYPE mux;
 } Semaphore_t;
 
+/**
+ * A mutex with an owner, recursion and priority inheritance. The owner word 
+ * is the owning TCB (plus OS_MUTEX_WAITERS), or 0 if the mutex is free, so an
+ * uncontended take or release is a single compare-and-set. mux is only taken
+ * once tasks have to wait
+ */
+typedef struct OSMutex {
+    volatile uint32_t owner;
+
+    /* Takes by the owner beyond the first. Only touched by the owner */
+    int recursion;
+
+    WaitList_t waiters;
+
+    SyncSpin_t spin;
+
+    portMUX_TYPE mux;
+} Mutex_t;
+
 /*******************************************************************************
 * FUNCTION HEADERS
 *******************************************************************************/
@@ -33,14 +106,32 @@ int OS_sem_delete(Sem_t *sem_ptr);
 
 int OS_sem_take(Sem_t semaphore);
 
+int OS_sem_take_timeout(Sem_t semaphore, TickType_t timeout);
+
+int OS_sem_try_take(Sem_t semaphore);
+
 int OS_sem_release(Sem_t semaphore);
 
-inline int OS_mux_create(Mux_t *mux_ptr);
+int OS_sem_set_handoff(Sem_t semaphore, OSBool_t handoff);
+
+int OS_sem_set_spin(Sem_t semaphore, uint32_t max_cycles);
+
+int OS_sem_get_spin_stats(Sem_t semaphore, SyncSpinStats_t *stats);
+
+uint32_t _OS_sem_update_state(Semaphore_t *sem, uint32_t clear, uint32_t set, uint32_t add);
+
+int OS_mux_create(Mux_t *mux_ptr);
+
+int OS_mux_delete(Mux_t *mux_ptr);
+
+int OS_mux_take(Mux_t mutex);
+
+int OS_mux_try_take(Mux_t mutex);
 
-inline int OS_mux_delete(Mux_t *mux_ptr);
+int OS_mux_release(Mux_t mutex);
 
-inline int OS_mux_take(Mux_t mutex);
+int OS_mux_set_spin(Mux_t mutex, uint32_t max_cycles);
 
-inline int OS_mux_release(Mux_t mutex);
+int OS_mux_get_spin_stats(Mux_t mutex, SyncSpinStats_t *stats);
 
-#endif /* OS_SEM_H */
\ No newline at end of file
+#endif /* OS_SEM_H */
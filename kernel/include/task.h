@@ -15,7 +15,21 @@
 * MACROS
 *******************************************************************************/
 
-#define OS_TID_TABLE_INITIAL_SIZE 64
+/* A tid holds a tid table index in its low bits and the generation of that
+table slot above it, so a stale tid never resolves to a recycled slot */
+#define OS_TID_INDEX_BITS 12
+#define OS_TID_INDEX_MASK ((1 << OS_TID_INDEX_BITS) - 1)
+#define OS_TID_GENERATION_MASK ((int)(INT_MAX >> OS_TID_INDEX_BITS))
+#define OS_TID_MAKE(index, generation) (Tid_t)(((generation) << OS_TID_INDEX_BITS) | (index))
+
+/* The tid table is grown in chunks that are never moved or freed */
+#define OS_TID_CHUNK_BITS 6
+#define OS_TID_CHUNK_SIZE (1 << OS_TID_CHUNK_BITS)
+#define OS_TID_CHUNK_MASK (OS_TID_CHUNK_SIZE - 1)
+#define OS_TID_MAX_CHUNKS (1 << (OS_TID_INDEX_BITS - OS_TID_CHUNK_BITS))
+
+/* Stored in free tid table slots. Never matches a valid tid */
+#define OS_TID_FREE (Tid_t)-2
 
 #define CORE_NO_AFFINITY INT_MAX
 
@@ -29,6 +43,9 @@
 
 #define OS_CURRENT_TASK (Tid_t)-1
 
+/* The most deleted tasks idle will free in a single pass */
+#define OS_TASK_RECLAIM_BATCH 4
+
 /*******************************************************************************
 * TYPEDEFS AND DATA STRUCTURES
 *******************************************************************************/
@@ -39,6 +56,20 @@ typedef uint8_t TaskPrio_t;
 /* The function pointer representing a task function */
 typedef void (*TaskFunc_t)( void * );
 
+/* A task ID. See OS_TID_MAKE for its layout */
+typedef int Tid_t;
+
+/* An entry of the tid table */
+typedef struct OSTidSlot {
+    /* The tid currently assigned to this slot, or OS_TID_FREE */
+    volatile Tid_t tid;
+    volatile TCB_t *tcb;
+    /* Bumped each time the slot is released */
+    int generation;
+    /* Index of the next free slot while this slot is on the free list */
+    int next_free;
+} TidSlot_t;
+
 /* If we ever want to pass TCBs around anonymously, cast as TaskHandle_t */
 typedef void * TaskHandle_t;
 
@@ -52,9 +83,53 @@ typedef enum {
     OS_TASK_STATE_READY_TO_DELETE
 } OSTaskState_t;
 
+/* What a notification does to the receiving task's notification value.
+In the same order as FreeRTOS' eNotifyAction so the two can be cast */
+typedef enum {
+    OS_NOTIFY_NO_ACTION,
+    OS_NOTIFY_SET_BITS,
+    OS_NOTIFY_INCREMENT,
+    OS_NOTIFY_OVERWRITE,
+    OS_NOTIFY_NO_OVERWRITE
+} OSNotifyAction_t;
+
+typedef enum {
+    /* No notification is pending and the task isn't waiting for one */
+    OS_NOTIFY_STATE_NONE,
+    /* The task is blocked waiting for a notification */
+    OS_NOTIFY_STATE_WAITING,
+    /* A notification arrived that the task hasn't consumed yet */
+    OS_NOTIFY_STATE_PENDING
+} OSNotifyState_t;
+
 typedef void *TLSPtr_t;
 typedef void (*TLSPtrDeleteCallback_t)(int, void *);
 
+/**
+ * Bookkeeping for a task blocked on a kernel resource such as a message queue
+ */
+typedef struct OSBlockRecord {
+    /* The waitlist the task is on, or NULL if it isn't waiting */
+    WaitList_t *waitlist;
+    TCB_t *waitlist_next_ptr;
+    TCB_t *waitlist_prev_ptr;
+
+    /* The mux of the kernel object owning the waitlist, or NULL if the 
+    scheduler locks guard it. The scheduler never dequeues a task from a 
+    waitlist guarded by an object's mux. The task dequeues itself instead */
+    portMUX_TYPE *waitlist_mux;
+
+    /* Set when the task was woken by being handed the resource it waited for,
+    so it must not try to take it again. Cleared on every waitlist append */
+    OSBool_t granted;
+
+    /* The condition of a task in OS_event_group_wait. The bits waited for, 
+    OS_EVENT_WAIT_* options, and the group's bits when the condition was met */
+    uint32_t event_bits;
+    uint32_t event_options;
+    uint32_t event_result;
+} BlockRecord_t;
+
 /**
  * Defines the memory ranges allocated to the task when an MPU is used.
  */
@@ -110,9 +185,12 @@ struct OSTaskControlBlock
     TCB_t *prev_ptr;
 
     /* Data for if the task is blocked for accessing a resource */
-    OSBool_t is_blocked;
     BlockRecord_t block_record;
 
+    /* Direct to task notifications. Guarded by task_state_mux */
+    volatile uint32_t notify_value;
+    volatile OSNotifyState_t notify_state;
+
     /* Tasks waiting on this task to die */
     WaitList_t *join_waitlist;
 
@@ -126,6 +204,9 @@ struct OSTaskControlBlock
     /* Time to wake this task up if it has been delayed */
     TickType_t delay_wakeup_time;
 
+    /* The timing wheel slot (or far list) holding this task while delayed */
+    volatile struct OSTaskListHeader *delay_slot;
+
     struct 	_reent xNewLib_reent;
 
     /* This list item is necessary for now until we are no longer reliant on FreeRTOS's
@@ -141,10 +222,16 @@ struct OSTaskControlBlock
 *******************************************************************************/
 
 int OS_task_create(TaskFunc_t task_func, void *task_arg, const char * const task_name, 
-            TaskPrio_t prio, int stack_size, int msg_queue_size, int core_ID, int *tid);
+            TaskPrio_t prio, int stack_size, int msg_queue_size, int core_ID, Tid_t *task_tid);
+
+int OS_task_create_static(TaskFunc_t task_func, void *task_arg, const char * const task_name, 
+            TaskPrio_t prio, int stack_size, StackType_t *stack_buffer, TCB_t *tcb_buffer,
+            int msg_queue_size, int core_ID, Tid_t *task_tid);
 
 int OS_task_delete(Tid_t tid);
 
+int OS_task_reclaim_deleted(int max_tasks);
+
 int OS_task_join(Tid_t tid, TickType_t timeout);
 
 char * OS_task_get_name(Tid_t tid);
@@ -163,4 +250,17 @@ int OS_task_send_msg(Tid_t tid, TickType_t timeout, const void * const data);
 
 int OS_task_receive_msg(TickType_t timeout, void ** data);
 
+int OS_task_notify(Tid_t tid, uint32_t value, OSNotifyAction_t action);
+
+int OS_task_notify_from_ISR(Tid_t tid, uint32_t value, OSNotifyAction_t action, OSBool_t *higher_prio_woken);
+
+int OS_task_notify_wait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t timeout);
+
+uint32_t OS_task_notify_take(OSBool_t clear_on_exit, TickType_t timeout);
+
+int _OS_task_notify(TCB_t *tcb, uint32_t value, OSNotifyAction_t action, uint32_t *prev_value);
+
+int _OS_task_notify_from_ISR(TCB_t *tcb, uint32_t value, OSNotifyAction_t action, 
+            uint32_t *prev_value, OSBool_t *higher_prio_woken);
+
 #endif /* OS_TASK_H */
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef OS_TASK_POOL_H
+#define OS_TASK_POOL_H
+
+#include "verios.h"
+#include "task.h"
+
+/*******************************************************************************
+* MACROS
+*******************************************************************************/
+
+/* Number of TCBs allocated in one go when the TCB pool runs dry */
+#define OS_TASK_POOL_TCB_SLAB_SIZE 4
+
+/* Stacks are pooled in size classes (measured in StackType_t) that double
+starting from this size */
+#define OS_TASK_POOL_MIN_STACK_SIZE 1024
+#define OS_TASK_POOL_NUM_STACK_CLASSES 4
+
+/* Stacks larger than the biggest class are not pooled and come from the heap */
+#define OS_TASK_POOL_MAX_STACK_SIZE \
+    (OS_TASK_POOL_MIN_STACK_SIZE << (OS_TASK_POOL_NUM_STACK_CLASSES - 1))
+
+/*******************************************************************************
+* TYPEDEFS AND DATA STRUCTURES
+*******************************************************************************/
+
+/* A free block in a pool. The link is stored in the free memory itself */
+typedef struct OSTaskPoolBlock TaskPoolBlock_t;
+
+struct OSTaskPoolBlock {
+    TaskPoolBlock_t *next_ptr;
+};
+
+/* A free list of equally sized blocks */
+typedef struct OSTaskPoolList {
+    /* Blocks currently on the free list */
+    int num_free;
+    /* Blocks ever allocated for this list. Never decremented */
+    int num_total;
+    TaskPoolBlock_t *head_ptr;
+} TaskPoolList_t;
+
+/* A snapshot of the state of the task pools */
+typedef struct OSTaskPoolStats {
+    int tcbs_free;
+    int tcbs_total;
+    int stacks_free[OS_TASK_POOL_NUM_STACK_CLASSES];
+    int stacks_total[OS_TASK_POOL_NUM_STACK_CLASSES];
+    /* Number of stacks too large for any class, taken from the heap */
+    int stack_heap_allocs;
+} TaskPoolStats_t;
+
+/*******************************************************************************
+* FUNCTION HEADERS
+*******************************************************************************/
+
+int OS_task_pool_prewarm(int num_tcbs, int stack_size, int num_stacks);
+
+void OS_task_pool_get_stats(TaskPoolStats_t *stats);
+
+TCB_t * _OS_task_pool_alloc_tcb(void);
+
+void _OS_task_pool_free_tcb(TCB_t *tcb);
+
+StackType_t * _OS_task_pool_alloc_stack(int stack_size);
+
+void _OS_task_pool_free_stack(StackType_t *stack, int stack_size);
+
+#endif /* OS_TASK_POOL_H */
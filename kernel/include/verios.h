@@ -25,6 +25,8 @@
 
 typedef struct OSTaskControlBlock TCB_t;
 
+typedef struct OSQueueSet QueueSet_t;
+
 typedef uint8_t OSBool_t;
 
 typedef enum OS_error_codes {
@@ -37,6 +39,8 @@ typedef enum OS_error_codes {
     OS_ERROR_TCB_ALLOC,
     OS_ERROR_IDLE_DELETE,
     OS_ERROR_DOUBLE_DELETE,
+    OS_ERROR_INVALID_TID,
+    OS_ERROR_TID_ALLOC,
 
     OS_ERROR_INVALID_TSK_STATE,
     OS_ERROR_INVALID_PRIO,
@@ -48,20 +52,54 @@ typedef enum OS_error_codes {
     OS_ERROR_DELETED_TASK,
     OS_ERROR_DELAYED_TASK,
     OS_ERROR_SUSPENDED_TASK,
+    OS_ERROR_BLOCKED_TASK,
 
     /* Attempting an operation that is not permitted based on the scheduler's current state */
     OS_ERROR_SCHEDULER_STOPPED,
 
     /* Msg Queue creation and deletion */
     OS_ERROR_INVALID_QUEUE_SIZE,
+    OS_ERROR_INVALID_QUEUE,
     OS_ERROR_QUEUE_ALLOC,
     OS_ERROR_QUEUE_NULL_PTR,
     OS_ERROR_QUEUE_FULL,
     OS_ERROR_QUEUE_EMPTY,
     OS_ERROR_MSG_POOL_RETR,
+    OS_ERROR_QUEUE_LOAN,
+
+    /* Semaphores */
+    OS_ERROR_SEM_ALLOC,
+    OS_ERROR_INVALID_SEM,
+    OS_ERROR_SEM_UNAVAILABLE,
+    OS_ERROR_INVALID_SEM_VALUE,
+
+    /* Mutexes */
+    OS_ERROR_MUTEX_ALLOC,
+    OS_ERROR_INVALID_MUTEX,
+    OS_ERROR_MUTEX_NOT_OWNER,
+
+    /* Queue sets */
+    OS_ERROR_QUEUE_SET_ALLOC,
+    OS_ERROR_INVALID_QUEUE_SET,
+    OS_ERROR_QUEUE_SET_FULL,
+    OS_ERROR_QUEUE_SET_MEMBER,
+
+    /* Reader-writer locks */
+    OS_ERROR_RWLOCK_ALLOC,
+    OS_ERROR_INVALID_RWLOCK,
+    OS_ERROR_RWLOCK_UNAVAILABLE,
+    OS_ERROR_RWLOCK_NOT_OWNER,
+
+    /* Event groups */
+    OS_ERROR_EVENT_GROUP_ALLOC,
+    OS_ERROR_INVALID_EVENT_GROUP,
+    OS_ERROR_INVALID_EVENT_BITS,
+    OS_ERROR_EVENT_BITS_UNAVAILABLE,
 
     /* Task IPC */
     OS_ERROR_NO_TASK_QUEUE,
+    OS_ERROR_NOTIFY_PENDING,
+    OS_ERROR_INVALID_NOTIFY_ACTION,
 
     /* Waiting on a resource */
     OS_ERROR_TIMER_EXPIRED,
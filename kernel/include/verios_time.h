@@ -14,6 +14,16 @@
 
 #define OS_NO_TIMEOUT (TickType_t)-1
 
+/* The longest finite delay. Anything longer is the same as OS_NO_TIMEOUT */
+#define OS_MAX_DELAY (OS_NO_TIMEOUT - 1)
+
+/**
+ * Tick times are compared relative to the current tick so that they stay 
+ * ordered across a tick counter wraparound. This is the number of ticks from
+ * 'now' until 'when' (a time in the past looks like a very long delay)
+ */
+#define OS_TICKS_UNTIL(when, now) ((TickType_t)((when) - (now)))
+
 /*******************************************************************************
 * FUNCTION HEADERS
 *******************************************************************************/
@@ -20,7 +20,7 @@
 *******************************************************************************/
 
 
-void _OS_waitlist_append(TCB_t *tcb, WaitList_t *waitlist);
+void _OS_waitlist_append(TCB_t *tcb, WaitList_t *waitlist, portMUX_TYPE *waitlist_mux);
 
 void _OS_waitlist_remove(TCB_t *tcb);
 
@@ -16,6 +16,7 @@ task.h is included from an application file. */
 #include "task.h"
 #include "schedule.h"
 #include "msg_queue.h"
+#include "queue_set.h"
 #include "verios_util.h"
 #include "StackMacros.h"
 #include "portmacro.h"
@@ -26,12 +27,17 @@ task.h is included from an application file. */
 * SCHEDULER CRITICAL STATE VARIABLES
 *******************************************************************************/
 
-/* A list of messages for use/reuse. Works similar to 'slab allocation' */
-PRIVILEGED_DATA static volatile MessagePool_t OS_msg_pool = {0, NULL, NULL};
+/* The shared depot of messages for use/reuse, kept as slabs with free lists */
+PRIVILEGED_DATA static volatile MessagePool_t OS_msg_pool = {0, NULL};
+
+/* Per-core caches in front of the depot. Only touched by their own core with 
+interrupts disabled, so most messages never need OS_message_mutex */
+PRIVILEGED_DATA static MessageCache_t OS_msg_cache[portNUM_PROCESSORS];
 
 /* A counter of all messages that have been allocated and exist in various places */
 PRIVILEGED_DATA static volatile int OS_msg_count = 0;
 
+/* Mutex for the depot. Never held across a heap call */
 PRIVILEGED_DATA static portMUX_TYPE OS_message_mutex = portMUX_INITIALIZER_UNLOCKED;
 
 /*******************************************************************************
@@ -40,12 +46,73 @@ PRIVILEGED_DATA static portMUX_TYPE OS_message_mutex = portMUX_INITIALIZER_UNLOC
 
 static Message_t * _OS_msg_pool_retrieve(void);
 
-static void _OS_msg_pool_insert(Message_t *msg);
+static void _OS_msg_pool_insert(Message_t *msg_list);
+
+static int _OS_msg_depot_take(Message_t **head_ptr, Message_t **tail_ptr, int max_messages);
+
+static void _OS_msg_depot_give(Message_t *msg_list);
+
+static int _OS_msg_depot_grow(void);
+
+static MsgSlab_t * _OS_msg_depot_unlink_free_slab(void);
 
 static void _OS_msg_queue_insert(MessageQueue_t *msg_queue, Message_t *msg);
 
 static Message_t * _OS_msg_queue_pop(MessageQueue_t *msg_queue);
 
+static int _OS_msg_queue_send(MessageQueue_t *msg_queue, TickType_t timeout, const void * const item);
+
+static int _OS_msg_queue_receive(MessageQueue_t *msg_queue, TickType_t timeout, void * const item);
+
+static int _OS_msg_queue_try_send(MessageQueue_t *msg_queue, const void * const item);
+
+static int _OS_msg_queue_try_receive(MessageQueue_t *msg_queue, void * const item);
+
+static int _OS_msg_queue_send_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            const uint8_t *items, int num_items, int *num_sent);
+
+static int _OS_msg_queue_receive_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            uint8_t *items, int max_items, int *num_received);
+
+static int _OS_msg_queue_put(MessageQueue_t *msg_queue, TCB_t *sender, const void * const item);
+
+static void _OS_msg_queue_get(MessageQueue_t *msg_queue, void * const item, Message_t **spent_list);
+
+static inline void _OS_msg_copy_item(void *dest, const void *src, int item_size);
+
+static int _OS_msg_queue_create_ring(MsgQueue_t * queue_ptr, int queue_size, int item_size, 
+            OSMsgQueueMode_t mode);
+
+static int _OS_msg_spsc_send(MessageQueue_t *msg_queue, TickType_t timeout, const void * const item);
+
+static int _OS_msg_spsc_receive(MessageQueue_t *msg_queue, TickType_t timeout, void * const item);
+
+static OSBool_t _OS_msg_spsc_try_put(MessageQueue_t *msg_queue, const void * const item);
+
+static OSBool_t _OS_msg_spsc_try_get(MessageQueue_t *msg_queue, void * const item);
+
+static int _OS_msg_spsc_send_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            const uint8_t *items, int num_items, int *num_sent);
+
+static int _OS_msg_spsc_receive_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            uint8_t *items, int max_items, int *num_received);
+
+static int _OS_msg_spsc_block(MessageQueue_t *msg_queue, uint32_t flag, TickType_t timeout);
+
+static void _OS_msg_spsc_publish(MessageQueue_t *msg_queue, int next);
+
+static int _OS_msg_queue_reserve_tail(MessageQueue_t *msg_queue, TickType_t timeout, void ** slot);
+
+static int _OS_msg_queue_reserve_head(MessageQueue_t *msg_queue, TickType_t timeout, void ** slot);
+
+static int _OS_msg_queue_wait(MessageQueue_t *msg_queue, WaitList_t *waitlist, TickType_t timeout);
+
+static OSBool_t _OS_msg_queue_claim(MessageQueue_t *msg_queue, uint32_t flag);
+
+static void _OS_msg_queue_unclaim(MessageQueue_t *msg_queue, uint32_t flag);
+
+static void _OS_msg_spsc_wake(MessageQueue_t *msg_queue, uint32_t flag);
+
 /*******************************************************************************
 * Message Queue Create (API FUNCTION)
 *
@@ -89,6 +156,110 @@ int OS_msg_queue_create(MsgQueue_t * queue_ptr, int queue_size)
     return OS_NO_ERROR;
 }
 
+/*******************************************************************************
+* Message Queue Create Ring (API FUNCTION)
+*
+*   queue_ptr = A reference to the pointer where the queue will be allocated
+*   queue_size = The maximum number of messages the queue should hold 
+* 
+* PURPOSE :
+*
+*   Create a message queue backed by a contiguous ring of queue_size slots,
+*   allocated along with the queue. Sending and receiving is index arithmetic
+*   under the queue's lock, without touching the global message pool
+* 
+* RETURN :
+*   
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES: 
+*
+*   Used with the same send/receive calls as a queue from OS_msg_queue_create.
+*   The ring is allocated up front, so very large sizes cost memory even when
+*   the queue is empty
+*******************************************************************************/
+
+int OS_msg_queue_create_ring(MsgQueue_t * queue_ptr, int queue_size)
+{
+    return _OS_msg_queue_create_ring(queue_ptr, queue_size, sizeof(void *), OS_MSG_QUEUE_MODE_RING);
+}
+
+/*******************************************************************************
+* Message Queue Create SPSC (API FUNCTION)
+*
+*   queue_ptr = A reference to the pointer where the queue will be allocated
+*   queue_size = The maximum number of messages the queue should hold 
+* 
+* PURPOSE :
+*
+*   Create a ring queue for exactly one sending task and one receiving task.
+*   Sends and receives that don't need to block are lock free, and the queue's
+*   mux is only taken when one side has to block or wake the other
+* 
+* RETURN :
+*   
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES: 
+*
+*   The two sides can be on different cores, but having two senders or two 
+*   receivers at once will corrupt the queue
+*******************************************************************************/
+
+int OS_msg_queue_create_spsc(MsgQueue_t * queue_ptr, int queue_size)
+{
+    return _OS_msg_queue_create_ring(queue_ptr, queue_size, sizeof(void *), OS_MSG_QUEUE_MODE_SPSC);
+}
+
+/*******************************************************************************
+* Message Queue Create Fixed (API FUNCTION)
+*
+*   queue_ptr = A reference to the pointer where the queue will be allocated
+*   queue_size = The maximum number of messages the queue should hold 
+*   item_size = The size in bytes of every message
+*   mode = OS_MSG_QUEUE_MODE_RING or OS_MSG_QUEUE_MODE_SPSC
+* 
+* PURPOSE :
+*
+*   Create a ring queue that holds messages by value. Each send copies 
+*   item_size bytes into the queue's own storage and each receive copies them 
+*   back out, so the sender doesn't need to keep the message alive (or 
+*   allocate it) until the receiver is done with it
+* 
+* RETURN :
+*   
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES: 
+*
+*   Use the OS_msg_queue_*_copy calls with these queues. Messages of up to
+*   OS_MSG_INLINE_COPY_SIZE bytes that are word sized and aligned are copied 
+*   inline instead of with memcpy
+*******************************************************************************/
+
+int OS_msg_queue_create_fixed(MsgQueue_t * queue_ptr, int queue_size, int item_size, 
+            OSMsgQueueMode_t mode)
+{
+    MessageQueue_t *msg_queue;
+    int ret_val;
+
+    if(item_size <= 0) {
+        return OS_ERROR_INVALID_QUEUE_SIZE;
+    }
+    if(mode != OS_MSG_QUEUE_MODE_RING && mode != OS_MSG_QUEUE_MODE_SPSC) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+
+    ret_val = _OS_msg_queue_create_ring(queue_ptr, queue_size, item_size, mode);
+    if(ret_val != OS_NO_ERROR) {
+        return ret_val;
+    }
+
+    msg_queue = (MessageQueue_t *)*queue_ptr;
+    msg_queue->copy_items = OS_TRUE;
+    return OS_NO_ERROR;
+}
+
 /*******************************************************************************
 * Message Queue Delete (API FUNCTION)
 *
@@ -109,25 +280,26 @@ int OS_msg_queue_create(MsgQueue_t * queue_ptr, int queue_size)
 int OS_msg_queue_delete(MsgQueue_t queue)
 {
     MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
-    Message_t *retrieved_message;
+    Message_t *spent_list = NULL;
 
     if(msg_queue == NULL) {
         return OS_ERROR_INVALID_QUEUE;
     }
 
     portENTER_CRITICAL(&(msg_queue->mux));
+    if(msg_queue->queue_set != NULL) {
+        _OS_queue_set_remove_member(msg_queue->queue_set, msg_queue, msg_queue->max_messages);
+        msg_queue->queue_set = NULL;
+    }
     OS_schedule_waitlist_empty(&(msg_queue->reveive_waiters));
     OS_schedule_waitlist_empty(&(msg_queue->send_waiters));
 
+    /* Return any linked messages to the pool. Ring slots go with the queue */
     while(msg_queue->num_messages != 0) {
-        retrieved_message = _OS_msg_queue_pop(msg_queue);
-
-        /* We are done with this message. Add to the pool for future re-use */
-        portENTER_CRITICAL(&OS_message_mutex);
-        _OS_msg_pool_insert(retrieved_message);
-        portEXIT_CRITICAL(&OS_message_mutex);
+        _OS_msg_queue_get(msg_queue, NULL, &spent_list);
     }
     portEXIT_CRITICAL(&(msg_queue->mux));
+    _OS_msg_pool_insert(spent_list);
     free(msg_queue);
     msg_queue = NULL;
     return OS_NO_ERROR;
@@ -160,80 +332,11 @@ int OS_msg_queue_delete(MsgQueue_t queue)
 int OS_msg_queue_send(MsgQueue_t queue, TickType_t timeout, const void * const data)
 {
     MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
-    Message_t *new_message = NULL;
-    TCB_t *sender = OS_schedule_get_current_tcb();
-    TCB_t *waiting_receiver = NULL;
 
-    if(msg_queue == NULL) {
+    if(msg_queue == NULL || msg_queue->copy_items == OS_TRUE) {
         return OS_ERROR_INVALID_QUEUE;
     }
-
-    while (OS_TRUE) {
-        portENTER_CRITICAL(&(msg_queue->mux));
-        
-        /* Add the message if there is room on the queue */
-        if (msg_queue->num_messages < msg_queue->max_messages)
-        {
-            
-            portENTER_CRITICAL(&OS_message_mutex);
-            new_message = _OS_msg_pool_retrieve();
-            portEXIT_CRITICAL(&OS_message_mutex);
-            
-            if (new_message == NULL)
-            {
-                portEXIT_CRITICAL(&(msg_queue->mux));
-                sender->is_blocked = OS_FALSE;
-                return OS_ERROR_MSG_POOL_RETR;
-            }
-
-            new_message->sender = sender;
-            new_message->contents = data;
-            new_message->next_ptr = NULL;
-
-            _OS_msg_queue_insert(msg_queue, new_message);
-
-            /* If tasks are waiting on this message queue, wake them up */
-            if(msg_queue->reveive_waiters.num_tasks != 0){
-                waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
-            }
-
-            portEXIT_CRITICAL(&(msg_queue->mux));
-
-            if(waiting_receiver != NULL){
-                /* Schedule the task that was waiting on a new message */
-                OS_schedule_resume_task(waiting_receiver);
-            }
-            sender->is_blocked = OS_FALSE;
-            return OS_NO_ERROR;
-        }
-
-        /* We were unable to add the message */
-
-        /* The queue was destroyed */
-        if(msg_queue == NULL) {
-            portEXIT_CRITICAL(&(msg_queue->mux));
-            sender->is_blocked = OS_FALSE;
-            return OS_ERROR_RESOURCE_DESTROYED;
-        }
-
-        /* The timeout already went off, but we were unable to find queue room */
-        if(sender->is_blocked == OS_TRUE) {
-            portEXIT_CRITICAL(&(msg_queue->mux));
-            sender->is_blocked = OS_FALSE;
-            return OS_ERROR_QUEUE_FULL;
-        }
-
-        /* Add the task to a waitlist so that it can be woken up if theres room in the queue */
-        _OS_waitlist_append(sender, &(msg_queue->send_waiters));
-        
-        portEXIT_CRITICAL(&(msg_queue->mux));
-
-        sender->is_blocked = OS_TRUE;
-        OS_schedule_delay_task(sender, timeout);
-
-    }
-    sender->is_blocked = OS_FALSE;
-    return OS_NO_ERROR;
+    return _OS_msg_queue_send(msg_queue, timeout, &data);
 }
 
 /*******************************************************************************
@@ -264,73 +367,17 @@ int OS_msg_queue_send(MsgQueue_t queue, TickType_t timeout, const void * const d
 int OS_msg_queue_receive(MsgQueue_t queue, TickType_t timeout, void ** data)
 {
     MessageQueue_t * msg_queue = (MessageQueue_t *)queue;
-    Message_t *retrieved_message = NULL;
-    TCB_t *receiver = OS_schedule_get_current_tcb();
-    TCB_t *waiting_sender = NULL;
-
-    void *msg_contents;
+    int ret_val;
 
-    if(msg_queue == NULL) {
+    if(msg_queue == NULL || msg_queue->copy_items == OS_TRUE) {
         return OS_ERROR_INVALID_QUEUE;
     }
 
-    while(OS_TRUE) {
-        portENTER_CRITICAL(&(msg_queue->mux));
-
-        /* There is a message on the queue that we can retrieve */
-        if(msg_queue->num_messages > 0) {
-            retrieved_message = _OS_msg_queue_pop(msg_queue);
-            msg_contents = retrieved_message->contents;
-
-            /* We are done with this message. Add to the pool for future re-use */
-            portENTER_CRITICAL(&OS_message_mutex);
-            _OS_msg_pool_insert(retrieved_message);
-            portEXIT_CRITICAL(&OS_message_mutex);
-
-            /* If tasks are waiting on this message queue, wake them up */
-            if(msg_queue->send_waiters.num_tasks != 0){
-                waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
-            }
-
-            portEXIT_CRITICAL(&(msg_queue->mux));
-
-            if(waiting_sender != NULL){
-                /* Schedule the task that was waiting on a new message */
-                OS_schedule_resume_task(waiting_sender);
-            }
-            *data = msg_contents;
-            receiver->is_blocked = OS_FALSE;
-            return OS_NO_ERROR;
-        }
-
-        /* We were unable to read because no messages were sent */
-
-        /* The queue was destroyed */
-        if(msg_queue == NULL){
-            portEXIT_CRITICAL(&(msg_queue->mux));
-            *data = NULL;
-            receiver->is_blocked = OS_FALSE;
-            return OS_ERROR_RESOURCE_DESTROYED;
-        }
-
-        /* The timeout expired */
-        if(receiver->is_blocked == OS_TRUE) {
-            portEXIT_CRITICAL(&(msg_queue->mux));
-            *data = NULL;
-            receiver->is_blocked = OS_FALSE;
-            return OS_ERROR_TIMER_EXPIRED;
-        }
-
-        /* Add the task to a waitlist so that it can be woken up if theres room in the queue */
-        _OS_waitlist_append(receiver, &(msg_queue->reveive_waiters));
-        
-        portEXIT_CRITICAL(&(msg_queue->mux));
-
-        receiver->is_blocked = OS_TRUE;
-        OS_schedule_delay_task(receiver, timeout);
+    ret_val = _OS_msg_queue_receive(msg_queue, timeout, data);
+    if(ret_val != OS_NO_ERROR) {
+        *data = NULL;
     }
-    receiver->is_blocked = OS_FALSE;
-    return OS_NO_ERROR;
+    return ret_val;
 }
 
 /*******************************************************************************
@@ -359,52 +406,11 @@ int OS_msg_queue_receive(MsgQueue_t queue, TickType_t timeout, void ** data)
 int OS_msg_queue_try_send(MsgQueue_t queue, const void * const data)
 {
     MessageQueue_t * msg_queue = (MessageQueue_t *)queue;
-    Message_t *new_message = NULL;
-    TCB_t *sender = OS_schedule_get_current_tcb();
-    TCB_t *waiting_receiver = NULL;
 
-    if(msg_queue == NULL) {
+    if(msg_queue == NULL || msg_queue->copy_items == OS_TRUE) {
         return OS_ERROR_INVALID_QUEUE;
     }
-
-    portENTER_CRITICAL(&(msg_queue->mux));
-    
-    /* Add the message if there is room on the queue */
-    if (msg_queue->num_messages < msg_queue->max_messages)
-    {
-        
-        portENTER_CRITICAL(&OS_message_mutex);
-        new_message = _OS_msg_pool_retrieve();
-        portEXIT_CRITICAL(&OS_message_mutex);
-        
-        if (new_message == NULL)
-        {
-            return OS_ERROR_MSG_POOL_RETR;
-        }
-
-        new_message->sender = sender;
-        new_message->contents = data;
-        new_message->next_ptr = NULL;
-
-        _OS_msg_queue_insert(msg_queue, new_message);
-
-        /* If tasks are waiting on this message queue, wake them up */
-        if(msg_queue->reveive_waiters.num_tasks != 0){
-            waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
-        }
-
-        portEXIT_CRITICAL(&(msg_queue->mux));
-
-        if(waiting_receiver != NULL){
-            /* Schedule the task that was waiting on a new message */
-            OS_schedule_resume_task(waiting_receiver);
-        }
-
-        return OS_NO_ERROR;
-    }
-
-    portEXIT_CRITICAL(&(msg_queue->mux));
-    return -1;
+    return _OS_msg_queue_try_send(msg_queue, &data);
 }
 
 /*******************************************************************************
@@ -434,172 +440,1781 @@ int OS_msg_queue_try_send(MsgQueue_t queue, const void * const data)
 int OS_msg_queue_try_receive(MsgQueue_t queue, void ** data)
 {
     MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
-    Message_t *retrieved_message = NULL;
-    TCB_t *waiting_sender = NULL;
+    int ret_val;
 
-    void *msg_contents;
-
-    if(msg_queue == NULL) {
+    if(msg_queue == NULL || msg_queue->copy_items == OS_TRUE) {
         return OS_ERROR_INVALID_QUEUE;
     }
 
-    portENTER_CRITICAL(&(msg_queue->mux));
-
-    /* There is a message on the queue that we can retrieve */
-    if(msg_queue->num_messages > 0) {
-        retrieved_message = _OS_msg_queue_pop(msg_queue);
-        msg_contents = retrieved_message->contents;
-
-        /* We are done with this message. Add to the pool for future re-use */
-        portENTER_CRITICAL(&OS_message_mutex);
-        _OS_msg_pool_insert(retrieved_message);
-        portEXIT_CRITICAL(&OS_message_mutex);
-
-        /* If tasks are waiting on this message queue, wake them up */
-        if(msg_queue->send_waiters.num_tasks != 0){
-            waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
-        }
-
-        portEXIT_CRITICAL(&(msg_queue->mux));
-
-        if(waiting_sender != NULL){
-            /* Schedule the task that was waiting on a new message */
-            OS_schedule_resume_task(waiting_sender);
-        }
-
-        *data = msg_contents;
-        return OS_NO_ERROR;
+    ret_val = _OS_msg_queue_try_receive(msg_queue, data);
+    if(ret_val != OS_NO_ERROR) {
+        *data = NULL;
     }
-    portEXIT_CRITICAL(&(msg_queue->mux));
-    *data = NULL;
-    return OS_ERROR_QUEUE_EMPTY;
+    return ret_val;
 }
 
 /*******************************************************************************
-* OS Message Queue Init
+* Message Queue Send Copy (API FUNCTION)
 *
-*   msg_queue = A reference to the message queue to be initialized
-*   queue_size = The maximum capacity of the message queue
+*   queue = A queue from OS_msg_queue_create_fixed
+*   timeout = Max amount of time to wait if the queue is full
+*   item = The message to copy into the queue. Must be the queue's item size
 * 
 * PURPOSE : 
-*   
-*   Initializes the data members in a message queue
+*
+*   Copy a message into a fixed size queue, blocking like OS_msg_queue_send
+*   if the queue is full
 * 
 * RETURN :
-*   
 *
-* NOTES: 
+*   Return an error message or 0 (OS_NO_ERROR) if no error occurred   
+*
+* NOTES: 
+*
+*   item can be reused as soon as this returns
 *******************************************************************************/
 
-void _OS_msg_queue_init(MessageQueue_t *msg_queue, int queue_size)
+int OS_msg_queue_send_copy(MsgQueue_t queue, TickType_t timeout, const void * const item)
 {
-    msg_queue->num_messages = 0;
-    msg_queue->max_messages = queue_size;
-    msg_queue->head_ptr = NULL;
-    msg_queue->tail_ptr = NULL;
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
 
-    _OS_list_header_init(&(msg_queue->reveive_waiters));
-    _OS_list_header_init(&(msg_queue->send_waiters));
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+    if(item == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+    return _OS_msg_queue_send(msg_queue, timeout, item);
+}
 
-    vPortCPUInitializeMutex(&msg_queue->mux);
+/*******************************************************************************
+* Message Queue Receive Copy (API FUNCTION)
+*
+*   queue = A queue from OS_msg_queue_create_fixed
+*   timeout = Max amount of time to wait if the queue is empty
+*   item = Where to copy the message. Must hold the queue's item size
+* 
+* PURPOSE : 
+*
+*   Copy the oldest message out of a fixed size queue, blocking like 
+*   OS_msg_queue_receive if the queue is empty
+* 
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if no error occurred   
+*
+* NOTES: 
+*
+*   item is left untouched if no message was received
+*******************************************************************************/
+
+int OS_msg_queue_receive_copy(MsgQueue_t queue, TickType_t timeout, void * const item)
+{
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
 
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+    if(item == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+    return _OS_msg_queue_receive(msg_queue, timeout, item);
 }
 
 /*******************************************************************************
-* STATIC FUNCTION DEFINITIONS
+* Message Queue Try Send Copy (API FUNCTION)
+*
+*   queue = A queue from OS_msg_queue_create_fixed
+*   item = The message to copy into the queue. Must be the queue's item size
+* 
+* PURPOSE : 
+*
+*   Copy a message into a fixed size queue if it has room, without blocking
+* 
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if no error occurred   
+*
+* NOTES: 
 *******************************************************************************/
 
-static void _OS_msg_pool_insert(Message_t *msg)
+int OS_msg_queue_try_send_copy(MsgQueue_t queue, const void * const item)
 {
-    /* The message pool is empty */
-    if(OS_msg_pool.num_messages == 0) {
-        OS_msg_pool.head_ptr = msg;
-        OS_msg_pool.tail_ptr = msg;
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
     }
-    /* The message pool isn't empty. Add to the tail */
-    else {
-        OS_msg_pool.tail_ptr->next_ptr = msg;
-        OS_msg_pool.tail_ptr = msg;
+    if(item == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
     }
-    OS_msg_pool.tail_ptr->next_ptr = NULL;
-    OS_msg_pool.num_messages++;
-    assert(OS_msg_pool.head_ptr);
+    return _OS_msg_queue_try_send(msg_queue, item);
 }
 
-static Message_t* _OS_msg_pool_retrieve(void)
+/*******************************************************************************
+* Message Queue Try Receive Copy (API FUNCTION)
+*
+*   queue = A queue from OS_msg_queue_create_fixed
+*   item = Where to copy the message. Must hold the queue's item size
+* 
+* PURPOSE : 
+*
+*   Copy the oldest message out of a fixed size queue if there is one, without
+*   blocking
+* 
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if no error occurred   
+*
+* NOTES: 
+*******************************************************************************/
+
+int OS_msg_queue_try_receive_copy(MsgQueue_t queue, void * const item)
 {
-    Message_t *msg;
-    int i;
-    int size;
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
 
-    /* Our pool is empty so we have to allocate another slab of messages */
-    if(OS_msg_pool.num_messages == 0){
-        /* First allocation is a fixed size. Later allocations double the size */
-        //size = OS_msg_count == 0 ? OS_MSG_POOL_INITIAL_SIZE : OS_msg_count;
-        size = 8;
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+    if(item == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+    return _OS_msg_queue_try_receive(msg_queue, item);
+}
 
-        OS_msg_pool.head_ptr = pvPortMalloc(sizeof(Message_t) * size);
-        assert(OS_msg_pool.head_ptr);
+/*******************************************************************************
+* Message Queue Loan (API FUNCTION)
+*
+*   queue = A queue from OS_msg_queue_create_fixed
+*   timeout = Max amount of time to wait if the queue is full
+*   slot = Filled with the address of the loaned slot, or NULL on error
+* 
+* PURPOSE : 
+*
+*   Reserve the next free slot of a fixed size queue so that it can be filled
+*   in place, for example by DMA, without copying the message. The message is
+*   only sent once it is handed back with OS_msg_queue_loan_commit
+* 
+* RETURN :
+*
+*   Return OS_ERROR_QUEUE_LOAN if a slot is already on loan, another error
+*   message, or 0 (OS_NO_ERROR) if a slot was loaned
+*
+* NOTES: 
+*
+*   One slot can be on loan at a time. While it is, the queue must not be sent
+*   to in any other way. The slot is item_size bytes and word aligned
+*******************************************************************************/
 
-        /* Connect the newly allocated messages as a pool list */
-        for(i = 0; i < size - 1; ++i) {
-            (&(OS_msg_pool.head_ptr)[i])->next_ptr = &(OS_msg_pool.head_ptr)[i + 1];
-        }
-        (OS_msg_pool.head_ptr)[size - 1].next_ptr = NULL;
-        OS_msg_pool.tail_ptr = &((OS_msg_pool.head_ptr)[size - 1]);
-        OS_msg_pool.num_messages = size;
+int OS_msg_queue_loan(MsgQueue_t queue, TickType_t timeout, void ** slot)
+{
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+    int ret_val;
 
-        OS_msg_count += size;
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
     }
+    if(slot == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+    *slot = NULL;
 
-    OS_msg_pool.num_messages--;
-    /* Remove the head of the list to return as the message for use */
-    assert(OS_msg_pool.head_ptr);
-    msg = OS_msg_pool.head_ptr;
-
-    OS_msg_pool.head_ptr = OS_msg_pool.head_ptr->next_ptr;
-    if(OS_msg_pool.head_ptr == NULL){
-        assert(OS_msg_pool.num_messages == 0);
+    if(_OS_msg_queue_claim(msg_queue, OS_MSG_QUEUE_SLOT_LOANED) == OS_FALSE) {
+        return OS_ERROR_QUEUE_LOAN;
     }
-    msg->next_ptr = NULL;
-    return msg;
 
+    ret_val = _OS_msg_queue_reserve_tail(msg_queue, timeout, slot);
+    if(ret_val != OS_NO_ERROR) {
+        _OS_msg_queue_unclaim(msg_queue, OS_MSG_QUEUE_SLOT_LOANED);
+    }
+    return ret_val;
 }
 
-static void _OS_msg_queue_insert(MessageQueue_t *msg_queue, Message_t *msg)
+/*******************************************************************************
+* Message Queue Loan Commit (API FUNCTION)
+*
+*   queue = A queue with a slot on loan from OS_msg_queue_loan
+* 
+* PURPOSE : 
+*
+*   Send the message that was filled in place in the loaned slot, waking a 
+*   waiting receiver if there is one
+* 
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if no error occurred   
+*
+* NOTES: 
+*
+*   The slot must not be touched after this returns
+*******************************************************************************/
+
+int OS_msg_queue_loan_commit(MsgQueue_t queue)
 {
-    /* If this is the first message in the queue */
-    if (msg_queue->head_ptr == NULL)
-    {
-        msg_queue->head_ptr = msg;
-        msg_queue->tail_ptr = msg;
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+    TCB_t *waiting_receiver = NULL;
+
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
     }
-    /* Add to the tail */
-    else
-    {
-        msg_queue->tail_ptr->next_ptr = msg;
-        msg_queue->tail_ptr = msg;
+    if((msg_queue->loan_flags & OS_MSG_QUEUE_SLOT_LOANED) == 0) {
+        return OS_ERROR_QUEUE_LOAN;
+    }
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        _OS_msg_spsc_publish(msg_queue, 
+                (msg_queue->ring_tail + 1 == msg_queue->ring_slots) ? 0 : msg_queue->ring_tail + 1);
+        _OS_msg_queue_unclaim(msg_queue, OS_MSG_QUEUE_SLOT_LOANED);
+        _OS_msg_spsc_wake(msg_queue, OS_MSG_QUEUE_RECEIVER_WAITING);
+        return OS_NO_ERROR;
+    }
+
+    portENTER_CRITICAL(&(msg_queue->mux));
+    if(++msg_queue->ring_tail == msg_queue->ring_slots) {
+        msg_queue->ring_tail = 0;
     }
-    msg->next_ptr = NULL;
     msg_queue->num_messages++;
+
+    if(msg_queue->reveive_waiters.num_tasks != 0){
+        waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
+    }
+    if(msg_queue->queue_set != NULL) {
+        _OS_queue_set_post(msg_queue->queue_set, msg_queue, 1);
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    _OS_msg_queue_unclaim(msg_queue, OS_MSG_QUEUE_SLOT_LOANED);
+    if(waiting_receiver != NULL){
+        OS_schedule_resume_task(waiting_receiver);
+    }
+    return OS_NO_ERROR;
 }
 
-static Message_t * _OS_msg_queue_pop(MessageQueue_t *msg_queue)
+/*******************************************************************************
+* Message Queue Peek (API FUNCTION)
+*
+*   queue = A queue from OS_msg_queue_create_fixed
+*   timeout = Max amount of time to wait if the queue is empty
+*   slot = Filled with the address of the oldest message, or NULL on error
+* 
+* PURPOSE : 
+*
+*   Get the oldest message of a fixed size queue in place, without copying it
+*   out. The message stays on the queue, and its slot can't be reused, until
+*   it is handed back with OS_msg_queue_peek_release
+* 
+* RETURN :
+*
+*   Return OS_ERROR_QUEUE_LOAN if a message is already being peeked, another
+*   error message, or 0 (OS_NO_ERROR) if a message was found
+*
+* NOTES: 
+*
+*   One message can be peeked at a time. While it is, the queue must not be 
+*   received from in any other way
+*******************************************************************************/
+
+int OS_msg_queue_peek(MsgQueue_t queue, TickType_t timeout, void ** slot)
 {
-    Message_t * msg; 
-    assert(msg_queue->num_messages > 0);
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+    int ret_val;
 
-    msg = msg_queue->head_ptr;
-    msg_queue->head_ptr = msg_queue->head_ptr->next_ptr;
-    msg->next_ptr = NULL;
-    
-    /* If we only had one message in the queue, update the tail */
-    if(msg_queue->head_ptr == NULL) {
-        msg_queue->tail_ptr = NULL;
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+    if(slot == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+    *slot = NULL;
+
+    if(_OS_msg_queue_claim(msg_queue, OS_MSG_QUEUE_SLOT_PEEKED) == OS_FALSE) {
+        return OS_ERROR_QUEUE_LOAN;
+    }
+
+    ret_val = _OS_msg_queue_reserve_head(msg_queue, timeout, slot);
+    if(ret_val != OS_NO_ERROR) {
+        _OS_msg_queue_unclaim(msg_queue, OS_MSG_QUEUE_SLOT_PEEKED);
+    }
+    return ret_val;
+}
+
+/*******************************************************************************
+* Message Queue Peek Release (API FUNCTION)
+*
+*   queue = A queue with a message peeked with OS_msg_queue_peek
+* 
+* PURPOSE : 
+*
+*   Remove the peeked message from the queue once it has been processed, 
+*   freeing its slot and waking a waiting sender if there is one
+* 
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if no error occurred   
+*
+* NOTES: 
+*
+*   The slot must not be touched after this returns
+*******************************************************************************/
+
+int OS_msg_queue_peek_release(MsgQueue_t queue)
+{
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+    TCB_t *waiting_sender = NULL;
+
+    if(msg_queue == NULL || msg_queue->copy_items == OS_FALSE) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+    if((msg_queue->loan_flags & OS_MSG_QUEUE_SLOT_PEEKED) == 0) {
+        return OS_ERROR_QUEUE_LOAN;
+    }
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        /* Release pairs with the sender's acquire, so we are done with the slot
+        before the sender can reuse it */
+        __atomic_store_n(&(msg_queue->ring_head), 
+                (msg_queue->ring_head + 1 == msg_queue->ring_slots) ? 0 : msg_queue->ring_head + 1, 
+                __ATOMIC_RELEASE);
+        _OS_msg_queue_unclaim(msg_queue, OS_MSG_QUEUE_SLOT_PEEKED);
+        _OS_msg_spsc_wake(msg_queue, OS_MSG_QUEUE_SENDER_WAITING);
+        return OS_NO_ERROR;
+    }
+
+    portENTER_CRITICAL(&(msg_queue->mux));
+    if(++msg_queue->ring_head == msg_queue->ring_slots) {
+        msg_queue->ring_head = 0;
     }
     msg_queue->num_messages--;
 
-    return msg;
+    if(msg_queue->send_waiters.num_tasks != 0){
+        waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    _OS_msg_queue_unclaim(msg_queue, OS_MSG_QUEUE_SLOT_PEEKED);
+    if(waiting_sender != NULL){
+        OS_schedule_resume_task(waiting_sender);
+    }
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Message Queue Send Batch (API FUNCTION)
+*
+*   queue = The reference to the message queue to send the messages to
+*   timeout = Max amount of time to wait if the queue is full
+*   items = An array of num_items messages. For queues holding pointers this is
+*           an array of the pointers, for fixed size queues an array of items
+*   num_items = The number of messages in items
+*   num_sent = Filled with how many messages were sent. Can be NULL
+* 
+* PURPOSE : 
+*
+*   Send a burst of messages under a single acquisition of the queue's lock,
+*   waking at most one waiting receiver for the whole batch. Sends as many 
+*   messages as fit, blocking like OS_msg_queue_send only if none do
+* 
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if at least one message was sent
+*
+* NOTES: 
+*
+*   Messages are sent in order, so a partial send always sends the first 
+*   *num_sent of them. The caller is responsible for the rest
+*******************************************************************************/
+
+int OS_msg_queue_send_batch(MsgQueue_t queue, TickType_t timeout, const void * const items, 
+            int num_items, int *num_sent)
+{
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+    int count = 0;
+    int ret_val;
+
+    if(msg_queue == NULL) {
+        ret_val = OS_ERROR_INVALID_QUEUE;
+    }
+    else if(items == NULL) {
+        ret_val = OS_ERROR_QUEUE_NULL_PTR;
+    }
+    else if(num_items <= 0) {
+        ret_val = OS_ERROR_INVALID_QUEUE_SIZE;
+    }
+    else if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        ret_val = _OS_msg_spsc_send_batch(msg_queue, timeout, items, num_items, &count);
+    }
+    else {
+        ret_val = _OS_msg_queue_send_batch(msg_queue, timeout, items, num_items, &count);
+    }
+
+    if(num_sent != NULL) {
+        *num_sent = count;
+    }
+    return ret_val;
 }
 
+/*******************************************************************************
+* Message Queue Receive Batch (API FUNCTION)
+*
+*   queue = The reference to the message queue to receive the messages from
+*   timeout = Max amount of time to wait if the queue is empty
+*   items = An array with room for max_items messages
+*   max_items = The most messages to receive
+*   num_received = Filled with how many messages were received. Can be NULL
+* 
+* PURPOSE : 
+*
+*   Receive a burst of messages under a single acquisition of the queue's 
+*   lock, waking at most one waiting sender for the whole batch. Receives 
+*   every waiting message up to max_items, blocking like OS_msg_queue_receive
+*   only if there are none
+* 
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if at least one message was 
+*   received
+*
+* NOTES: 
+*******************************************************************************/
+
+int OS_msg_queue_receive_batch(MsgQueue_t queue, TickType_t timeout, void * const items, 
+            int max_items, int *num_received)
+{
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+    int count = 0;
+    int ret_val;
 
+    if(msg_queue == NULL) {
+        ret_val = OS_ERROR_INVALID_QUEUE;
+    }
+    else if(items == NULL) {
+        ret_val = OS_ERROR_QUEUE_NULL_PTR;
+    }
+    else if(max_items <= 0) {
+        ret_val = OS_ERROR_INVALID_QUEUE_SIZE;
+    }
+    else if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        ret_val = _OS_msg_spsc_receive_batch(msg_queue, timeout, items, max_items, &count);
+    }
+    else {
+        ret_val = _OS_msg_queue_receive_batch(msg_queue, timeout, items, max_items, &count);
+    }
+
+    if(num_received != NULL) {
+        *num_received = count;
+    }
+    return ret_val;
+}
+
+/*******************************************************************************
+* OS Message Queue Init
+*
+*   msg_queue = A reference to the message queue to be initialized
+*   queue_size = The maximum capacity of the message queue
+* 
+* PURPOSE : 
+*   
+*   Initializes the data members in a message queue
+* 
+* RETURN :
+*   
+*
+* NOTES: 
+*******************************************************************************/
+
+void _OS_msg_queue_init(MessageQueue_t *msg_queue, int queue_size)
+{
+    msg_queue->num_messages = 0;
+    msg_queue->max_messages = queue_size;
+    msg_queue->mode = OS_MSG_QUEUE_MODE_LINKED;
+    msg_queue->head_ptr = NULL;
+    msg_queue->tail_ptr = NULL;
+    msg_queue->ring = NULL;
+    msg_queue->ring_slots = 0;
+    msg_queue->item_size = sizeof(void *);
+    msg_queue->slot_size = sizeof(void *);
+    msg_queue->copy_items = OS_FALSE;
+    msg_queue->ring_head = 0;
+    msg_queue->ring_tail = 0;
+    msg_queue->spsc_waiting = 0;
+    msg_queue->loan_flags = 0;
+    msg_queue->queue_set = NULL;
+
+    _OS_list_header_init(&(msg_queue->reveive_waiters));
+    _OS_list_header_init(&(msg_queue->send_waiters));
+
+    vPortCPUInitializeMutex(&msg_queue->mux);
+
+}
+
+/*******************************************************************************
+* STATIC FUNCTION DEFINITIONS
+*******************************************************************************/
+
+/**
+ * Return a NULL terminated list of messages to this core's cache. When the 
+ * cache passes OS_MSG_CACHE_SIZE a batch of it is handed back to the shared 
+ * depot, which may free memory, so no queue mux may be held
+ */
+static void _OS_msg_pool_insert(Message_t *msg_list)
+{
+    MessageCache_t *cache;
+    Message_t *msg;
+    Message_t *surplus;
+    Message_t *surplus_tail;
+    unsigned state;
+    int i;
+
+    while(msg_list != NULL) {
+        msg = msg_list;
+        msg_list = msg->next_ptr;
+        surplus = NULL;
+
+        state = portENTER_CRITICAL_NESTED();
+        cache = &OS_msg_cache[xPortGetCoreID()];
+        msg->next_ptr = cache->head_ptr;
+        cache->head_ptr = msg;
+        cache->num_messages++;
+
+        /* Keep the message we were just given, since it is the most likely to 
+        still be in the data cache, and give away the batch behind it */
+        if(cache->num_messages > OS_MSG_CACHE_SIZE) {
+            surplus = msg->next_ptr;
+            surplus_tail = surplus;
+            for(i = 1; i < OS_MSG_CACHE_BATCH; ++i) {
+                surplus_tail = surplus_tail->next_ptr;
+            }
+            msg->next_ptr = surplus_tail->next_ptr;
+            surplus_tail->next_ptr = NULL;
+            cache->num_messages -= OS_MSG_CACHE_BATCH;
+        }
+        portEXIT_CRITICAL_NESTED(state);
+
+        if(surplus != NULL) {
+            _OS_msg_depot_give(surplus);
+        }
+    }
+}
+
+/**
+ * Get a message from this core's cache, refilling the cache with a batch
+ * from the shared depot if it is empty. Never allocates, so it is safe under
+ * a queue mux. Returns NULL if the depot is empty too, and the caller should
+ * grow it with _OS_msg_depot_grow after releasing its mux
+ */
+static Message_t* _OS_msg_pool_retrieve(void)
+{
+    MessageCache_t *cache;
+    Message_t *msg;
+    Message_t *batch;
+    Message_t *batch_tail;
+    int batch_size;
+    unsigned state;
+
+    state = portENTER_CRITICAL_NESTED();
+    cache = &OS_msg_cache[xPortGetCoreID()];
+    msg = cache->head_ptr;
+    if(msg != NULL) {
+        cache->head_ptr = msg->next_ptr;
+        cache->num_messages--;
+        portEXIT_CRITICAL_NESTED(state);
+        msg->next_ptr = NULL;
+        return msg;
+    }
+    portEXIT_CRITICAL_NESTED(state);
+
+    /* Our cache is empty. Keep the first message of a new batch and cache the rest */
+    batch_size = _OS_msg_depot_take(&batch, &batch_tail, OS_MSG_CACHE_BATCH);
+    if(batch_size == 0) {
+        return NULL;
+    }
+    msg = batch;
+    batch = batch->next_ptr;
+
+    if(batch != NULL) {
+        state = portENTER_CRITICAL_NESTED();
+        cache = &OS_msg_cache[xPortGetCoreID()];
+        batch_tail->next_ptr = cache->head_ptr;
+        cache->head_ptr = batch;
+        cache->num_messages += batch_size - 1;
+        portEXIT_CRITICAL_NESTED(state);
+    }
+    msg->next_ptr = NULL;
+    return msg;
+}
+
+/**
+ * Take up to max_messages messages from the depot as a NULL terminated list.
+ * Older slabs are drained first so that newer ones can empty out and be 
+ * trimmed. Returns the number of messages taken, 0 if the depot is empty
+ */
+static int _OS_msg_depot_take(Message_t **head_ptr, Message_t **tail_ptr, int max_messages)
+{
+    MsgSlab_t *slab;
+    Message_t *msg;
+    int count = 0;
+
+    *head_ptr = NULL;
+    *tail_ptr = NULL;
+
+    portENTER_CRITICAL(&OS_message_mutex);
+    for(slab = OS_msg_pool.slab_list; slab != NULL && count < max_messages; slab = slab->next_ptr) {
+        while(slab->free_ptr != NULL && count < max_messages) {
+            msg = slab->free_ptr;
+            slab->free_ptr = msg->next_ptr;
+            slab->num_free--;
+
+            msg->next_ptr = *head_ptr;
+            if(*head_ptr == NULL) {
+                *tail_ptr = msg;
+            }
+            *head_ptr = msg;
+            count++;
+        }
+    }
+    OS_msg_pool.num_free -= count;
+    portEXIT_CRITICAL(&OS_message_mutex);
+
+    return count;
+}
+
+/**
+ * Return a NULL terminated list of messages to the free lists of their slabs.
+ * Once the depot is over OS_MSG_POOL_TRIM_WATERMARK a completely free slab is
+ * given back to the heap
+ */
+static void _OS_msg_depot_give(Message_t *msg_list)
+{
+    MsgSlab_t *free_slab = NULL;
+    Message_t *msg;
+
+    portENTER_CRITICAL(&OS_message_mutex);
+    while(msg_list != NULL) {
+        msg = msg_list;
+        msg_list = msg->next_ptr;
+
+        msg->next_ptr = msg->slab->free_ptr;
+        msg->slab->free_ptr = msg;
+        msg->slab->num_free++;
+        OS_msg_pool.num_free++;
+    }
+
+    if(OS_msg_pool.num_free > OS_MSG_POOL_TRIM_WATERMARK) {
+        free_slab = _OS_msg_depot_unlink_free_slab();
+    }
+    portEXIT_CRITICAL(&OS_message_mutex);
+
+    if(free_slab != NULL) {
+        vPortFree(free_slab);
+    }
+}
+
+/**
+ * Allocate a new slab and add it to the end of the depot. The first slab
+ * holds OS_MSG_POOL_INITIAL_SIZE messages and every later slab doubles the
+ * total, up to OS_MSG_POOL_MAX_SLAB_SIZE messages per slab. Allocates, so
+ * the caller must not hold a queue mux
+ */
+static int _OS_msg_depot_grow(void)
+{
+    MsgSlab_t *slab;
+    MsgSlab_t **slab_ptr;
+    Message_t *msgs;
+    int size;
+    int i;
+
+    portENTER_CRITICAL(&OS_message_mutex);
+    size = (OS_msg_count == 0) ? OS_MSG_POOL_INITIAL_SIZE : OS_msg_count;
+    portEXIT_CRITICAL(&OS_message_mutex);
+
+    if(size > OS_MSG_POOL_MAX_SLAB_SIZE) {
+        size = OS_MSG_POOL_MAX_SLAB_SIZE;
+    }
+
+    slab = pvPortMalloc(sizeof(MsgSlab_t) + sizeof(Message_t) * size);
+    if(slab == NULL) {
+        return OS_ERROR_MSG_POOL_RETR;
+    }
+
+    /* Connect the newly allocated messages as the slab's free list */
+    msgs = (Message_t *)(slab + 1);
+    for(i = 0; i < size; ++i) {
+        msgs[i].slab = slab;
+        msgs[i].next_ptr = (i == size - 1) ? NULL : &msgs[i + 1];
+    }
+    slab->num_messages = size;
+    slab->num_free = size;
+    slab->free_ptr = msgs;
+    slab->next_ptr = NULL;
+
+    portENTER_CRITICAL(&OS_message_mutex);
+    slab_ptr = (MsgSlab_t **)&(OS_msg_pool.slab_list);
+    while(*slab_ptr != NULL) {
+        slab_ptr = &((*slab_ptr)->next_ptr);
+    }
+    *slab_ptr = slab;
+    OS_msg_pool.num_free += size;
+    OS_msg_count += size;
+    portEXIT_CRITICAL(&OS_message_mutex);
+
+    return OS_NO_ERROR;
+}
+
+/**
+ * Remove the newest completely free slab from the depot, as long as that 
+ * leaves at least half the watermark free. Caller must hold OS_message_mutex
+ * and free the returned slab after releasing it. Returns NULL if no slab 
+ * can be removed
+ */
+static MsgSlab_t * _OS_msg_depot_unlink_free_slab(void)
+{
+    MsgSlab_t **slab_ptr;
+    MsgSlab_t **found_ptr = NULL;
+    MsgSlab_t *slab;
+
+    for(slab_ptr = (MsgSlab_t **)&(OS_msg_pool.slab_list); *slab_ptr != NULL; 
+            slab_ptr = &((*slab_ptr)->next_ptr)) {
+        slab = *slab_ptr;
+        if(slab->num_free == slab->num_messages && 
+                OS_msg_pool.num_free - slab->num_messages >= OS_MSG_POOL_TRIM_WATERMARK / 2) {
+            found_ptr = slab_ptr;
+        }
+    }
+    if(found_ptr == NULL) {
+        return NULL;
+    }
+
+    slab = *found_ptr;
+    *found_ptr = slab->next_ptr;
+    OS_msg_pool.num_free -= slab->num_messages;
+    OS_msg_count -= slab->num_messages;
+    return slab;
+}
+
+static void _OS_msg_queue_insert(MessageQueue_t *msg_queue, Message_t *msg)
+{
+    /* If this is the first message in the queue */
+    if (msg_queue->head_ptr == NULL)
+    {
+        msg_queue->head_ptr = msg;
+        msg_queue->tail_ptr = msg;
+    }
+    /* Add to the tail */
+    else
+    {
+        msg_queue->tail_ptr->next_ptr = msg;
+        msg_queue->tail_ptr = msg;
+    }
+    msg->next_ptr = NULL;
+    msg_queue->num_messages++;
+}
+
+static Message_t * _OS_msg_queue_pop(MessageQueue_t *msg_queue)
+{
+    Message_t * msg; 
+    assert(msg_queue->num_messages > 0);
+
+    msg = msg_queue->head_ptr;
+    msg_queue->head_ptr = msg_queue->head_ptr->next_ptr;
+    msg->next_ptr = NULL;
+    
+    /* If we only had one message in the queue, update the tail */
+    if(msg_queue->head_ptr == NULL) {
+        msg_queue->tail_ptr = NULL;
+    }
+    msg_queue->num_messages--;
+
+    return msg;
+}
+
+/**
+ * Copy the message at item into a queue that has room for it. For pointer 
+ * queues item points at the message pointer. Caller must hold the queue's mux
+ */
+static int _OS_msg_queue_put(MessageQueue_t *msg_queue, TCB_t *sender, const void * const item)
+{
+    Message_t *new_message;
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_RING) {
+        _OS_msg_copy_item(msg_queue->ring + msg_queue->ring_tail * msg_queue->slot_size, 
+                item, msg_queue->item_size);
+        if(++msg_queue->ring_tail == msg_queue->ring_slots) {
+            msg_queue->ring_tail = 0;
+        }
+        msg_queue->num_messages++;
+    }
+    else {
+        new_message = _OS_msg_pool_retrieve();
+        if(new_message == NULL) {
+            return OS_ERROR_MSG_POOL_RETR;
+        }
+
+        new_message->sender = sender;
+        new_message->contents = *(void * const *)item;
+        new_message->next_ptr = NULL;
+
+        _OS_msg_queue_insert(msg_queue, new_message);
+    }
+
+    if(msg_queue->queue_set != NULL) {
+        _OS_queue_set_post(msg_queue->queue_set, msg_queue, 1);
+    }
+    return OS_NO_ERROR;
+}
+
+/**
+ * Take the oldest message from a non-empty queue and copy it to item, or
+ * drop it if item is NULL. Caller must hold the queue's mux. A linked message
+ * is pushed on spent_list, which the caller returns to the pool with 
+ * _OS_msg_pool_insert after releasing the mux
+ */
+static void _OS_msg_queue_get(MessageQueue_t *msg_queue, void * const item, Message_t **spent_list)
+{
+    Message_t *retrieved_message;
+
+    assert(msg_queue->num_messages > 0);
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_RING) {
+        if(item != NULL) {
+            _OS_msg_copy_item(item, msg_queue->ring + msg_queue->ring_head * msg_queue->slot_size, 
+                    msg_queue->item_size);
+        }
+        if(++msg_queue->ring_head == msg_queue->ring_slots) {
+            msg_queue->ring_head = 0;
+        }
+        msg_queue->num_messages--;
+        return;
+    }
+
+    retrieved_message = _OS_msg_queue_pop(msg_queue);
+    if(item != NULL) {
+        *(void **)item = retrieved_message->contents;
+    }
+
+    /* We are done with this message. Hand it back for the pool to re-use */
+    retrieved_message->next_ptr = *spent_list;
+    *spent_list = retrieved_message;
+}
+
+/**
+ * Copy one message. Small word sized messages, the common case for fixed size
+ * queues, are copied a word at a time without a call to memcpy
+ */
+static inline void _OS_msg_copy_item(void *dest, const void *src, int item_size)
+{
+    uint32_t *dest_words = (uint32_t *)dest;
+    const uint32_t *src_words = (const uint32_t *)src;
+
+    if(item_size > OS_MSG_INLINE_COPY_SIZE || (item_size & 3) != 0 || 
+            (((uintptr_t)dest | (uintptr_t)src) & 3) != 0) {
+        memcpy(dest, src, (size_t)item_size);
+        return;
+    }
+
+    switch(item_size >> 2) {
+        case 4:
+            dest_words[3] = src_words[3];
+            /* Falls through */
+        case 3:
+            dest_words[2] = src_words[2];
+            /* Falls through */
+        case 2:
+            dest_words[1] = src_words[1];
+            /* Falls through */
+        case 1:
+            dest_words[0] = src_words[0];
+            /* Falls through */
+        default:
+            break;
+    }
+}
+
+/**
+ * Allocate a queue together with its ring of slots. Slots are item_size 
+ * rounded up to a whole word. SPSC rings get one spare slot, see MessageQueue_t
+ */
+static int _OS_msg_queue_create_ring(MsgQueue_t * queue_ptr, int queue_size, int item_size, 
+            OSMsgQueueMode_t mode)
+{
+    MessageQueue_t *msg_queue = NULL;
+    int ring_slots;
+    int slot_size = (item_size + 3) & ~3;
+
+    if(queue_size <= 0 || queue_size > OS_MAX_MSG_QUEUE_SIZE || slot_size <= 0 ||
+            (size_t)queue_size >= (SIZE_MAX - sizeof(MessageQueue_t)) / (size_t)slot_size - 1) {
+        return OS_ERROR_INVALID_QUEUE_SIZE;
+    }
+
+    if(queue_ptr == NULL){
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+
+    ring_slots = (mode == OS_MSG_QUEUE_MODE_SPSC) ? queue_size + 1 : queue_size;
+
+    /* Allocate the queue and its ring together */
+    msg_queue = malloc(sizeof(MessageQueue_t) + (size_t)ring_slots * (size_t)slot_size);
+    if(msg_queue == NULL) {
+        return OS_ERROR_QUEUE_ALLOC;
+    }
+
+    _OS_msg_queue_init(msg_queue, queue_size);
+    msg_queue->mode = mode;
+    msg_queue->ring = (uint8_t *)(msg_queue + 1);
+    msg_queue->ring_slots = ring_slots;
+    msg_queue->item_size = item_size;
+    msg_queue->slot_size = slot_size;
+    
+    *queue_ptr = (void *)msg_queue;
+
+    return OS_NO_ERROR;
+}
+
+/**
+ * Send on an SPSC queue, blocking for up to timeout ticks if it is full
+ */
+static int _OS_msg_spsc_send(MessageQueue_t *msg_queue, TickType_t timeout, const void * const item)
+{
+    int ret_val;
+    OSBool_t waited = OS_FALSE;
+
+    while(OS_TRUE) {
+        if(_OS_msg_spsc_try_put(msg_queue, item) == OS_TRUE) {
+            _OS_msg_spsc_wake(msg_queue, OS_MSG_QUEUE_RECEIVER_WAITING);
+            return OS_NO_ERROR;
+        }
+
+        if(timeout == 0) {
+            return OS_ERROR_QUEUE_FULL;
+        }
+        /* Only wait once. Waking up to a still full ring means the timeout hit */
+        if(waited == OS_TRUE) {
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        ret_val = _OS_msg_spsc_block(msg_queue, OS_MSG_QUEUE_SENDER_WAITING, timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Receive from an SPSC queue, blocking for up to timeout ticks if it is empty
+ */
+static int _OS_msg_spsc_receive(MessageQueue_t *msg_queue, TickType_t timeout, void * const item)
+{
+    int ret_val;
+    OSBool_t waited = OS_FALSE;
+
+    while(OS_TRUE) {
+        if(_OS_msg_spsc_try_get(msg_queue, item) == OS_TRUE) {
+            _OS_msg_spsc_wake(msg_queue, OS_MSG_QUEUE_SENDER_WAITING);
+            return OS_NO_ERROR;
+        }
+
+        if(timeout == 0) {
+            return OS_ERROR_QUEUE_EMPTY;
+        }
+        if(waited == OS_TRUE) {
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        ret_val = _OS_msg_spsc_block(msg_queue, OS_MSG_QUEUE_RECEIVER_WAITING, timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Lock free write of one message. Only the sender ever writes ring_tail.
+ * Returns false if the ring is full
+ */
+static OSBool_t _OS_msg_spsc_try_put(MessageQueue_t *msg_queue, const void * const item)
+{
+    int tail = msg_queue->ring_tail;
+    int next = (tail + 1 == msg_queue->ring_slots) ? 0 : tail + 1;
+
+    /* Acquire pairs with the receiver's release, so its read of the slot we 
+    are about to reuse has finished */
+    if(next == __atomic_load_n(&(msg_queue->ring_head), __ATOMIC_ACQUIRE)) {
+        return OS_FALSE;
+    }
+    _OS_msg_copy_item(msg_queue->ring + tail * msg_queue->slot_size, item, msg_queue->item_size);
+
+    _OS_msg_spsc_publish(msg_queue, next);
+    return OS_TRUE;
+}
+
+/**
+ * Make the filled slot before next visible to the receiver. Only the sender
+ * ever calls this
+ */
+static void _OS_msg_spsc_publish(MessageQueue_t *msg_queue, int next)
+{
+    QueueSet_t *queue_set;
+
+    /* Release publishes the slot contents before the new tail */
+    __atomic_store_n(&(msg_queue->ring_tail), next, __ATOMIC_RELEASE);
+
+    queue_set = __atomic_load_n(&(msg_queue->queue_set), __ATOMIC_ACQUIRE);
+    if(queue_set != NULL) {
+        _OS_queue_set_post(queue_set, msg_queue, 1);
+    }
+}
+
+/**
+ * Lock free read of one message. Only the receiver ever writes ring_head.
+ * Returns false if the ring is empty
+ */
+static OSBool_t _OS_msg_spsc_try_get(MessageQueue_t *msg_queue, void * const item)
+{
+    int head = msg_queue->ring_head;
+
+    if(head == __atomic_load_n(&(msg_queue->ring_tail), __ATOMIC_ACQUIRE)) {
+        return OS_FALSE;
+    }
+    _OS_msg_copy_item(item, msg_queue->ring + head * msg_queue->slot_size, msg_queue->item_size);
+
+    __atomic_store_n(&(msg_queue->ring_head), (head + 1 == msg_queue->ring_slots) ? 0 : head + 1, 
+            __ATOMIC_RELEASE);
+    return OS_TRUE;
+}
+
+/**
+ * Lock free send of as many of num_items messages as fit on an SPSC queue,
+ * blocking for up to timeout ticks if none do. The receiver is woken once
+ */
+static int _OS_msg_spsc_send_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            const uint8_t *items, int num_items, int *num_sent)
+{
+    int count = 0;
+    int ret_val;
+    OSBool_t waited = OS_FALSE;
+
+    while(OS_TRUE) {
+        while(count < num_items && 
+                _OS_msg_spsc_try_put(msg_queue, items + count * msg_queue->item_size) == OS_TRUE) {
+            count++;
+        }
+        if(count != 0) {
+            _OS_msg_spsc_wake(msg_queue, OS_MSG_QUEUE_RECEIVER_WAITING);
+            *num_sent = count;
+            return OS_NO_ERROR;
+        }
+
+        if(timeout == 0) {
+            return OS_ERROR_QUEUE_FULL;
+        }
+        if(waited == OS_TRUE) {
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        ret_val = _OS_msg_spsc_block(msg_queue, OS_MSG_QUEUE_SENDER_WAITING, timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Lock free receive of up to max_items messages from an SPSC queue, blocking
+ * for up to timeout ticks if it is empty. The sender is woken once
+ */
+static int _OS_msg_spsc_receive_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            uint8_t *items, int max_items, int *num_received)
+{
+    int count = 0;
+    int ret_val;
+    OSBool_t waited = OS_FALSE;
+
+    while(OS_TRUE) {
+        while(count < max_items && 
+                _OS_msg_spsc_try_get(msg_queue, items + count * msg_queue->item_size) == OS_TRUE) {
+            count++;
+        }
+        if(count != 0) {
+            _OS_msg_spsc_wake(msg_queue, OS_MSG_QUEUE_SENDER_WAITING);
+            *num_received = count;
+            return OS_NO_ERROR;
+        }
+
+        if(timeout == 0) {
+            return OS_ERROR_QUEUE_EMPTY;
+        }
+        if(waited == OS_TRUE) {
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        ret_val = _OS_msg_spsc_block(msg_queue, OS_MSG_QUEUE_RECEIVER_WAITING, timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Block the current task on an SPSC queue until the other side wakes it or 
+ * the timeout expires. Returns without blocking if the other side made 
+ * progress while the wait flag was being raised
+ */
+static int _OS_msg_spsc_block(MessageQueue_t *msg_queue, uint32_t flag, TickType_t timeout)
+{
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    WaitList_t *waitlist;
+    uint32_t old_flags, new_flags;
+    OSBool_t can_proceed;
+    int ret_val;
+
+    waitlist = (flag == OS_MSG_QUEUE_SENDER_WAITING) ? 
+            &(msg_queue->send_waiters) : &(msg_queue->reveive_waiters);
+
+    portENTER_CRITICAL(&(msg_queue->mux));
+
+    /* Raise the flag with a compare-and-set, which also acts as a full barrier
+    between raising it and re-checking the ring below */
+    do {
+        old_flags = msg_queue->spsc_waiting;
+        new_flags = old_flags | flag;
+        uxPortCompareSet(&(msg_queue->spsc_waiting), old_flags, &new_flags);
+    } while(new_flags != old_flags);
+
+    /* The other side may have moved after our failed attempt but before it 
+    could see the flag. It will never wake us in that case, so check again */
+    if(flag == OS_MSG_QUEUE_SENDER_WAITING) {
+        can_proceed = (((msg_queue->ring_tail + 1) % msg_queue->ring_slots) != msg_queue->ring_head);
+    }
+    else {
+        can_proceed = (msg_queue->ring_head != msg_queue->ring_tail);
+    }
+    if(can_proceed == OS_TRUE) {
+        msg_queue->spsc_waiting &= ~flag;
+        portEXIT_CRITICAL(&(msg_queue->mux));
+        return OS_NO_ERROR;
+    }
+
+    /* Leave the ready list before dropping the mux so the wakeup can't be lost */
+    _OS_waitlist_append(cur_tcb, waitlist, &(msg_queue->mux));
+    ret_val = OS_schedule_block_current_task(timeout);
+    if(ret_val != OS_NO_ERROR) {
+        _OS_waitlist_remove(cur_tcb);
+        msg_queue->spsc_waiting &= ~flag;
+        portEXIT_CRITICAL(&(msg_queue->mux));
+        return ret_val;
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    portYIELD_WITHIN_API();
+
+    /* If the timeout woke us we are still on the waitlist */
+    portENTER_CRITICAL(&(msg_queue->mux));
+    if(cur_tcb->block_record.waitlist != NULL) {
+        _OS_waitlist_remove(cur_tcb);
+        msg_queue->spsc_waiting &= ~flag;
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    return OS_NO_ERROR;
+}
+
+/**
+ * Wake the other side of an SPSC queue after making progress, if it is 
+ * waiting. Only takes the mux when the wait flag is raised
+ */
+static void _OS_msg_spsc_wake(MessageQueue_t *msg_queue, uint32_t flag)
+{
+    WaitList_t *waitlist;
+    TCB_t *waiter = NULL;
+
+    /* Order our index update before reading the flag. Pairs with the
+    compare-and-set in _OS_msg_spsc_block */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if((msg_queue->spsc_waiting & flag) == 0) {
+        return;
+    }
+
+    waitlist = (flag == OS_MSG_QUEUE_SENDER_WAITING) ? 
+            &(msg_queue->send_waiters) : &(msg_queue->reveive_waiters);
+
+    portENTER_CRITICAL(&(msg_queue->mux));
+    if((msg_queue->spsc_waiting & flag) != 0) {
+        msg_queue->spsc_waiting &= ~flag;
+        if(waitlist->num_tasks != 0) {
+            waiter = _OS_waitlist_pop_head(waitlist);
+        }
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    if(waiter != NULL) {
+        OS_schedule_resume_task(waiter);
+    }
+}
+
+/**
+ * Send the message at item, blocking for up to timeout ticks if the queue is full
+ */
+static int _OS_msg_queue_send(MessageQueue_t *msg_queue, TickType_t timeout, const void * const item)
+{
+    TCB_t *sender = OS_schedule_get_current_tcb();
+    TCB_t *waiting_receiver = NULL;
+    TCB_t *waiting_sender = NULL;
+    OSBool_t waited = OS_FALSE;
+    int ret_val;
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        return _OS_msg_spsc_send(msg_queue, timeout, item);
+    }
+
+    while (OS_TRUE) {
+        portENTER_CRITICAL(&(msg_queue->mux));
+        
+        /* Add the message if there is room on the queue */
+        if (msg_queue->num_messages < msg_queue->max_messages)
+        {
+            /* The pool ran dry. Grow it outside the mux and try again */
+            if (_OS_msg_queue_put(msg_queue, sender, item) != OS_NO_ERROR)
+            {
+                portEXIT_CRITICAL(&(msg_queue->mux));
+                if(_OS_msg_depot_grow() != OS_NO_ERROR) {
+                    return OS_ERROR_MSG_POOL_RETR;
+                }
+                continue;
+            }
+
+            /* If tasks are waiting on this message queue, wake them up */
+            if(msg_queue->reveive_waiters.num_tasks != 0){
+                waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
+            }
+
+            /* Batch receives only wake one task. Pass the wakeup on while there is room */
+            if(msg_queue->num_messages < msg_queue->max_messages && msg_queue->send_waiters.num_tasks != 0) {
+                waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
+            }
+
+            portEXIT_CRITICAL(&(msg_queue->mux));
+
+            if(waiting_receiver != NULL){
+                /* Schedule the task that was waiting on a new message */
+                OS_schedule_resume_task(waiting_receiver);
+            }
+            if(waiting_sender != NULL){
+                OS_schedule_resume_task(waiting_sender);
+            }
+            return OS_NO_ERROR;
+        }
+
+        /* We were unable to add the message */
+
+        /* The queue was destroyed */
+        if(msg_queue == NULL) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_RESOURCE_DESTROYED;
+        }
+
+        if(timeout == 0) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_QUEUE_FULL;
+        }
+
+        /* The timeout already went off, but we were unable to find queue room */
+        if(waited == OS_TRUE) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        /* Wait on the waitlist so that we can be woken up if theres room in the queue */
+        ret_val = _OS_msg_queue_wait(msg_queue, &(msg_queue->send_waiters), timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Receive a message into item, blocking for up to timeout ticks if the queue
+ * is empty
+ */
+static int _OS_msg_queue_receive(MessageQueue_t *msg_queue, TickType_t timeout, void * const item)
+{
+    TCB_t *waiting_sender = NULL;
+    TCB_t *waiting_receiver = NULL;
+    Message_t *spent_list = NULL;
+    OSBool_t waited = OS_FALSE;
+    int ret_val;
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        return _OS_msg_spsc_receive(msg_queue, timeout, item);
+    }
+
+    while(OS_TRUE) {
+        portENTER_CRITICAL(&(msg_queue->mux));
+
+        /* There is a message on the queue that we can retrieve */
+        if(msg_queue->num_messages > 0) {
+            _OS_msg_queue_get(msg_queue, item, &spent_list);
+
+            /* If tasks are waiting on this message queue, wake them up */
+            if(msg_queue->send_waiters.num_tasks != 0){
+                waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
+            }
+
+            /* Batch sends only wake one task. Pass the wakeup on while messages remain */
+            if(msg_queue->num_messages != 0 && msg_queue->reveive_waiters.num_tasks != 0) {
+                waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
+            }
+
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            _OS_msg_pool_insert(spent_list);
+
+            if(waiting_sender != NULL){
+                /* Schedule the task that was waiting on a new message */
+                OS_schedule_resume_task(waiting_sender);
+            }
+            if(waiting_receiver != NULL){
+                OS_schedule_resume_task(waiting_receiver);
+            }
+            return OS_NO_ERROR;
+        }
+
+        /* We were unable to read because no messages were sent */
+
+        /* The queue was destroyed */
+        if(msg_queue == NULL){
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_RESOURCE_DESTROYED;
+        }
+
+        if(timeout == 0) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_QUEUE_EMPTY;
+        }
+
+        /* The timeout expired */
+        if(waited == OS_TRUE) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        /* Wait on the waitlist so that we can be woken up when a message is sent */
+        ret_val = _OS_msg_queue_wait(msg_queue, &(msg_queue->reveive_waiters), timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Send the message at item if the queue has room, without blocking
+ */
+static int _OS_msg_queue_try_send(MessageQueue_t *msg_queue, const void * const item)
+{
+    TCB_t *sender = OS_schedule_get_current_tcb();
+    TCB_t *waiting_receiver = NULL;
+    TCB_t *waiting_sender = NULL;
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        return (_OS_msg_spsc_send(msg_queue, 0, item) == OS_NO_ERROR) ? OS_NO_ERROR : -1;
+    }
+
+    while(OS_TRUE) {
+        portENTER_CRITICAL(&(msg_queue->mux));
+
+        /* There is no room on the queue */
+        if(msg_queue->num_messages >= msg_queue->max_messages) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return -1;
+        }
+
+        if(_OS_msg_queue_put(msg_queue, sender, item) == OS_NO_ERROR) {
+            break;
+        }
+
+        /* The pool ran dry. Grow it outside the mux and try again */
+        portEXIT_CRITICAL(&(msg_queue->mux));
+        if(_OS_msg_depot_grow() != OS_NO_ERROR) {
+            return OS_ERROR_MSG_POOL_RETR;
+        }
+    }
+
+    /* If tasks are waiting on this message queue, wake them up */
+    if(msg_queue->reveive_waiters.num_tasks != 0){
+        waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
+    }
+
+    /* Batch receives only wake one task. Pass the wakeup on while there is room */
+    if(msg_queue->num_messages < msg_queue->max_messages && msg_queue->send_waiters.num_tasks != 0) {
+        waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
+    }
+
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    if(waiting_receiver != NULL){
+        /* Schedule the task that was waiting on a new message */
+        OS_schedule_resume_task(waiting_receiver);
+    }
+    if(waiting_sender != NULL){
+        OS_schedule_resume_task(waiting_sender);
+    }
+
+    return OS_NO_ERROR;
+}
+
+/**
+ * Receive a message into item if the queue has one, without blocking
+ */
+static int _OS_msg_queue_try_receive(MessageQueue_t *msg_queue, void * const item)
+{
+    TCB_t *waiting_sender = NULL;
+    TCB_t *waiting_receiver = NULL;
+    Message_t *spent_list = NULL;
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        return _OS_msg_spsc_receive(msg_queue, 0, item);
+    }
+
+    portENTER_CRITICAL(&(msg_queue->mux));
+
+    /* There is a message on the queue that we can retrieve */
+    if(msg_queue->num_messages > 0) {
+        _OS_msg_queue_get(msg_queue, item, &spent_list);
+
+        /* If tasks are waiting on this message queue, wake them up */
+        if(msg_queue->send_waiters.num_tasks != 0){
+            waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
+        }
+
+        /* Batch sends only wake one task. Pass the wakeup on while messages remain */
+        if(msg_queue->num_messages != 0 && msg_queue->reveive_waiters.num_tasks != 0) {
+            waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
+        }
+
+        portEXIT_CRITICAL(&(msg_queue->mux));
+        _OS_msg_pool_insert(spent_list);
+
+        if(waiting_sender != NULL){
+            /* Schedule the task that was waiting on a new message */
+            OS_schedule_resume_task(waiting_sender);
+        }
+        if(waiting_receiver != NULL){
+            OS_schedule_resume_task(waiting_receiver);
+        }
+
+        return OS_NO_ERROR;
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+    return OS_ERROR_QUEUE_EMPTY;
+}
+
+/**
+ * Send as many of num_items messages as fit, blocking for up to timeout ticks
+ * if none do. The queue's mux is taken once per attempt and a single receiver
+ * is woken, which passes the wakeup on if messages remain. Like a single send,
+ * another sender is woken if room is left over
+ */
+static int _OS_msg_queue_send_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            const uint8_t *items, int num_items, int *num_sent)
+{
+    TCB_t *sender = OS_schedule_get_current_tcb();
+    TCB_t *waiting_receiver = NULL;
+    TCB_t *waiting_sender = NULL;
+    OSBool_t waited = OS_FALSE;
+    int ret_val;
+    int count = 0;
+
+    while(OS_TRUE) {
+        portENTER_CRITICAL(&(msg_queue->mux));
+
+        /* Add as many messages as there is room for */
+        while(count < num_items && msg_queue->num_messages < msg_queue->max_messages) {
+            if(_OS_msg_queue_put(msg_queue, sender, items + count * msg_queue->item_size) != OS_NO_ERROR) {
+                break;
+            }
+            count++;
+        }
+
+        if(count != 0) {
+            if(msg_queue->reveive_waiters.num_tasks != 0){
+                waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
+            }
+
+            /* Batch receives only wake one task. Pass the wakeup on while there is room */
+            if(msg_queue->num_messages < msg_queue->max_messages && msg_queue->send_waiters.num_tasks != 0) {
+                waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
+            }
+
+            portEXIT_CRITICAL(&(msg_queue->mux));
+
+            if(waiting_receiver != NULL){
+                OS_schedule_resume_task(waiting_receiver);
+            }
+            if(waiting_sender != NULL){
+                OS_schedule_resume_task(waiting_sender);
+            }
+            *num_sent = count;
+            return OS_NO_ERROR;
+        }
+
+        /* There was room but the pool ran dry. Grow it outside the mux and try again */
+        if(msg_queue->num_messages < msg_queue->max_messages) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            if(_OS_msg_depot_grow() != OS_NO_ERROR) {
+                return OS_ERROR_MSG_POOL_RETR;
+            }
+            continue;
+        }
+
+        if(timeout == 0) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_QUEUE_FULL;
+        }
+
+        /* The timeout already went off, but we were unable to find queue room */
+        if(waited == OS_TRUE) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        ret_val = _OS_msg_queue_wait(msg_queue, &(msg_queue->send_waiters), timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Receive up to max_items messages, blocking for up to timeout ticks if there
+ * are none. The queue's mux is taken once per attempt and a single sender is
+ * woken, which passes the wakeup on if room remains. Like a single receive,
+ * another receiver is woken if messages are left over
+ */
+static int _OS_msg_queue_receive_batch(MessageQueue_t *msg_queue, TickType_t timeout, 
+            uint8_t *items, int max_items, int *num_received)
+{
+    TCB_t *waiting_sender = NULL;
+    TCB_t *waiting_receiver = NULL;
+    Message_t *spent_list = NULL;
+    OSBool_t waited = OS_FALSE;
+    int ret_val;
+    int count = 0;
+
+    while(OS_TRUE) {
+        portENTER_CRITICAL(&(msg_queue->mux));
+
+        if(msg_queue->num_messages > 0) {
+            while(count < max_items && msg_queue->num_messages > 0) {
+                _OS_msg_queue_get(msg_queue, items + count * msg_queue->item_size, &spent_list);
+                count++;
+            }
+
+            if(msg_queue->send_waiters.num_tasks != 0){
+                waiting_sender = _OS_waitlist_pop_head(&(msg_queue->send_waiters));
+            }
+
+            /* Batch sends only wake one task. Pass the wakeup on while messages remain */
+            if(msg_queue->num_messages != 0 && msg_queue->reveive_waiters.num_tasks != 0) {
+                waiting_receiver = _OS_waitlist_pop_head(&(msg_queue->reveive_waiters));
+            }
+
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            _OS_msg_pool_insert(spent_list);
+
+            if(waiting_sender != NULL){
+                OS_schedule_resume_task(waiting_sender);
+            }
+            if(waiting_receiver != NULL){
+                OS_schedule_resume_task(waiting_receiver);
+            }
+            *num_received = count;
+            return OS_NO_ERROR;
+        }
+
+        if(timeout == 0) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_QUEUE_EMPTY;
+        }
+
+        /* The timeout expired */
+        if(waited == OS_TRUE) {
+            portEXIT_CRITICAL(&(msg_queue->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        ret_val = _OS_msg_queue_wait(msg_queue, &(msg_queue->reveive_waiters), timeout);
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Wait for room and return the tail slot of a fixed size queue without 
+ * sending anything. Only the task holding the loan calls this
+ */
+static int _OS_msg_queue_reserve_tail(MessageQueue_t *msg_queue, TickType_t timeout, void ** slot)
+{
+    OSBool_t waited = OS_FALSE;
+    int ret_val;
+    int tail;
+
+    while(OS_TRUE) {
+        if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+            tail = msg_queue->ring_tail;
+            if(((tail + 1 == msg_queue->ring_slots) ? 0 : tail + 1) != 
+                    __atomic_load_n(&(msg_queue->ring_head), __ATOMIC_ACQUIRE)) {
+                *slot = msg_queue->ring + tail * msg_queue->slot_size;
+                return OS_NO_ERROR;
+            }
+            if(timeout == 0) {
+                return OS_ERROR_QUEUE_FULL;
+            }
+            if(waited == OS_TRUE) {
+                return OS_ERROR_TIMER_EXPIRED;
+            }
+            ret_val = _OS_msg_spsc_block(msg_queue, OS_MSG_QUEUE_SENDER_WAITING, timeout);
+        }
+        else {
+            portENTER_CRITICAL(&(msg_queue->mux));
+            if(msg_queue->num_messages < msg_queue->max_messages) {
+                *slot = msg_queue->ring + msg_queue->ring_tail * msg_queue->slot_size;
+                portEXIT_CRITICAL(&(msg_queue->mux));
+                return OS_NO_ERROR;
+            }
+            if(timeout == 0) {
+                portEXIT_CRITICAL(&(msg_queue->mux));
+                return OS_ERROR_QUEUE_FULL;
+            }
+            if(waited == OS_TRUE) {
+                portEXIT_CRITICAL(&(msg_queue->mux));
+                return OS_ERROR_TIMER_EXPIRED;
+            }
+            ret_val = _OS_msg_queue_wait(msg_queue, &(msg_queue->send_waiters), timeout);
+        }
+
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Wait for a message and return the head slot of a fixed size queue without 
+ * removing it. Only the task holding the peek calls this
+ */
+static int _OS_msg_queue_reserve_head(MessageQueue_t *msg_queue, TickType_t timeout, void ** slot)
+{
+    OSBool_t waited = OS_FALSE;
+    int ret_val;
+    int head;
+
+    while(OS_TRUE) {
+        if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+            head = msg_queue->ring_head;
+            if(head != __atomic_load_n(&(msg_queue->ring_tail), __ATOMIC_ACQUIRE)) {
+                *slot = msg_queue->ring + head * msg_queue->slot_size;
+                return OS_NO_ERROR;
+            }
+            if(timeout == 0) {
+                return OS_ERROR_QUEUE_EMPTY;
+            }
+            if(waited == OS_TRUE) {
+                return OS_ERROR_TIMER_EXPIRED;
+            }
+            ret_val = _OS_msg_spsc_block(msg_queue, OS_MSG_QUEUE_RECEIVER_WAITING, timeout);
+        }
+        else {
+            portENTER_CRITICAL(&(msg_queue->mux));
+            if(msg_queue->num_messages > 0) {
+                *slot = msg_queue->ring + msg_queue->ring_head * msg_queue->slot_size;
+                portEXIT_CRITICAL(&(msg_queue->mux));
+                return OS_NO_ERROR;
+            }
+            if(timeout == 0) {
+                portEXIT_CRITICAL(&(msg_queue->mux));
+                return OS_ERROR_QUEUE_EMPTY;
+            }
+            if(waited == OS_TRUE) {
+                portEXIT_CRITICAL(&(msg_queue->mux));
+                return OS_ERROR_TIMER_EXPIRED;
+            }
+            ret_val = _OS_msg_queue_wait(msg_queue, &(msg_queue->reveive_waiters), timeout);
+        }
+
+        if(ret_val != OS_NO_ERROR) {
+            return ret_val;
+        }
+        waited = OS_TRUE;
+    }
+}
+
+/**
+ * Block the current task on one of a queue's waitlists until it is woken or
+ * the timeout expires. Caller must hold the queue's mux, which is released
+ */
+static int _OS_msg_queue_wait(MessageQueue_t *msg_queue, WaitList_t *waitlist, TickType_t timeout)
+{
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    int ret_val;
+
+    /* Leave the ready list before dropping the mux so the wakeup can't be lost */
+    _OS_waitlist_append(cur_tcb, waitlist, &(msg_queue->mux));
+    ret_val = OS_schedule_block_current_task(timeout);
+    if(ret_val != OS_NO_ERROR) {
+        _OS_waitlist_remove(cur_tcb);
+        portEXIT_CRITICAL(&(msg_queue->mux));
+        return ret_val;
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    portYIELD_WITHIN_API();
+
+    /* If the timeout woke us we are still on the waitlist */
+    portENTER_CRITICAL(&(msg_queue->mux));
+    if(cur_tcb->block_record.waitlist != NULL) {
+        _OS_waitlist_remove(cur_tcb);
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    return OS_NO_ERROR;
+}
+
+/**
+ * Atomically raise a loan flag. Returns false if it was already raised
+ */
+static OSBool_t _OS_msg_queue_claim(MessageQueue_t *msg_queue, uint32_t flag)
+{
+    uint32_t old_flags, new_flags;
+
+    do {
+        old_flags = msg_queue->loan_flags;
+        if((old_flags & flag) != 0) {
+            return OS_FALSE;
+        }
+        new_flags = old_flags | flag;
+        uxPortCompareSet(&(msg_queue->loan_flags), old_flags, &new_flags);
+    } while(new_flags != old_flags);
+
+    return OS_TRUE;
+}
+
+/**
+ * Atomically lower a loan flag
+ */
+static void _OS_msg_queue_unclaim(MessageQueue_t *msg_queue, uint32_t flag)
+{
+    uint32_t old_flags, new_flags;
+
+    do {
+        old_flags = msg_queue->loan_flags;
+        new_flags = old_flags & ~flag;
+        uxPortCompareSet(&(msg_queue->loan_flags), old_flags, &new_flags);
+    } while(new_flags != old_flags);
+}
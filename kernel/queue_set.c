@@ -0,0 +1,570 @@
+/* Standard includes. */
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+/* FreeRTOS includes. */
+#include "FreeRTOS_old.h"
+#include "verios.h"
+#include "task.h"
+#include "schedule.h"
+#include "verios_util.h"
+#include "msg_queue.h"
+#include "sem.h"
+#include "queue_set.h"
+#include "portmacro.h"
+
+/*******************************************************************************
+* STATIC FUNCTION DECLARATIONS
+*******************************************************************************/
+
+static int _OS_queue_set_add_member(QueueSet_t *queue_set, QSetMember_t member, int count, int capacity);
+
+/*******************************************************************************
+* Queue Set Create (API FUNCTION)
+*
+*   set_ptr = A reference to the pointer where the set will be allocated
+*   set_size = The most ready events the set can hold at once
+*
+* PURPOSE :
+*
+*   Create a queue set, which lets one task block on several message queues
+*   and semaphores at once and wake on the first one that is ready
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*
+*   Every message and every semaphore unit in a member is one event, so
+*   set_size must be at least the sum of the sizes of the member queues plus
+*   the max_count of the member semaphores. Members that don't fit can't be
+*   added
+*******************************************************************************/
+
+int OS_queue_set_create(QSet_t *set_ptr, int set_size)
+{
+    QueueSet_t *queue_set;
+
+    if(set_size <= 0 ||
+            (size_t)set_size >= (SIZE_MAX - sizeof(QueueSet_t)) / sizeof(QSetMember_t)) {
+        return OS_ERROR_INVALID_QUEUE_SIZE;
+    }
+
+    if(set_ptr == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+
+    /* Allocate the set and its ready ring together */
+    queue_set = malloc(sizeof(QueueSet_t) + (size_t)set_size * sizeof(QSetMember_t));
+    if(queue_set == NULL) {
+        return OS_ERROR_QUEUE_SET_ALLOC;
+    }
+
+    queue_set->ready = (QSetMember_t *)(queue_set + 1);
+    queue_set->ready_slots = set_size;
+    queue_set->ready_head = 0;
+    queue_set->ready_tail = 0;
+    queue_set->num_ready = 0;
+    queue_set->num_members = 0;
+    queue_set->reserved = 0;
+    _OS_list_header_init(&(queue_set->waiters));
+    vPortCPUInitializeMutex(&queue_set->mux);
+
+    *set_ptr = (void *)queue_set;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Queue Set Delete (API FUNCTION)
+*
+*   set = The queue set to delete
+*
+* PURPOSE :
+*
+*   Destroy a queue set and free up any tasks waiting on it
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*
+*   Every member must be removed first
+*******************************************************************************/
+
+int OS_queue_set_delete(QSet_t set)
+{
+    QueueSet_t *queue_set = (QueueSet_t *)set;
+
+    if(queue_set == NULL) {
+        return OS_ERROR_INVALID_QUEUE_SET;
+    }
+
+    portENTER_CRITICAL(&(queue_set->mux));
+    if(queue_set->num_members != 0) {
+        portEXIT_CRITICAL(&(queue_set->mux));
+        return OS_ERROR_QUEUE_SET_MEMBER;
+    }
+    OS_schedule_waitlist_empty(&(queue_set->waiters));
+    portEXIT_CRITICAL(&(queue_set->mux));
+
+    free(queue_set);
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Queue Set Add Queue (API FUNCTION)
+*
+*   set = The queue set to add to
+*   queue = The message queue to add
+*
+* PURPOSE :
+*
+*   Make a message queue a member of a set. Messages already on the queue are
+*   reported as ready right away
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*
+*   The set reserves room for as many events as the queue holds messages and
+*   fails with OS_ERROR_QUEUE_SET_FULL if it has too little left.
+*   A queue can be in at most one set. An OS_MSG_QUEUE_MODE_SPSC queue should
+*   be added before its sender starts, since its sends don't take the queue's
+*   mux. Receive exactly one message each time OS_queue_set_select returns
+*   the queue. Receiving any other way (OS_msg_queue_try_receive without a
+*   select, or a blocking receive) leaves a stale event in the set, and later
+*   sends then post past the queue's reservation. That is a fatal misuse: it
+*   trips the assert in _OS_queue_set_post, or with asserts off the set 
+*   drops events and select can miss ready members
+*******************************************************************************/
+
+int OS_queue_set_add_queue(QSet_t set, MsgQueue_t queue)
+{
+    QueueSet_t *queue_set = (QueueSet_t *)set;
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+    int count;
+    int ret_val;
+
+    if(queue_set == NULL) {
+        return OS_ERROR_INVALID_QUEUE_SET;
+    }
+    if(msg_queue == NULL) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+
+    portENTER_CRITICAL(&(msg_queue->mux));
+    if(msg_queue->queue_set != NULL) {
+        portEXIT_CRITICAL(&(msg_queue->mux));
+        return OS_ERROR_QUEUE_SET_MEMBER;
+    }
+
+    if(msg_queue->mode == OS_MSG_QUEUE_MODE_SPSC) {
+        count = (msg_queue->ring_tail - msg_queue->ring_head + msg_queue->ring_slots) %
+                msg_queue->ring_slots;
+    }
+    else {
+        count = msg_queue->num_messages;
+    }
+
+    ret_val = _OS_queue_set_add_member(queue_set, queue, count, msg_queue->max_messages);
+    if(ret_val == OS_NO_ERROR) {
+        __atomic_store_n(&(msg_queue->queue_set), queue_set, __ATOMIC_RELEASE);
+    }
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    return ret_val;
+}
+
+/*******************************************************************************
+* Queue Set Add Semaphore (API FUNCTION)
+*
+*   set = The queue set to add to
+*   semaphore = The semaphore to add
+*   max_count = The most units the semaphore may count while in the set
+*
+* PURPOSE :
+*
+*   Make a semaphore a member of a set. Each unit the semaphore currently has
+*   is reported as ready right away
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*
+*   The set reserves room for max_count events and fails with 
+*   OS_ERROR_QUEUE_SET_FULL if it has too little left. Releases that would 
+*   count past max_count fail instead of overflowing the set.
+*   A semaphore can be in at most one set. Take exactly one unit with 
+*   OS_sem_try_take each time OS_queue_set_select returns it. Taking a unit 
+*   any other way (OS_sem_take, or a try take without a select) leaves a 
+*   stale event in the set, and later releases then post past max_count. 
+*   That is a fatal misuse: it trips the assert in _OS_queue_set_post, or 
+*   with asserts off the set drops events and select can miss ready members
+*******************************************************************************/
+
+int OS_queue_set_add_sem(QSet_t set, Sem_t semaphore, int max_count)
+{
+    QueueSet_t *queue_set = (QueueSet_t *)set;
+    Semaphore_t *sem = (Semaphore_t *)semaphore;
+    uint32_t state;
+    int ret_val;
+
+    if(queue_set == NULL) {
+        return OS_ERROR_INVALID_QUEUE_SET;
+    }
+    if(sem == NULL) {
+        return OS_ERROR_INVALID_SEM;
+    }
+    if(max_count <= 0 || max_count > OS_SEM_MAX_VALUE) {
+        return OS_ERROR_INVALID_SEM_VALUE;
+    }
+
+    portENTER_CRITICAL(&(sem->mux));
+    if(sem->queue_set != NULL) {
+        portEXIT_CRITICAL(&(sem->mux));
+        return OS_ERROR_QUEUE_SET_MEMBER;
+    }
+
+    /* Once flagged, releases take the slow path and post to the set, so the 
+    units counted here are exactly the ones not posted */
+    state = _OS_sem_update_state(sem, 0, OS_SEM_IN_SET, 0);
+    if(OS_SEM_COUNT(state) > max_count) {
+        ret_val = OS_ERROR_INVALID_SEM_VALUE;
+    }
+    else {
+        ret_val = _OS_queue_set_add_member(queue_set, semaphore, OS_SEM_COUNT(state), max_count);
+    }
+    if(ret_val == OS_NO_ERROR) {
+        sem->queue_set = queue_set;
+        sem->set_max_count = max_count;
+    }
+    else {
+        (void) _OS_sem_update_state(sem, OS_SEM_IN_SET, 0, 0);
+    }
+    portEXIT_CRITICAL(&(sem->mux));
+
+    return ret_val;
+}
+
+/*******************************************************************************
+* Queue Set Remove Queue (API FUNCTION)
+*
+*   set = The queue set to remove from
+*   queue = The message queue to remove
+*
+* PURPOSE :
+*
+*   Take a message queue out of a set. Any ready events it still had in the
+*   set are dropped, but its messages stay on the queue
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*******************************************************************************/
+
+int OS_queue_set_remove_queue(QSet_t set, MsgQueue_t queue)
+{
+    QueueSet_t *queue_set = (QueueSet_t *)set;
+    MessageQueue_t *msg_queue = (MessageQueue_t *)queue;
+
+    if(queue_set == NULL) {
+        return OS_ERROR_INVALID_QUEUE_SET;
+    }
+    if(msg_queue == NULL) {
+        return OS_ERROR_INVALID_QUEUE;
+    }
+
+    portENTER_CRITICAL(&(msg_queue->mux));
+    if(msg_queue->queue_set != queue_set) {
+        portEXIT_CRITICAL(&(msg_queue->mux));
+        return OS_ERROR_QUEUE_SET_MEMBER;
+    }
+    __atomic_store_n(&(msg_queue->queue_set), NULL, __ATOMIC_RELEASE);
+    _OS_queue_set_remove_member(queue_set, queue, msg_queue->max_messages);
+    portEXIT_CRITICAL(&(msg_queue->mux));
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Queue Set Remove Semaphore (API FUNCTION)
+*
+*   set = The queue set to remove from
+*   semaphore = The semaphore to remove
+*
+* PURPOSE :
+*
+*   Take a semaphore out of a set. Any ready events it still had in the set
+*   are dropped, but its count is unchanged
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*******************************************************************************/
+
+int OS_queue_set_remove_sem(QSet_t set, Sem_t semaphore)
+{
+    QueueSet_t *queue_set = (QueueSet_t *)set;
+    Semaphore_t *sem = (Semaphore_t *)semaphore;
+
+    if(queue_set == NULL) {
+        return OS_ERROR_INVALID_QUEUE_SET;
+    }
+    if(sem == NULL) {
+        return OS_ERROR_INVALID_SEM;
+    }
+
+    portENTER_CRITICAL(&(sem->mux));
+    if(sem->queue_set != queue_set) {
+        portEXIT_CRITICAL(&(sem->mux));
+        return OS_ERROR_QUEUE_SET_MEMBER;
+    }
+    sem->queue_set = NULL;
+    (void) _OS_sem_update_state(sem, OS_SEM_IN_SET, 0, 0);
+    _OS_queue_set_remove_member(queue_set, semaphore, sem->set_max_count);
+    portEXIT_CRITICAL(&(sem->mux));
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Queue Set Select (API FUNCTION)
+*
+*   set = The queue set to wait on
+*   timeout = Max amount of time to wait if no member is ready
+*   member = Filled with the member that is ready, or NULL on error
+*
+* PURPOSE :
+*
+*   Block until any member of the set has a message or unit available and
+*   report which one. The caller then receives from (or takes) that member
+*   without blocking
+*
+* RETURN :
+*
+*   Return an error message or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*
+*   Members are reported once per message or unit, in the order they became
+*   ready. Use OS_NO_TIMEOUT as the timeout to wait forever, or 0 to poll
+*******************************************************************************/
+
+int OS_queue_set_select(QSet_t set, TickType_t timeout, QSetMember_t *member)
+{
+    QueueSet_t *queue_set = (QueueSet_t *)set;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    TCB_t *next_waiter = NULL;
+    TimeOut_t time_out;
+    OSBool_t waited = OS_FALSE;
+    int ret_val;
+
+    if(queue_set == NULL) {
+        return OS_ERROR_INVALID_QUEUE_SET;
+    }
+    if(member == NULL) {
+        return OS_ERROR_QUEUE_NULL_PTR;
+    }
+    *member = NULL;
+
+    while(OS_TRUE) {
+        portENTER_CRITICAL(&(queue_set->mux));
+
+        if(queue_set->num_ready != 0) {
+            *member = queue_set->ready[queue_set->ready_head];
+            if(++queue_set->ready_head == queue_set->ready_slots) {
+                queue_set->ready_head = 0;
+            }
+            queue_set->num_ready--;
+
+            /* Posts only wake one task. Pass the wakeup on while members are ready */
+            if(queue_set->num_ready != 0 && queue_set->waiters.num_tasks != 0) {
+                next_waiter = _OS_waitlist_pop_head(&(queue_set->waiters));
+            }
+            portEXIT_CRITICAL(&(queue_set->mux));
+
+            if(next_waiter != NULL) {
+                OS_schedule_resume_task(next_waiter);
+            }
+            return OS_NO_ERROR;
+        }
+
+        if(timeout == 0) {
+            portEXIT_CRITICAL(&(queue_set->mux));
+            return OS_ERROR_QUEUE_EMPTY;
+        }
+
+        /* Another selector may have taken the event that woke us. Keep waiting
+        until one is ready or the whole timeout has passed */
+        if(waited == OS_FALSE) {
+            OS_set_timeout_state(&time_out);
+        }
+        else if(OS_schedule_check_for_timeout(&time_out, &timeout) == OS_TRUE) {
+            portEXIT_CRITICAL(&(queue_set->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        /* Leave the ready list before dropping the mux so the wakeup can't be lost */
+        _OS_waitlist_append(cur_tcb, &(queue_set->waiters), &(queue_set->mux));
+        ret_val = OS_schedule_block_current_task(timeout);
+        if(ret_val != OS_NO_ERROR) {
+            _OS_waitlist_remove(cur_tcb);
+            portEXIT_CRITICAL(&(queue_set->mux));
+            return ret_val;
+        }
+        portEXIT_CRITICAL(&(queue_set->mux));
+
+        portYIELD_WITHIN_API();
+
+        /* If the timeout woke us we are still on the waitlist */
+        portENTER_CRITICAL(&(queue_set->mux));
+        if(cur_tcb->block_record.waitlist != NULL) {
+            _OS_waitlist_remove(cur_tcb);
+        }
+        portEXIT_CRITICAL(&(queue_set->mux));
+
+        waited = OS_TRUE;
+    }
+}
+
+/*******************************************************************************
+* Queue Set Post
+*
+*   queue_set = The set the member belongs to
+*   member = The member that has become ready
+*   count = The number of new messages or units in the member
+*
+* PURPOSE :
+*
+*   Report that a member has count more messages or units, waking a task
+*   blocked in OS_queue_set_select if there is one
+*
+* RETURN :
+*
+* NOTES:
+*
+*   Called by the members with their own mux held. Never takes a member's mux.
+*   Members never hold more events than the capacity they reserved, so the 
+*   set always has room as long as members are only read once selected. A 
+*   member read outside select breaks that. Events that don't fit are then
+*   dropped rather than written over the ring
+*******************************************************************************/
+
+void _OS_queue_set_post(QueueSet_t *queue_set, QSetMember_t member, int count)
+{
+    TCB_t *waiter = NULL;
+
+    if(count == 0) {
+        return;
+    }
+
+    portENTER_CRITICAL(&(queue_set->mux));
+    configASSERT(queue_set->num_ready + count <= queue_set->ready_slots);
+    if(count > queue_set->ready_slots - queue_set->num_ready) {
+        count = queue_set->ready_slots - queue_set->num_ready;
+    }
+
+    queue_set->num_ready += count;
+    while(count-- != 0) {
+        queue_set->ready[queue_set->ready_tail] = member;
+        if(++queue_set->ready_tail == queue_set->ready_slots) {
+            queue_set->ready_tail = 0;
+        }
+    }
+
+    if(queue_set->waiters.num_tasks != 0) {
+        waiter = _OS_waitlist_pop_head(&(queue_set->waiters));
+    }
+    portEXIT_CRITICAL(&(queue_set->mux));
+
+    if(waiter != NULL) {
+        OS_schedule_resume_task(waiter);
+    }
+}
+
+/*******************************************************************************
+* Queue Set Remove Member
+*
+*   queue_set = The set the member belongs to
+*   member = The member leaving the set
+*   capacity = The ready slots the member reserved when it was added
+*
+* PURPOSE :
+*
+*   Drop a member's ready events from the set, stop counting it as a member
+*   and give back its reserved slots
+*
+* RETURN :
+*
+* NOTES:
+*
+*   The caller must already have cleared the member's queue_set pointer, with
+*   the member's mux held, so that no new events are posted
+*******************************************************************************/
+
+void _OS_queue_set_remove_member(QueueSet_t *queue_set, QSetMember_t member, int capacity)
+{
+    int num_entries;
+    int read_index;
+    int write_index;
+
+    portENTER_CRITICAL(&(queue_set->mux));
+
+    /* Compact the ring in place, keeping the order of the other members */
+    num_entries = queue_set->num_ready;
+    read_index = queue_set->ready_head;
+    write_index = queue_set->ready_head;
+    while(num_entries-- != 0) {
+        if(queue_set->ready[read_index] != member) {
+            queue_set->ready[write_index] = queue_set->ready[read_index];
+            if(++write_index == queue_set->ready_slots) {
+                write_index = 0;
+            }
+        }
+        else {
+            queue_set->num_ready--;
+        }
+        if(++read_index == queue_set->ready_slots) {
+            read_index = 0;
+        }
+    }
+    queue_set->ready_tail = write_index;
+    queue_set->num_members--;
+    queue_set->reserved -= capacity;
+
+    portEXIT_CRITICAL(&(queue_set->mux));
+}
+
+/*******************************************************************************
+* STATIC FUNCTION DEFINITIONS
+*******************************************************************************/
+
+/**
+ * Count a new member, reserve capacity ready slots for it and post the count
+ * events it already has. Caller must hold the member's mux
+ */
+static int _OS_queue_set_add_member(QueueSet_t *queue_set, QSetMember_t member, int count, int capacity)
+{
+    portENTER_CRITICAL(&(queue_set->mux));
+    if(capacity > queue_set->ready_slots - queue_set->reserved) {
+        portEXIT_CRITICAL(&(queue_set->mux));
+        return OS_ERROR_QUEUE_SET_FULL;
+    }
+    queue_set->reserved += capacity;
+    queue_set->num_members++;
+    portEXIT_CRITICAL(&(queue_set->mux));
+
+    _OS_queue_set_post(queue_set, member, count);
+    return OS_NO_ERROR;
+}
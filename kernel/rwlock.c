@@ -0,0 +1,519 @@
+/* Standard includes. */
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+/* FreeRTOS includes. */
+#include "FreeRTOS_old.h"
+#include "verios.h"
+#include "task.h"
+#include "schedule.h"
+#include "verios_util.h"
+#include "rwlock.h"
+#include "portmacro.h"
+
+/*******************************************************************************
+* STATIC FUNCTION DECLARATIONS
+*******************************************************************************/
+
+static uint32_t _OS_rwlock_update_state(ReadWriteLock_t *rwlock, uint32_t clear,
+            uint32_t set, uint32_t add);
+
+static int _OS_rwlock_block(ReadWriteLock_t *rwlock, WaitList_t *waitlist, TickType_t timeout);
+
+static int _OS_rwlock_grant(ReadWriteLock_t *rwlock, OSBool_t readers_first, TCB_t **woken);
+
+static void _OS_rwlock_wake(ReadWriteLock_t *rwlock, OSBool_t readers_first, TCB_t **woken, int num_woken);
+
+/*******************************************************************************
+* Reader-Writer Lock Create (API FUNCTION)
+*
+*   rwlock_ptr = A pointer to a RWLock_t reference for the lock we will create
+*   writer_preference = OS_TRUE to make new readers wait behind waiting writers
+*
+* PURPOSE :
+*
+*   Create a reader-writer lock for data that is read by many tasks and
+*   rarely written. Readers hold the lock together and only writers exclude
+*   each other and the readers
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occurred
+*
+* NOTES:
+*
+*   Without writer preference, a steady stream of readers can keep a writer
+*   waiting forever. With it, a task that already holds a read lock must not
+*   read lock again, or it may wait behind a writer that waits on it
+*******************************************************************************/
+
+int OS_rwlock_create(RWLock_t *rwlock_ptr, OSBool_t writer_preference)
+{
+    ReadWriteLock_t *rwlock;
+
+    rwlock = malloc(sizeof(ReadWriteLock_t));
+    if(rwlock == NULL) {
+        return OS_ERROR_RWLOCK_ALLOC;
+    }
+
+    rwlock->state = 0;
+    rwlock->writer = NULL;
+    rwlock->writer_preference = writer_preference;
+    _OS_list_header_init(&(rwlock->read_waiters));
+    _OS_list_header_init(&(rwlock->write_waiters));
+    vPortCPUInitializeMutex(&(rwlock->mux));
+
+    *rwlock_ptr = (void *)rwlock;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Reader-Writer Lock Delete (API FUNCTION)
+*
+*   rwlock_ptr = A pointer to the RWLock_t reference for the lock to delete
+*
+* PURPOSE :
+*
+*   Destroy a reader-writer lock and free its associated data
+*
+* RETURN :
+*
+*   Returns an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES:
+*******************************************************************************/
+
+int OS_rwlock_delete(RWLock_t *rwlock_ptr)
+{
+    ReadWriteLock_t *rwlock;
+
+    if(rwlock_ptr == NULL || *rwlock_ptr == NULL) {
+        return OS_ERROR_INVALID_RWLOCK;
+    }
+    rwlock = (ReadWriteLock_t *)(*rwlock_ptr);
+
+    portENTER_CRITICAL(&(rwlock->mux));
+    OS_schedule_waitlist_empty(&(rwlock->read_waiters));
+    OS_schedule_waitlist_empty(&(rwlock->write_waiters));
+    portEXIT_CRITICAL(&(rwlock->mux));
+
+    free(rwlock);
+    *rwlock_ptr = NULL;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Reader-Writer Lock Read Lock (API FUNCTION)
+*
+*   rwlock = The lock to take for reading
+*   timeout = The most ticks to wait. 0 never blocks, OS_NO_TIMEOUT waits forever
+*
+* PURPOSE :
+*
+*   Take a reader-writer lock shared with other readers. Blocks while a writer
+*   holds the lock, or with writer preference while a writer is waiting
+*
+* RETURN :
+*
+*   Return OS_ERROR_RWLOCK_UNAVAILABLE if timeout was 0 and the lock couldn't
+*   be taken, OS_ERROR_TIMER_EXPIRED if the timeout passed, another error
+*   message, or 0 (OS_NO_ERROR) if the lock was taken
+*
+* NOTES:
+*
+*   With no tasks waiting, this is a single compare-and-set on the state word
+*******************************************************************************/
+
+int OS_rwlock_read_lock(RWLock_t rwlock, TickType_t timeout)
+{
+    ReadWriteLock_t *rw = (ReadWriteLock_t *)rwlock;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    OSBool_t waited = OS_FALSE;
+    uint32_t state, new_state;
+    int ret_val;
+
+    if(rw == NULL) {
+        return OS_ERROR_INVALID_RWLOCK;
+    }
+
+    /* Fast path. No writer and nobody waiting, so just count ourselves in */
+    state = rw->state;
+    while((state & (OS_RWLOCK_WRITER | OS_RWLOCK_WAITERS)) == 0) {
+        new_state = state + OS_RWLOCK_READER_ONE;
+        uxPortCompareSet(&(rw->state), state, &new_state);
+        if(new_state == state) {
+            return OS_NO_ERROR;
+        }
+        state = new_state;
+    }
+
+    portENTER_CRITICAL(&(rw->mux));
+    while(OS_TRUE) {
+        state = rw->state;
+        if((state & OS_RWLOCK_WRITER) == 0 && (rw->writer_preference == OS_FALSE ||
+                rw->write_waiters.num_tasks == 0)) {
+            new_state = state + OS_RWLOCK_READER_ONE;
+            uxPortCompareSet(&(rw->state), state, &new_state);
+            if(new_state != state) {
+                continue;
+            }
+            break;
+        }
+        if(timeout == 0) {
+            portEXIT_CRITICAL(&(rw->mux));
+            return OS_ERROR_RWLOCK_UNAVAILABLE;
+        }
+        if(waited == OS_TRUE && timeout != OS_NO_TIMEOUT) {
+            portEXIT_CRITICAL(&(rw->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        /* Flag that we are waiting, so unlocks take the slow path. Once set,
+        an unlock can't finish without our mux */
+        if((state & OS_RWLOCK_WAITERS) == 0) {
+            new_state = state | OS_RWLOCK_WAITERS;
+            uxPortCompareSet(&(rw->state), state, &new_state);
+            if(new_state != state) {
+                continue;
+            }
+        }
+
+        ret_val = _OS_rwlock_block(rw, &(rw->read_waiters), timeout);
+        if(ret_val != OS_NO_ERROR) {
+            portEXIT_CRITICAL(&(rw->mux));
+            return ret_val;
+        }
+        if(cur_tcb->block_record.granted == OS_TRUE) {
+            /* A writer's unlock counted us in along with the other readers */
+            break;
+        }
+        waited = OS_TRUE;
+    }
+    portEXIT_CRITICAL(&(rw->mux));
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Reader-Writer Lock Read Unlock (API FUNCTION)
+*
+*   rwlock = The lock to release from reading
+*
+* PURPOSE :
+*
+*   Release a read lock. The last reader out hands the lock to the highest
+*   priority waiting writer
+*
+* RETURN :
+*
+*   Return OS_ERROR_RWLOCK_NOT_OWNER if the lock had no readers, another
+*   error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES:
+*******************************************************************************/
+
+int OS_rwlock_read_unlock(RWLock_t rwlock)
+{
+    ReadWriteLock_t *rw = (ReadWriteLock_t *)rwlock;
+    TCB_t *woken[OS_RWLOCK_GRANT_BATCH];
+    int num_woken = 0;
+    uint32_t state, new_state;
+
+    if(rw == NULL) {
+        return OS_ERROR_INVALID_RWLOCK;
+    }
+
+    /* Fast path. Nobody is waiting, so just count ourselves out */
+    state = rw->state;
+    while((state & OS_RWLOCK_WAITERS) == 0) {
+        if(OS_RWLOCK_READERS(state) == 0) {
+            return OS_ERROR_RWLOCK_NOT_OWNER;
+        }
+        new_state = state - OS_RWLOCK_READER_ONE;
+        uxPortCompareSet(&(rw->state), state, &new_state);
+        if(new_state == state) {
+            return OS_NO_ERROR;
+        }
+        state = new_state;
+    }
+
+    portENTER_CRITICAL(&(rw->mux));
+    if(OS_RWLOCK_READERS(rw->state) == 0) {
+        portEXIT_CRITICAL(&(rw->mux));
+        return OS_ERROR_RWLOCK_NOT_OWNER;
+    }
+    state = _OS_rwlock_update_state(rw, 0, 0, (uint32_t)-OS_RWLOCK_READER_ONE);
+    if(OS_RWLOCK_READERS(state) == 1) {
+        num_woken = _OS_rwlock_grant(rw, OS_FALSE, woken);
+    }
+    portEXIT_CRITICAL(&(rw->mux));
+    _OS_rwlock_wake(rw, OS_FALSE, woken, num_woken);
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Reader-Writer Lock Write Lock (API FUNCTION)
+*
+*   rwlock = The lock to take for writing
+*   timeout = The most ticks to wait. 0 never blocks, OS_NO_TIMEOUT waits forever
+*
+* PURPOSE :
+*
+*   Take a reader-writer lock exclusively. Blocks while any reader or another
+*   writer holds the lock
+*
+* RETURN :
+*
+*   Return OS_ERROR_RWLOCK_UNAVAILABLE if timeout was 0 and the lock couldn't
+*   be taken, OS_ERROR_TIMER_EXPIRED if the timeout passed, another error
+*   message, or 0 (OS_NO_ERROR) if the lock was taken
+*
+* NOTES:
+*
+*   The write lock isn't recursive and doesn't raise the priority of readers
+*******************************************************************************/
+
+int OS_rwlock_write_lock(RWLock_t rwlock, TickType_t timeout)
+{
+    ReadWriteLock_t *rw = (ReadWriteLock_t *)rwlock;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    OSBool_t waited = OS_FALSE;
+    uint32_t state, new_state;
+    int ret_val;
+
+    if(rw == NULL) {
+        return OS_ERROR_INVALID_RWLOCK;
+    }
+
+    /* Fast path. The lock is free and a single compare-and-set takes it */
+    new_state = OS_RWLOCK_WRITER;
+    uxPortCompareSet(&(rw->state), 0, &new_state);
+    if(new_state == 0) {
+        rw->writer = cur_tcb;
+        return OS_NO_ERROR;
+    }
+
+    portENTER_CRITICAL(&(rw->mux));
+    while(OS_TRUE) {
+        state = rw->state;
+        if((state & ~OS_RWLOCK_WAITERS) == 0) {
+            new_state = state | OS_RWLOCK_WRITER;
+            uxPortCompareSet(&(rw->state), state, &new_state);
+            if(new_state != state) {
+                continue;
+            }
+            rw->writer = cur_tcb;
+            break;
+        }
+        if(timeout == 0) {
+            portEXIT_CRITICAL(&(rw->mux));
+            return OS_ERROR_RWLOCK_UNAVAILABLE;
+        }
+        if(waited == OS_TRUE && timeout != OS_NO_TIMEOUT) {
+            portEXIT_CRITICAL(&(rw->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
+
+        if((state & OS_RWLOCK_WAITERS) == 0) {
+            new_state = state | OS_RWLOCK_WAITERS;
+            uxPortCompareSet(&(rw->state), state, &new_state);
+            if(new_state != state) {
+                continue;
+            }
+        }
+
+        ret_val = _OS_rwlock_block(rw, &(rw->write_waiters), timeout);
+        if(ret_val != OS_NO_ERROR) {
+            portEXIT_CRITICAL(&(rw->mux));
+            return ret_val;
+        }
+        if(cur_tcb->block_record.granted == OS_TRUE) {
+            /* The unlock handed the lock straight to us */
+            break;
+        }
+        waited = OS_TRUE;
+    }
+    portEXIT_CRITICAL(&(rw->mux));
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Reader-Writer Lock Write Unlock (API FUNCTION)
+*
+*   rwlock = The lock to release from writing
+*
+* PURPOSE :
+*
+*   Release a write lock. Every waiting reader is let in at once, or if there
+*   are none, the lock is handed to the highest priority waiting writer
+*
+* RETURN :
+*
+*   Return OS_ERROR_RWLOCK_NOT_OWNER if the calling task doesn't hold the
+*   write lock, another error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES:
+*******************************************************************************/
+
+int OS_rwlock_write_unlock(RWLock_t rwlock)
+{
+    ReadWriteLock_t *rw = (ReadWriteLock_t *)rwlock;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    TCB_t *woken[OS_RWLOCK_GRANT_BATCH];
+    int num_woken;
+    uint32_t new_state;
+
+    if(rw == NULL) {
+        return OS_ERROR_INVALID_RWLOCK;
+    }
+    if((rw->state & OS_RWLOCK_WRITER) == 0 || rw->writer != cur_tcb) {
+        return OS_ERROR_RWLOCK_NOT_OWNER;
+    }
+    rw->writer = NULL;
+
+    /* Fast path. Nobody is waiting, so a single compare-and-set frees it */
+    new_state = 0;
+    uxPortCompareSet(&(rw->state), OS_RWLOCK_WRITER, &new_state);
+    if(new_state == OS_RWLOCK_WRITER) {
+        return OS_NO_ERROR;
+    }
+
+    portENTER_CRITICAL(&(rw->mux));
+    (void) _OS_rwlock_update_state(rw, OS_RWLOCK_WRITER, 0, 0);
+    num_woken = _OS_rwlock_grant(rw, OS_TRUE, woken);
+    portEXIT_CRITICAL(&(rw->mux));
+    _OS_rwlock_wake(rw, OS_TRUE, woken, num_woken);
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* STATIC FUNCTION DEFINITIONS
+*******************************************************************************/
+
+/**
+ * Atomically clear and set flags of the state word and add to it. Returns
+ * the state word before the update
+ */
+static uint32_t _OS_rwlock_update_state(ReadWriteLock_t *rwlock, uint32_t clear,
+            uint32_t set, uint32_t add)
+{
+    uint32_t state, new_state;
+
+    while(OS_TRUE) {
+        state = rwlock->state;
+        new_state = ((state & ~clear) | set) + add;
+        uxPortCompareSet(&(rwlock->state), state, &new_state);
+        if(new_state == state) {
+            return state;
+        }
+    }
+}
+
+/**
+ * Block the current task on one of the lock's waitlists until an unlock or
+ * the timeout wakes it. Called and returns with the mux held, which is
+ * dropped while blocked. The task owns the lock afterwards if its block
+ * record was granted
+ */
+static int _OS_rwlock_block(ReadWriteLock_t *rwlock, WaitList_t *waitlist, TickType_t timeout)
+{
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    TCB_t *woken[OS_RWLOCK_GRANT_BATCH];
+    int num_woken = 0;
+    int ret_val;
+
+    /* Leave the ready list before dropping the mux so the unlock can't be lost */
+    _OS_waitlist_append(cur_tcb, waitlist, &(rwlock->mux));
+    ret_val = OS_schedule_block_current_task(timeout);
+    if(ret_val == OS_NO_ERROR) {
+        portEXIT_CRITICAL(&(rwlock->mux));
+
+        portYIELD_WITHIN_API();
+
+        portENTER_CRITICAL(&(rwlock->mux));
+    }
+
+    /* If the timeout woke us we are still on the waitlist. Leaving may let
+    in readers that were only queued behind us */
+    if(cur_tcb->block_record.waitlist != NULL) {
+        _OS_waitlist_remove(cur_tcb);
+        num_woken = _OS_rwlock_grant(rwlock, OS_FALSE, woken);
+    }
+    if(num_woken != 0) {
+        portEXIT_CRITICAL(&(rwlock->mux));
+        _OS_rwlock_wake(rwlock, OS_FALSE, woken, num_woken);
+        portENTER_CRITICAL(&(rwlock->mux));
+    }
+    return ret_val;
+}
+
+/**
+ * Hand the lock to waiting tasks if it is free for them, then update the
+ * waiters flag. After a write unlock (readers_first), every waiting reader
+ * is let in before the next writer. Otherwise a free lock goes to the 
+ * highest priority writer, and readers are only let in when no writer they
+ * must queue behind is waiting. Called with the mux held. The granted tasks
+ * are popped into woken, up to OS_RWLOCK_GRANT_BATCH of them, and the count
+ * is returned for _OS_rwlock_wake to resume once the mux is released
+ */
+static int _OS_rwlock_grant(ReadWriteLock_t *rwlock, OSBool_t readers_first, TCB_t **woken)
+{
+    uint32_t state = rwlock->state;
+    uint32_t flags = 0;
+    int num_woken = 0;
+    int i;
+
+    if((state & OS_RWLOCK_WRITER) == 0 && rwlock->read_waiters.num_tasks != 0 &&
+            (readers_first == OS_TRUE || rwlock->write_waiters.num_tasks == 0 ||
+            rwlock->writer_preference == OS_FALSE)) {
+        /* Batch hand-off. Count the batch in before any of it runs */
+        num_woken = rwlock->read_waiters.num_tasks;
+        if(num_woken > OS_RWLOCK_GRANT_BATCH) {
+            num_woken = OS_RWLOCK_GRANT_BATCH;
+        }
+        (void) _OS_rwlock_update_state(rwlock, 0, 0, OS_RWLOCK_READER_ONE * (uint32_t)num_woken);
+        for(i = 0; i < num_woken; ++i) {
+            woken[i] = _OS_waitlist_pop_head(&(rwlock->read_waiters));
+            woken[i]->block_record.granted = OS_TRUE;
+        }
+    }
+    else if((state & ~OS_RWLOCK_WAITERS) == 0 && rwlock->write_waiters.num_tasks != 0) {
+        woken[0] = _OS_waitlist_pop_head(&(rwlock->write_waiters));
+        rwlock->writer = woken[0];
+        (void) _OS_rwlock_update_state(rwlock, 0, OS_RWLOCK_WRITER, 0);
+        woken[0]->block_record.granted = OS_TRUE;
+        num_woken = 1;
+    }
+
+    if(rwlock->read_waiters.num_tasks != 0 || rwlock->write_waiters.num_tasks != 0) {
+        flags = OS_RWLOCK_WAITERS;
+    }
+    (void) _OS_rwlock_update_state(rwlock, OS_RWLOCK_WAITERS, flags, 0);
+    return num_woken;
+}
+
+/**
+ * Resume the tasks _OS_rwlock_grant popped. Called without the mux held. A
+ * full batch may have left readers behind, so the grant is repeated until
+ * it comes up short
+ */
+static void _OS_rwlock_wake(ReadWriteLock_t *rwlock, OSBool_t readers_first, TCB_t **woken, int num_woken)
+{
+    int i;
+
+    while(OS_TRUE) {
+        for(i = 0; i < num_woken; ++i) {
+            OS_schedule_resume_task(woken[i]);
+        }
+        if(num_woken < OS_RWLOCK_GRANT_BATCH) {
+            return;
+        }
+        portENTER_CRITICAL(&(rwlock->mux));
+        num_woken = _OS_rwlock_grant(rwlock, readers_first, woken);
+        portEXIT_CRITICAL(&(rwlock->mux));
+    }
+}
@@ -62,45 +62,90 @@ PRIVILEGED_DATA static volatile unsigned int OS_num_tasks_delayed = 0;
 /* A counter for the time to unblock the next task that is blocked */
 PRIVILEGED_DATA static volatile TickType_t OS_next_task_unblock_time = OS_NO_TIMEOUT;
 
-/* One mutex for use in scheduler actions */
-PRIVILEGED_DATA static portMUX_TYPE OS_schedule_mutex = portMUX_INITIALIZER_UNLOCKED;
+/**
+ * Scheduler locks.
+ *
+ * Scheduler state is split across several spinlocks so that the two cores only
+ * contend with each other when they touch the same list:
+ *
+ *  - OS_delayed_lock guards the delayed list, OS_num_tasks_delayed,
+ *    OS_next_task_unblock_time, the tick counters and resource waitlist
+ *    membership (since timeouts remove tasks from waitlists).
+ *  - OS_suspended_lock guards the suspended list.
+ *  - OS_deletion_lock guards the deletion pending list and the task counters.
+ *  - OS_ready_lock[N] guards ready queue N. For a core's own queue it also 
+ *    guards that core's pending ready list and current TCB.
+ *
+ * A task's task_state is only ever changed while holding the lock of the ready
+ * queue it belongs to, so holding that lock is enough to read a stable state.
+ * Moving a task out of the delayed or suspended lists additionally needs the
+ * lock of that list.
+ *
+ * Locks must always be taken in the order below, skipping any not needed:
+ *
+ *   1. OS_delayed_lock
+ *   2. OS_suspended_lock
+ *   3. OS_deletion_lock
+ *   4. OS_ready_lock[core] for at most one core
+ *   5. OS_ready_lock[OS_READY_QUEUE_SHARED]
+ *
+ * A TCB's task_state_mux, when needed, is taken before any of them.
+ */
+PRIVILEGED_DATA static SchedLock_t OS_delayed_lock = OS_SCHEDULE_LOCK_INITIALIZER;
+PRIVILEGED_DATA static SchedLock_t OS_suspended_lock = OS_SCHEDULE_LOCK_INITIALIZER;
+PRIVILEGED_DATA static SchedLock_t OS_deletion_lock = OS_SCHEDULE_LOCK_INITIALIZER;
+PRIVILEGED_DATA static SchedLock_t OS_ready_lock[OS_NUM_READY_QUEUES] = {
+    [0 ... OS_NUM_READY_QUEUES - 1] = OS_SCHEDULE_LOCK_INITIALIZER
+};
 
 /*******************************************************************************
 * SCHEDULER CRITICAL DATA STRUCTURES
 *******************************************************************************/
 
 /**
- * Bitmap of priorities in use.
- * Broken up into an array of 8 bit integers where each bit represents if a priority is in use
- * The map is designed backwards. 
- * The first bit corresponds to the highest priority (highest number)
- * The last bit is priority 0 (reserved for Idle)
+ * The ready queues of all tasks ready to be run.
+ * Index N < portNUM_PROCESSORS holds the tasks pinned to core N. Index
+ * OS_READY_QUEUE_SHARED holds the tasks with no core affinity.
+ * A core only ever looks at its own queue and the shared queue when
+ * picking the next task to run.
+ *
+ * Within a queue, each list index corresponds to a priority. Index 0 is 
+ * priority 0 (reserved for Idle).
+ * Bit N of word W of the queue's priority map is set if priority 
+ * (W * OS_PRIO_MAP_WORD_BITS + N) has a ready task. Bit W of the summary 
+ * word is set if word W of the map is non-zero. The highest priority is 
+ * found with two count-leading-zeros operations
  */
-static volatile uint8_t OS_ready_priorities_map[OS_PRIO_MAP_SIZE] = {(uint8_t)0};
+static volatile ReadyQueue_t OS_ready_queue[OS_NUM_READY_QUEUES];
 
 /**
- * The Ready list of all tasks ready to be run
- * Each index corresponds to a priority. Index 0 is priority 0 (reserved for Idle)
+ * The list of tasks that were scheduled while the scheduler was suspended
  */
-static volatile ReadyList_t OS_ready_list[OS_MAX_PRIORITIES] = {{0, NULL, NULL}};
+static volatile ReadyList_t OS_pending_ready_list[portNUM_PROCESSORS] = {{0, NULL, NULL}};
 
 /**
- * The list of tasks that were scheduled while the scheduler was suspended
+ * The lists of tasks pending deletion (memory not yet freed), one per core.
+ * A task goes on the list of the core it was running on (or pinned to), and 
+ * that core's IDLE frees it, since by the time IDLE runs there the task can 
+ * no longer be running anywhere
  */
-static volatile ReadyList_t OS_pending_ready_list[portNUM_PROCESSORS] = {{0, NULL, NULL}};
+static volatile DeletionList_t OS_deletion_pending_list[portNUM_PROCESSORS] = {{0, NULL, NULL}};
 
 /**
- * A list of tasks pending deletion (memory not yet freed).
- * Deletion should be carried out by IDLE for these tasks
+ * The timing wheel of delayed tasks.
+ * A task lands in the lowest level whose span covers its remaining delay, in
+ * the slot picked by that level's digit of its wakeup time. Slots are unordered.
+ * When a level's digit wraps, the next level's current slot is cascaded down.
+ * Each level keeps a bitmap of which of its slots hold tasks.
  */
-static DeletionList_t OS_deletion_pending_list = {0, NULL, NULL};
+static volatile DelayedList_t OS_delay_wheel[OS_DELAY_WHEEL_LEVELS][OS_DELAY_WHEEL_SLOTS];
+static volatile uint32_t OS_delay_wheel_occupied[OS_DELAY_WHEEL_LEVELS];
 
 /**
- * The lists of delayed tasks
- * Index 0 is the regular list, index 1 is a list for overflowed delays.
- * Both indece's lists are sorted by ascending wake-up time
+ * Delayed tasks too far out for the wheel. Unordered, and only looked at
+ * once every OS_DELAY_WHEEL_RANGE ticks
  */
-static volatile DelayedList_t OS_delayed_list = {0, NULL, NULL};
+static volatile DelayedList_t OS_delay_far_list = {0, NULL, NULL};
 
 /**
  * A list of tasks that have been suspended.
@@ -114,11 +159,13 @@ static SuspendedList_t OS_suspended_list = {0, NULL, NULL};
 
 static void _OS_bitmap_reset_prios(void);
 
-static int _OS_schedule_get_highest_prio(void);
+static int _OS_schedule_get_highest_prio(volatile ReadyQueue_t *queue);
 
-static void _OS_bitmap_add_prio(TaskPrio_t new_prio);
+static int _OS_schedule_get_highest_prio_below(volatile ReadyQueue_t *queue, int prio);
 
-static void _OS_bitmap_remove_prio(TaskPrio_t old_prio);
+static void _OS_bitmap_add_prio(volatile ReadyQueue_t *queue, TaskPrio_t new_prio);
+
+static void _OS_bitmap_remove_prio(volatile ReadyQueue_t *queue, TaskPrio_t old_prio);
 
 static void _OS_ready_list_init(void);
 
@@ -126,9 +173,7 @@ static void _OS_ready_list_insert(TCB_t *new_tcb);
 
 static void _OS_ready_list_remove(TCB_t *old_tcb);
 
-static void _OS_deletion_pending_list_insert(TCB_t *tcb);
-
-static void _OS_deletion_pending_list_empty();
+static void _OS_deletion_pending_list_insert(TCB_t *tcb, int core_ID);
 
 static void _OS_delayed_list_insert(TCB_t *tcb);
 
@@ -138,16 +183,34 @@ static void _OS_suspended_list_insert(TCB_t *tcb);
 
 static void _OS_suspended_list_remove(TCB_t *tcb);
 
-static OSBool_t _OS_delayed_list_wakeup_next_task(void);
+static OSBool_t _OS_delayed_list_wakeup_task(TCB_t *woken_task);
 
-static void _OS_delayed_tasks_cycle_overflow(void);
+static void _OS_delay_wheel_place(TCB_t *tcb, TickType_t when);
+
+static void _OS_delay_wheel_unlink(TCB_t *tcb);
+
+static void _OS_delay_wheel_mark_empty(volatile DelayedList_t *slot);
+
+static void _OS_delay_wheel_cascade(volatile DelayedList_t *slot, TickType_t ticks);
+
+static void _OS_delay_wheel_advance(TickType_t ticks);
+
+static OSBool_t _OS_delay_wheel_expire(void);
+
+static OSBool_t _OS_schedule_round_robin_due(void);
 
 static void _OS_pending_ready_list_schedule_next_task(void);
 
 static void _OS_pending_ready_list_insert(TCB_t *tcb, int core_ID);
 
+static int _OS_schedule_make_ready(TCB_t *unblocked_tcb);
+
 static void _OS_update_next_task_unblock_time(void);
 
+#if OS_SCHEDULE_LOCK_STATS
+static void _OS_schedule_read_lock_stats(SchedLock_t *lock, SchedLockStats_t *stats);
+#endif
+
 static void _OS_schedule_yield_other_core(int core_ID, TaskPrio_t prio );
 
 /**
@@ -176,18 +239,151 @@ static inline void _OS_set_current_tcb_for_core(int core_ID, TCB_t *tcb){
     OS_current_TCB[core_ID] = tcb;
 }
 
+/**
+ * The ready queue a task belongs to is fixed by its affinity at creation
+ */
+static inline volatile ReadyQueue_t * _OS_ready_queue_of(TCB_t *tcb){
+    if(tcb->core_ID == CORE_NO_AFFINITY){
+        return &OS_ready_queue[OS_READY_QUEUE_SHARED];
+    }
+    return &OS_ready_queue[tcb->core_ID];
+}
+
+static inline SchedLock_t * _OS_ready_lock_of(TCB_t *tcb){
+    if(tcb->core_ID == CORE_NO_AFFINITY){
+        return &OS_ready_lock[OS_READY_QUEUE_SHARED];
+    }
+    return &OS_ready_lock[tcb->core_ID];
+}
+
+/**
+ * Take a scheduler lock. Disables interrupts on this core like portENTER_CRITICAL
+ */
+static inline void _OS_schedule_lock(SchedLock_t *lock){
+#if OS_SCHEDULE_LOCK_STATS
+    /* Only a hint, but good enough to compare contention between lock layouts */
+    OSBool_t contended = (lock->mux.spinlock.owner != portMUX_FREE_VAL);
+#endif
+    portENTER_CRITICAL(&(lock->mux));
+#if OS_SCHEDULE_LOCK_STATS
+    lock->acquisitions++;
+    if(contended == OS_TRUE){
+        lock->contentions++;
+    }
+#endif
+}
+
+static inline void _OS_schedule_unlock(SchedLock_t *lock){
+    portEXIT_CRITICAL(&(lock->mux));
+}
+
+/**
+ * Same as _OS_schedule_lock but safe to call from an ISR
+ */
+static inline void _OS_schedule_lock_from_ISR(SchedLock_t *lock){
+#if OS_SCHEDULE_LOCK_STATS
+    OSBool_t contended = (lock->mux.spinlock.owner != portMUX_FREE_VAL);
+#endif
+    portENTER_CRITICAL_ISR(&(lock->mux));
+#if OS_SCHEDULE_LOCK_STATS
+    lock->acquisitions++;
+    if(contended == OS_TRUE){
+        lock->contentions++;
+    }
+#endif
+}
+
+static inline void _OS_schedule_unlock_from_ISR(SchedLock_t *lock){
+    portEXIT_CRITICAL_ISR(&(lock->mux));
+}
+
+/**
+ * Spin on a scheduler lock without touching interrupts.
+ * Only for callers that already disabled interrupts themselves
+ */
+static inline void _OS_schedule_acquire(SchedLock_t *lock){
+#if OS_SCHEDULE_LOCK_STATS
+    OSBool_t contended = (lock->mux.spinlock.owner != portMUX_FREE_VAL);
+#endif
+    vPortCPUAcquireMutex(&(lock->mux));
+#if OS_SCHEDULE_LOCK_STATS
+    lock->acquisitions++;
+    if(contended == OS_TRUE){
+        lock->contentions++;
+    }
+#endif
+}
+
+static inline void _OS_schedule_release(SchedLock_t *lock){
+    vPortCPUReleaseMutex(&(lock->mux));
+}
+
+/**
+ * Take every lock needed to move a task between the delayed, suspended and 
+ * ready lists, in lock order
+ */
+static inline void _OS_schedule_lock_task(TCB_t *tcb){
+    _OS_schedule_lock(&OS_delayed_lock);
+    _OS_schedule_lock(&OS_suspended_lock);
+    _OS_schedule_lock(_OS_ready_lock_of(tcb));
+}
+
+static inline void _OS_schedule_unlock_task(TCB_t *tcb){
+    _OS_schedule_unlock(_OS_ready_lock_of(tcb));
+    _OS_schedule_unlock(&OS_suspended_lock);
+    _OS_schedule_unlock(&OS_delayed_lock);
+}
+
+/**
+ * Same as _OS_schedule_lock_task but also takes the deletion lock
+ */
+static inline void _OS_schedule_lock_task_deletion(TCB_t *tcb){
+    _OS_schedule_lock(&OS_delayed_lock);
+    _OS_schedule_lock(&OS_suspended_lock);
+    _OS_schedule_lock(&OS_deletion_lock);
+    _OS_schedule_lock(_OS_ready_lock_of(tcb));
+}
+
+static inline void _OS_schedule_unlock_task_deletion(TCB_t *tcb){
+    _OS_schedule_unlock(_OS_ready_lock_of(tcb));
+    _OS_schedule_unlock(&OS_deletion_lock);
+    _OS_schedule_unlock(&OS_suspended_lock);
+    _OS_schedule_unlock(&OS_delayed_lock);
+}
+
 /*******************************************************************************
 * IDLE TASK
 *******************************************************************************/
 
 void OS_IDLE_TASK(void * idle_task_param)
 {
+#if( configUSE_TICKLESS_IDLE != 0 )
+    TickType_t expected_idle_time;
+#endif
+
     for(;;) {
-        if(OS_deletion_pending_list.num_tasks != 0) {
-            /* _OS_deletion_pending_list_empty(); */
+        /* Free a bounded number of deleted tasks per pass so that idle work 
+        like sleeping is never held off for long */
+        if(OS_deletion_pending_list[xPortGetCoreID()].num_tasks != 0) {
+            OS_task_reclaim_deleted(OS_TASK_RECLAIM_BATCH);
         }
         extern void vApplicationIdleHook(void);
         vApplicationIdleHook();
+
+#if( configUSE_TICKLESS_IDLE != 0 )
+        /* Stop the tick while there is nothing to do until the next wakeup. 
+        The first check is cheap and avoids suspending the scheduler on every 
+        pass. The second makes sure nothing changed while we were suspending */
+        expected_idle_time = OS_schedule_get_expected_idle_time();
+        if(expected_idle_time >= OS_IDLE_TIME_BEFORE_SLEEP) {
+            OS_schedule_suspend();
+            expected_idle_time = OS_schedule_get_expected_idle_time();
+            if(expected_idle_time >= OS_IDLE_TIME_BEFORE_SLEEP) {
+                portSUPPRESS_TICKS_AND_SLEEP(expected_idle_time);
+            }
+            OS_schedule_resume();
+        }
+#endif
     }
 }
 
@@ -218,7 +414,7 @@ void OS_schedule_init(void)
         cpu.switching_context = OS_FALSE;
         cpu.yield_pending = OS_FALSE;
     }
-    _OS_bitmap_reset_prios();
+    _OS_ready_list_init();
 }
 
 /*******************************************************************************
@@ -342,39 +538,49 @@ void OS_schedule_suspend(void)
 OSBool_t OS_schedule_resume(void)
 {
     OSBool_t yield_occured = OS_FALSE;
-    assert(OS_schedule_CPU[xPortGetCoreID()].scheduler_suspended >= OS_TRUE);
+    TickType_t pending_ticks;
+    unsigned state;
+    int core_ID;
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    state = portENTER_CRITICAL_NESTED();
+    core_ID = xPortGetCoreID();
+    assert(OS_schedule_CPU[core_ID].scheduler_suspended >= OS_TRUE);
 
-    OS_schedule_CPU[xPortGetCoreID()].scheduler_suspended--;
+    OS_schedule_CPU[core_ID].scheduler_suspended--;
     
     /* Nothing to do if we are still in nested suspension or have no tasks */
-    if(OS_schedule_CPU[xPortGetCoreID()].scheduler_suspended != OS_FALSE ||
+    if(OS_schedule_CPU[core_ID].scheduler_suspended != OS_FALSE ||
        OS_num_tasks == 0) {
-        portEXIT_CRITICAL(&OS_schedule_mutex); 
+        portEXIT_CRITICAL_NESTED(state); 
         return yield_occured;
     }
 
     /* Ready all of the tasks from the pending ready list */
-    while(OS_pending_ready_list[xPortGetCoreID()].num_tasks > 0) {
+    _OS_schedule_lock(&OS_ready_lock[core_ID]);
+    _OS_schedule_lock(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
+    while(OS_pending_ready_list[core_ID].num_tasks > 0) {
         _OS_pending_ready_list_schedule_next_task();
     }
+    _OS_schedule_unlock(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
+    _OS_schedule_unlock(&OS_ready_lock[core_ID]);
 
-    /* Get up to date with all the ticks that have passed */
-	while( OS_pending_ticks > 0) {
-		if( OS_schedule_process_tick() == OS_TRUE) {
-            OS_schedule_CPU[xPortGetCoreID()].yield_pending = OS_TRUE;
-		}
-		--OS_pending_ticks;
-	}
+    /* Get up to date with all the ticks that have passed, in a single pass */
+    _OS_schedule_lock(&OS_delayed_lock);
+    pending_ticks = OS_pending_ticks;
+    OS_pending_ticks = 0;
+    _OS_schedule_unlock(&OS_delayed_lock);
+
+    if(pending_ticks > 0 && OS_schedule_process_ticks(pending_ticks) == OS_TRUE) {
+        OS_schedule_CPU[core_ID].yield_pending = OS_TRUE;
+    }
 
     /* Yield if we missed a necessary yield while suspended */
-    if( OS_schedule_CPU[xPortGetCoreID()].yield_pending == OS_TRUE ) {
+    if( OS_schedule_CPU[core_ID].yield_pending == OS_TRUE ) {
 		yield_occured = OS_TRUE;
         portYIELD_WITHIN_API();
 	}
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    portEXIT_CRITICAL_NESTED(state);
     return yield_occured;
 }
 
@@ -399,10 +605,13 @@ void OS_schedule_switch_context(void)
 {
     int state;
     int core_ID;
-    TaskPrio_t ready_list_index;
+    int local_prio;
+    int shared_prio;
+    volatile ReadyQueue_t *local_queue;
+    volatile ReadyQueue_t *shared_queue;
     TCB_t *tcb_to_run = NULL;
+    TCB_t *shared_tcb = NULL;
     TCB_t *tcb_swapped_out = NULL;
-    TCB_t *temp = NULL;
 
     state = portENTER_CRITICAL_NESTED();
 
@@ -420,7 +629,13 @@ void OS_schedule_switch_context(void)
 
     /* TODO: check for stack overflow one day */
 
-    vPortCPUAcquireMutex(&OS_schedule_mutex);
+    /* Interrupts are already disabled. Only this core's queue and the shared
+    queue are touched, so only their locks are needed */
+    _OS_schedule_acquire(&OS_ready_lock[core_ID]);
+    _OS_schedule_acquire(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
+
+    local_queue = &OS_ready_queue[core_ID];
+    shared_queue = &OS_ready_queue[OS_READY_QUEUE_SHARED];
 
     tcb_swapped_out = _OS_get_current_tcb_from_core(core_ID);
     if(tcb_swapped_out->task_state == OS_TASK_STATE_RUNNING){
@@ -435,28 +650,34 @@ void OS_schedule_switch_context(void)
         _OS_ready_list_insert(tcb_swapped_out);
     }
 
-    ready_list_index = _OS_schedule_get_highest_prio();
-    temp = OS_ready_list[ready_list_index].head_ptr;
-
-    /* Find the next highest priority task we can run on this core */
-    while(ready_list_index > 0 && tcb_to_run == NULL) {
+    /* Pinned tasks can only be running on this core, and the task that was
+    running here is no longer marked running. So the head of the highest 
+    local priority list is always a valid choice */
+    local_prio = _OS_schedule_get_highest_prio(local_queue);
 
-        /* No valid task to run at this priority */
-        if(temp == NULL) {
-            --ready_list_index;
-            temp = OS_ready_list[ready_list_index].head_ptr;
+    /* Shared tasks may be running on another core. Skip those, but never look
+    below the best local priority since the local task would win anyways */
+    shared_prio = _OS_schedule_get_highest_prio(shared_queue);
+    while(shared_prio > 0 && shared_prio >= local_prio && shared_tcb == NULL) {
+        shared_tcb = shared_queue->lists[shared_prio].head_ptr;
+        while(shared_tcb != NULL && shared_tcb->task_state == OS_TASK_STATE_RUNNING) {
+            shared_tcb = shared_tcb->next_ptr;
         }
-        /* We found a valid task to run */
-        else if(temp->task_state != OS_TASK_STATE_RUNNING &&
-                (temp->core_ID == core_ID || temp->core_ID == CORE_NO_AFFINITY)){
-            tcb_to_run = temp;
-        }
-        /* Try the next round robin task at this priority */
-        else {
-            temp = temp->next_ptr;
+        if(shared_tcb == NULL) {
+            shared_prio = _OS_schedule_get_highest_prio_below(shared_queue, shared_prio);
         }
     }
 
+    /* Equal priorities alternate between the local and shared queues so that
+    round robin scheduling still applies across both of them */
+    if(shared_tcb != NULL && (shared_prio > local_prio || 
+            _OS_ready_queue_of(tcb_swapped_out) == local_queue)) {
+        tcb_to_run = shared_tcb;
+    }
+    else if(local_prio > 0) {
+        tcb_to_run = local_queue->lists[local_prio].head_ptr;
+    }
+
     /* See if we need to run IDLE */
     if(tcb_to_run == NULL){
         tcb_to_run = OS_schedule_CPU[core_ID].idle_tcb;
@@ -466,7 +687,8 @@ void OS_schedule_switch_context(void)
     _OS_set_current_tcb_for_core(core_ID, tcb_to_run);
 
     OS_schedule_CPU[core_ID].switching_context = OS_FALSE;
-    vPortCPUReleaseMutex(&OS_schedule_mutex);
+    _OS_schedule_release(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
+    _OS_schedule_release(&OS_ready_lock[core_ID]);
     portEXIT_CRITICAL_NESTED(state);
     return;
 }
@@ -501,10 +723,7 @@ int OS_schedule_add_task(TCB_t *new_tcb)
         return OS_ERROR_INVALID_PRIO;
     }
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
-
     core_ID = new_tcb->core_ID;
-    new_tcb->task_state = OS_TASK_STATE_READY;
     
     /* If there is no affinity with which core it is placed on */
     if(core_ID == CORE_NO_AFFINITY) {
@@ -525,6 +744,20 @@ int OS_schedule_add_task(TCB_t *new_tcb)
         }
     }
 
+    /* Increase the task count */
+    _OS_schedule_lock(&OS_deletion_lock);
+    ++OS_num_tasks;
+    _OS_schedule_unlock(&OS_deletion_lock);
+
+    /* The chosen core's lock guards its current TCB. Shared tasks also need
+    the shared queue lock */
+    _OS_schedule_lock(&OS_ready_lock[core_ID]);
+    if(new_tcb->core_ID == CORE_NO_AFFINITY) {
+        _OS_schedule_lock(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
+    }
+
+    new_tcb->task_state = OS_TASK_STATE_READY;
+
     /* If nothing is running on this core then put our task there */
     if(_OS_get_current_tcb_from_core(core_ID) == NULL ) {
         _OS_set_current_tcb_for_core(core_ID, new_tcb);
@@ -541,18 +774,12 @@ int OS_schedule_add_task(TCB_t *new_tcb)
         }
     }
     
-    /* Increase the task count and update the ready list */
-    ++OS_num_tasks;
+    /* Update the ready list */
     _OS_ready_list_insert(new_tcb);
 
-    /* Nothing else to do it the schedule is not running */
-    if(OS_scheduler_running == OS_FALSE) {
-        portEXIT_CRITICAL(&OS_schedule_mutex);
-        return OS_NO_ERROR;
-    }
-
-	/* Scheduler is running. Check to see if we should run the task now */
-	if(_OS_get_current_tcb_from_core(core_ID)->priority < new_tcb->priority) {
+    /* Scheduler is running. Check to see if we should run the task now */
+    if(OS_scheduler_running == OS_TRUE &&
+            _OS_get_current_tcb_from_core(core_ID)->priority < new_tcb->priority) {
 		if( core_ID == xPortGetCoreID() )
 		{
 			portYIELD_WITHIN_API();
@@ -563,7 +790,10 @@ int OS_schedule_add_task(TCB_t *new_tcb)
 		}
 	}
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    if(new_tcb->core_ID == CORE_NO_AFFINITY) {
+        _OS_schedule_unlock(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
+    }
+    _OS_schedule_unlock(&OS_ready_lock[core_ID]);
     return OS_NO_ERROR;
 }
 
@@ -571,6 +801,8 @@ int OS_schedule_add_task(TCB_t *new_tcb)
 * OS Schedule Remove Task
 *
 *   old_tcb = A pointer to the tcb to be removed from scheduling
+*   reclaim = Set to OS_TRUE if the caller must free the task, or OS_FALSE if
+*             an idle task will
 * 
 * PURPOSE : 
 *
@@ -583,24 +815,35 @@ int OS_schedule_add_task(TCB_t *new_tcb)
 *
 * NOTES: 
 *
-*   User code should use OS_task_delete instead of this function directly
+*   User code should use OS_task_delete instead of this function directly.
+*   Once the task is handed to an idle task, that idle task may free it at 
+*   any time, so the caller must not touch the tcb again unless told to 
+*   reclaim it
 *******************************************************************************/
 
-int OS_schedule_remove_task(TCB_t *old_tcb)
+int OS_schedule_remove_task(TCB_t *old_tcb, OSBool_t *reclaim)
 {
     OSBool_t ready_to_delete = OS_TRUE;
+    int deleting_core = CORE_NO_AFFINITY;
     int i;
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
-    
     assert(old_tcb != NULL);
+    *reclaim = OS_FALSE;
+
+    _OS_schedule_lock_task_deletion(old_tcb);
 
     /* Cannot remove the idle task */
 	if(old_tcb->priority == OS_IDLE_PRIORITY){
-        portEXIT_CRITICAL(&OS_schedule_mutex);
+        _OS_schedule_unlock_task_deletion(old_tcb);
         return OS_ERROR_IDLE_DELETE;
 	}
 
+    /* Only the holder of the object's mux may take the task off its waitlist */
+    if(old_tcb->block_record.waitlist_mux != NULL) {
+        _OS_schedule_unlock_task_deletion(old_tcb);
+        return OS_ERROR_BLOCKED_TASK;
+    }
+
     /* Remove from any state lists */
     switch(old_tcb->task_state) {
         case OS_TASK_STATE_RUNNING:
@@ -616,35 +859,44 @@ int OS_schedule_remove_task(TCB_t *old_tcb)
             _OS_suspended_list_remove(old_tcb);
             break;
         case OS_TASK_STATE_PENDING_DELETION:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task_deletion(old_tcb);
             return OS_ERROR_DOUBLE_DELETE;
         case OS_TASK_STATE_READY_TO_DELETE:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task_deletion(old_tcb);
             return OS_ERROR_DOUBLE_DELETE;
         default:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task_deletion(old_tcb);
             return OS_ERROR_INVALID_TSK_STATE;
     }
         
     /* Update task counters */
     OS_num_tasks--;
-    OS_num_tasks_deleted++;
 
-    /* Idle must delete this task if it is not on this core */
-    if(old_tcb->core_ID != xPortGetCoreID()){
+    /* Idle must delete this task if it is pinned to another core */
+    if(old_tcb->core_ID != CORE_NO_AFFINITY && old_tcb->core_ID != xPortGetCoreID()){
         ready_to_delete = OS_FALSE;
+        deleting_core = old_tcb->core_ID;
     }
-    /* Idle must delete this task if it is running on any core */
+    /* Idle must delete this task if it is running on any core. Only the
+    idle task of the core it is running on knows when it has switched out */
     if(old_tcb->task_state == OS_TASK_STATE_RUNNING){
         ready_to_delete = OS_FALSE;
+        for(i = 0; i < portNUM_PROCESSORS; ++i){
+            if(_OS_get_current_tcb_from_core(i) == old_tcb){
+                deleting_core = i;
+            }
+        }
     }
 
     if(ready_to_delete == OS_TRUE){
         old_tcb->task_state = OS_TASK_STATE_READY_TO_DELETE;
+        *reclaim = OS_TRUE;
     }
     else {
+        assert(deleting_core != CORE_NO_AFFINITY);
         old_tcb->task_state = OS_TASK_STATE_PENDING_DELETION;
-        _OS_deletion_pending_list_insert(old_tcb);
+        _OS_deletion_pending_list_insert(old_tcb, deleting_core);
+        OS_num_tasks_deleted++;
     }
 
     /* Necessary since we use FreeRTOS events lists (for now) */
@@ -652,16 +904,11 @@ int OS_schedule_remove_task(TCB_t *old_tcb)
 		( void ) uxListRemove( &( old_tcb->xEventListItem ) );
     }
 
-    /* Remove the task from any resource waitlists it is on */
+    /* Remove the task from any join waitlist it is on */
     if(old_tcb->block_record.waitlist != NULL) {
         _OS_waitlist_remove(old_tcb);
     }
 
-    /* schedule all tasks waiting on this task's deletion */
-    if(old_tcb->join_waitlist != NULL){
-        OS_schedule_waitlist_empty(old_tcb->join_waitlist);
-    }
-
     /* Force a reschedule if the conditions require it */
     if(OS_scheduler_running == OS_TRUE){
         /* If the task is running on this core */
@@ -677,7 +924,19 @@ int OS_schedule_remove_task(TCB_t *old_tcb)
             }
         }
     }
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+
+    /* Joiners may live on any ready queue, so only one ready lock can be held
+    while they are scheduled. The task itself is already off every list */
+    _OS_schedule_unlock(_OS_ready_lock_of(old_tcb));
+
+    /* schedule all tasks waiting on this task's deletion */
+    if(old_tcb->join_waitlist != NULL){
+        OS_schedule_waitlist_empty(old_tcb->join_waitlist);
+    }
+
+    _OS_schedule_unlock(&OS_deletion_lock);
+    _OS_schedule_unlock(&OS_suspended_lock);
+    _OS_schedule_unlock(&OS_delayed_lock);
     return OS_NO_ERROR;
 }
 
@@ -714,12 +973,12 @@ int OS_schedule_delay_task(TCB_t *tcb, TickType_t tick_delay)
         return OS_ERROR_INVALID_DLY;
     }
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
-    
     if(tcb == NULL){
         tcb = _OS_get_current_TCB();
     }
 
+    _OS_schedule_lock_task(tcb);
+
     /* Remove ourselves from existing task list */
     switch(tcb->task_state) {
         case OS_TASK_STATE_RUNNING:
@@ -729,36 +988,21 @@ int OS_schedule_delay_task(TCB_t *tcb, TickType_t tick_delay)
             _OS_ready_list_remove(tcb);
             break;
         case OS_TASK_STATE_DELAYED:
+            /* A task blocked with a timeout just has the delay stacked on it. 
+            It stays on its waitlist, which only its owner may change */
             _OS_delayed_list_remove(tcb);
-
-            /* This task is blocked and is getting delayed/suspended for the first time */
-            if(tcb->is_blocked == OS_TRUE && tcb->block_record.timeout_remaining == 0) {
-                tcb->block_record.timeout_remaining = tcb->delay_wakeup_time - OS_tick_counter;
-                /* This value will get added to when we calculate the delay */
-                tcb->delay_wakeup_time = OS_tick_counter;
-                _OS_waitlist_remove(tcb);
-            }
-
-            /* This task has no existing delays but still is blocked with a timeout*/
-            else if(tcb->block_record.waitlist != NULL) {
-                /* This value will get added to when we calculate the delay */
-                tcb->delay_wakeup_time = OS_tick_counter;
-                tick_delay = tcb->block_record.timeout_remaining;
-                tcb->block_record.timeout_remaining = 0;
-            }
-
             break; 
         case OS_TASK_STATE_SUSPENDED:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_NO_ERROR;
         case OS_TASK_STATE_PENDING_DELETION:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_DELETED_TASK;
         case OS_TASK_STATE_READY_TO_DELETE:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_DELETED_TASK;
         default:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_INVALID_TSK_STATE;
     }
 
@@ -772,7 +1016,13 @@ int OS_schedule_delay_task(TCB_t *tcb, TickType_t tick_delay)
     if(tick_delay != OS_NO_TIMEOUT){
         /* If already delayed, increase the delay */
         if(tcb->task_state == OS_TASK_STATE_DELAYED){
-            tcb->delay_wakeup_time += tick_delay;
+            /* Clamp so the stacked delay cannot wrap around past the current tick */
+            if(tick_delay > OS_MAX_DELAY - OS_TICKS_UNTIL(tcb->delay_wakeup_time, OS_tick_counter)){
+                tcb->delay_wakeup_time = OS_tick_counter + OS_MAX_DELAY;
+            }
+            else {
+                tcb->delay_wakeup_time += tick_delay;
+            }
         }
         /* This is the first time this task has been delayed */
         else {
@@ -787,7 +1037,7 @@ int OS_schedule_delay_task(TCB_t *tcb, TickType_t tick_delay)
         _OS_suspended_list_insert(tcb); 
     }
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(tcb);
     
     /* Yield if we suspended the TCB on this core */
     if(tcb == _OS_get_current_TCB()) {
@@ -865,16 +1115,16 @@ int OS_schedule_resume_task(TCB_t *tcb)
         return OS_ERROR_SCHEDULER_STOPPED;
     }
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_lock_task(tcb);
 
     /* We need to remove the task list off of either the delayed or suspended list */
     switch(tcb->task_state) {
         case OS_TASK_STATE_RUNNING:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_RUNNING_TASK;
             break;
         case OS_TASK_STATE_READY:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_READY_TASK;
             break;
         case OS_TASK_STATE_DELAYED:
@@ -884,10 +1134,10 @@ int OS_schedule_resume_task(TCB_t *tcb)
             _OS_suspended_list_remove(tcb);
             break;
         case OS_TASK_STATE_PENDING_DELETION:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_DELETED_TASK;
         case OS_TASK_STATE_READY_TO_DELETE:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_DELETED_TASK;
         default:
             assert(OS_FALSE);
@@ -897,7 +1147,7 @@ int OS_schedule_resume_task(TCB_t *tcb)
     tcb->task_state = OS_TASK_STATE_READY;
     _OS_ready_list_insert(tcb);
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(tcb);
     
     /* Run the resumed task if its priority is greater than any running task */
     if(tcb->priority > _OS_get_current_TCB()->priority) {
@@ -914,6 +1164,103 @@ int OS_schedule_resume_task(TCB_t *tcb)
     return OS_NO_ERROR;
 }
 
+/*******************************************************************************
+* OS Schedule Block Current Task
+*
+*   timeout = The most ticks to stay blocked. OS_NO_TIMEOUT to block forever
+* 
+* PURPOSE :
+*
+*   Take the running task off the ready list and delay or suspend it, without
+*   yielding. Lets a caller decide to block and actually leave the ready list 
+*   inside one critical section, so a wakeup arriving in between isn't lost
+*
+* RETURN : 
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*
+*   The caller must yield (portYIELD_WITHIN_API) once it has left its own
+*   critical sections
+*******************************************************************************/
+
+int OS_schedule_block_current_task(TickType_t timeout)
+{
+    TCB_t *tcb;
+
+    /* The suspend count nests, so any non-zero value means suspended */
+    if(OS_scheduler_running == OS_FALSE || 
+            OS_schedule_CPU[xPortGetCoreID()].scheduler_suspended != OS_FALSE) {
+        return OS_ERROR_SCHEDULER_STOPPED;
+    }
+
+    tcb = _OS_get_current_TCB();
+    _OS_schedule_lock_task(tcb);
+
+    /* The task was deleted while running and is only waiting to switch out */
+    if(tcb->task_state != OS_TASK_STATE_RUNNING) {
+        _OS_schedule_unlock_task(tcb);
+        return OS_ERROR_DELETED_TASK;
+    }
+
+    _OS_ready_list_remove(tcb);
+    if(timeout != OS_NO_TIMEOUT){
+        /* Clamp so the wakeup time cannot wrap around past the current tick */
+        if(timeout > OS_MAX_DELAY) {
+            timeout = OS_MAX_DELAY;
+        }
+        tcb->task_state = OS_TASK_STATE_DELAYED;
+        tcb->delay_wakeup_time = timeout + OS_tick_counter;
+        _OS_delayed_list_insert(tcb);
+    }
+    else {
+        tcb->task_state = OS_TASK_STATE_SUSPENDED;
+        _OS_suspended_list_insert(tcb);
+    }
+
+    _OS_schedule_unlock_task(tcb);
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* OS Schedule Unblock Task
+*
+*   tcb = A pointer to a task that may be delayed or suspended
+* 
+* PURPOSE :
+*
+*   Make a delayed or suspended task ready again. Does nothing if the task is
+*   already ready or running
+*
+* RETURN : 
+*
+*   True if a task of higher priority than the one running on this core was
+*   woken, and the caller should yield
+*
+* NOTES: 
+*
+*   Safe to call from an ISR. Never yields itself
+*******************************************************************************/
+
+OSBool_t OS_schedule_unblock_task(TCB_t *tcb)
+{
+    OSBool_t yield_required = OS_FALSE;
+
+    _OS_schedule_lock_from_ISR(&OS_delayed_lock);
+    _OS_schedule_lock_from_ISR(&OS_suspended_lock);
+
+    if(tcb->task_state == OS_TASK_STATE_DELAYED || tcb->task_state == OS_TASK_STATE_SUSPENDED) {
+        if(_OS_schedule_make_ready(tcb) == pdTRUE) {
+            yield_required = OS_TRUE;
+        }
+    }
+
+    _OS_schedule_unlock_from_ISR(&OS_suspended_lock);
+    _OS_schedule_unlock_from_ISR(&OS_delayed_lock);
+    return yield_required;
+}
+
 /*******************************************************************************
 * OS Schedule Process Tick
 * 
@@ -944,8 +1291,8 @@ OSBool_t OS_schedule_process_tick(void)
     if (xPortInIsrContext()) {
         vApplicationTickHook();
 
-        /* Only core 0 can increment the tick count */
-        if (xPortGetCoreID() != 0 ) {
+        /* Only the tick core can increment the tick count */
+        if (xPortGetCoreID() != OS_TICK_CORE_ID) {
 			return OS_TRUE;
 		}
     }
@@ -956,41 +1303,69 @@ OSBool_t OS_schedule_process_tick(void)
         return context_switch_required;
     }
 
-    portENTER_CRITICAL_ISR(&OS_schedule_mutex);
+    _OS_schedule_lock_from_ISR(&OS_delayed_lock);
 
-    OS_tick_counter++;
-    if(OS_tick_counter == (TickType_t)0){
-        assert(OS_FALSE); /* TODO */
-        ++OS_tick_overflow_counter;
+    /* Move to the next tick and wake up every task that is now due */
+    _OS_delay_wheel_advance(1);
+    if(_OS_delay_wheel_expire() == OS_TRUE) {
+        context_switch_required = OS_TRUE;
     }
 
-    /* Wakeup any tasks whose timers have expired */
-    while((OS_delayed_list.head_ptr != NULL) && 
-          (OS_delayed_list.head_ptr->delay_wakeup_time <= OS_tick_counter)) {
+    _OS_schedule_unlock_from_ISR(&OS_delayed_lock);
 
-        /* Remove the task from an event list if it is on one */
-		if( listLIST_ITEM_CONTAINER( &(OS_delayed_list.head_ptr->xEventListItem ) ) != NULL ){
-			( void ) uxListRemove( &(OS_delayed_list.head_ptr->xEventListItem ) );
-            context_switch_required = OS_TRUE;
-        }
+    /* If our current task is in a round robin list, we will have to switch */
+    if(_OS_schedule_round_robin_due() == OS_TRUE){
+        context_switch_required = OS_TRUE;
+    }
 
-        /* Remove the task from a waiting list if it is on one */
-        if(OS_delayed_list.head_ptr->block_record.waitlist != NULL){
-            _OS_waitlist_remove(OS_delayed_list.head_ptr);
-        }
+    return context_switch_required;
+}
 
-        /* Wake up the task */
-        if(_OS_delayed_list_wakeup_next_task() == OS_TRUE) {
-            context_switch_required = OS_TRUE;
-        }
+/*******************************************************************************
+* OS Schedule Process Ticks
+*
+*   ticks = The number of ticks to move forward by
+* 
+* PURPOSE : 
+*
+*   Notifies the kernel that several ticks have occured at once. Moves the 
+*   tick counter forward by all of them and wakes every task that came due in
+*   one pass, under a single acquisition of the delayed lock
+* 
+* RETURN :
+*
+*   Returns a boolean stating whether or not a context switch is required.
+*
+* NOTES: 
+*
+*   Used to catch up after the scheduler was suspended for a long time. Must 
+*   not be called from an ISR. The tick hook is not run for these ticks
+*******************************************************************************/
+
+OSBool_t OS_schedule_process_ticks(TickType_t ticks)
+{
+    OSBool_t context_switch_required = OS_FALSE;
+
+    if(ticks == 0) {
+        return context_switch_required;
     }
 
-    /* If our current task is in a round robin list, we will have to switch */
-    if(OS_ready_list[_OS_get_current_TCB()->priority].num_tasks > 1){
+    /* Still suspended. Keep holding on to the ticks */
+    if(OS_schedule_CPU[xPortGetCoreID()].scheduler_suspended != OS_FALSE) {
+        _OS_schedule_lock(&OS_delayed_lock);
+        OS_pending_ticks += ticks;
+        _OS_schedule_unlock(&OS_delayed_lock);
+        return context_switch_required;
+    }
+
+    _OS_schedule_lock(&OS_delayed_lock);
+    _OS_delay_wheel_advance(ticks);
+    context_switch_required = _OS_delay_wheel_expire();
+    _OS_schedule_unlock(&OS_delayed_lock);
+
+    if(_OS_schedule_round_robin_due() == OS_TRUE){
         context_switch_required = OS_TRUE;
     }
-    
-    portEXIT_CRITICAL_ISR(&OS_schedule_mutex);
     return context_switch_required;
 }
 
@@ -1020,17 +1395,17 @@ int OS_schedule_change_task_prio(TCB_t *tcb, TaskPrio_t new_prio)
         return OS_ERROR_INVALID_PRIO;
     }
     
-    portENTER_CRITICAL(&OS_schedule_mutex);
-    
     /* If the tcb is null, get the current tcb */
     if(tcb == NULL){
         tcb = OS_schedule_get_current_tcb();
     }
+
+    _OS_schedule_lock_task(tcb);
     old_prio = tcb->priority;
 
     /* Nothing to do if the base priority equals the new priority */
     if(tcb->base_priority == new_prio){
-        portEXIT_CRITICAL(&OS_schedule_mutex);
+        _OS_schedule_unlock_task(tcb);
         return OS_NO_ERROR;
     }
 
@@ -1047,13 +1422,13 @@ int OS_schedule_change_task_prio(TCB_t *tcb, TaskPrio_t new_prio)
         case OS_TASK_STATE_SUSPENDED:
             break;
         case OS_TASK_STATE_PENDING_DELETION:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_DELETED_TASK;
         case OS_TASK_STATE_READY_TO_DELETE:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_DELETED_TASK;
         default:
-            portEXIT_CRITICAL(&OS_schedule_mutex);
+            _OS_schedule_unlock_task(tcb);
             return OS_ERROR_INVALID_TSK_STATE;
     }
     
@@ -1098,7 +1473,7 @@ int OS_schedule_change_task_prio(TCB_t *tcb, TaskPrio_t new_prio)
         }
     }
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(tcb);
     return OS_NO_ERROR;
 }
 
@@ -1119,14 +1494,16 @@ int OS_schedule_change_task_prio(TCB_t *tcb, TaskPrio_t new_prio)
 
 void OS_schedule_raise_priority_mutex_holder(TCB_t *mutex_holder)
 {
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    if(mutex_holder == NULL){
+        return;
+    }
+
+    _OS_schedule_lock_task(mutex_holder);
 
-    if(mutex_holder == NULL || 
-            (mutex_holder->priority >= _OS_get_current_TCB()->priority)) {
-        portEXIT_CRITICAL(&OS_schedule_mutex);
+    if(mutex_holder->priority >= _OS_get_current_TCB()->priority) {
+        _OS_schedule_unlock_task(mutex_holder);
         return;
     }
-    portENTER_CRITICAL(&OS_schedule_mutex);
 
     /* Adjust the mutex holder state to account for its new
 	priority.  Only reset the event list item value if the value is
@@ -1143,9 +1520,7 @@ void OS_schedule_raise_priority_mutex_holder(TCB_t *mutex_holder)
     else {
        mutex_holder->priority = _OS_get_current_TCB()->priority; 
     }
-    portEXIT_CRITICAL(&OS_schedule_mutex);
-
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(mutex_holder);
     return;
 }
 
@@ -1169,19 +1544,16 @@ OSBool_t OS_schedule_revert_priority_mutex_holder(void * const mux_holder)
     TCB_t * const mutex_holder = (TCB_t *)mux_holder;
     OSBool_t ret_val = OS_FALSE;
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
-
     if(mutex_holder == NULL){
-        portEXIT_CRITICAL(&OS_schedule_mutex);
         return ret_val;
     }
+
+    _OS_schedule_lock_task(mutex_holder);
     mutex_holder->mutexes_held--;
 
     if(mutex_holder->priority != mutex_holder->base_priority){
 		/* Only disinherit if no other mutexes are held. */
 		if(mutex_holder->mutexes_held == 0) {
-			portENTER_CRITICAL(&OS_schedule_mutex);
-
             if(mutex_holder->task_state == OS_TASK_STATE_READY || 
                     mutex_holder->task_state == OS_TASK_STATE_RUNNING) {
                 _OS_ready_list_remove(mutex_holder);
@@ -1198,10 +1570,9 @@ OSBool_t OS_schedule_revert_priority_mutex_holder(void * const mux_holder)
             listSET_LIST_ITEM_VALUE( &( mutex_holder->xEventListItem ), ( TickType_t ) configMAX_PRIORITIES - ( TickType_t ) mutex_holder->priority ); /*lint !e961 MISRA exception as the casts are only redundant for some ports. */
 
 			ret_val = OS_TRUE;
-			portEXIT_CRITICAL(&OS_schedule_mutex);
 		}
 	}
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(mutex_holder);
     return ret_val;
 }
 
@@ -1218,14 +1589,14 @@ OSBool_t OS_schedule_revert_priority_mutex_holder(void * const mux_holder)
 int OS_schedule_join_list_insert(TCB_t *waiter, TCB_t *tcb_to_join, TickType_t timeout)
 {
     TickType_t wakeup_time;
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_lock_task(waiter);
     if(tcb_to_join->task_state == OS_TASK_STATE_PENDING_DELETION ||
             tcb_to_join->task_state == OS_TASK_STATE_READY_TO_DELETE) {
-        portEXIT_CRITICAL(&OS_schedule_mutex);
+        _OS_schedule_unlock_task(waiter);
         return OS_TRUE;
     }
 
-    _OS_waitlist_append(waiter, (tcb_to_join->join_waitlist));
+    _OS_waitlist_append(waiter, (tcb_to_join->join_waitlist), NULL);
 
     _OS_ready_list_remove(waiter);
     if(timeout == OS_NO_TIMEOUT) {
@@ -1239,7 +1610,7 @@ int OS_schedule_join_list_insert(TCB_t *waiter, TCB_t *tcb_to_join, TickType_t t
         _OS_delayed_list_insert(waiter);
     }
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(waiter);
     portYIELD_WITHIN_API();
     return OS_NO_ERROR;
 }
@@ -1264,10 +1635,12 @@ int OS_schedule_join_list_insert(TCB_t *waiter, TCB_t *tcb_to_join, TickType_t t
 void OS_schedule_waitlist_empty(WaitList_t *waitlist)
 {
     TCB_t *popped_tcb;
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_lock(&OS_delayed_lock);
+    _OS_schedule_lock(&OS_suspended_lock);
 
     while(waitlist->num_tasks != 0) {
         popped_tcb = _OS_waitlist_pop_head(waitlist);
+        _OS_schedule_lock(_OS_ready_lock_of(popped_tcb));
         if(popped_tcb->task_state == OS_TASK_STATE_DELAYED){
             _OS_delayed_list_remove(popped_tcb);
         }
@@ -1277,8 +1650,46 @@ void OS_schedule_waitlist_empty(WaitList_t *waitlist)
         popped_tcb->delay_wakeup_time = 0;
         popped_tcb->task_state = OS_TASK_STATE_READY;
         _OS_ready_list_insert(popped_tcb);
+        _OS_schedule_unlock(_OS_ready_lock_of(popped_tcb));
     }
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock(&OS_suspended_lock);
+    _OS_schedule_unlock(&OS_delayed_lock);
+}
+
+/*******************************************************************************
+* OS Schedule Pop Deleted Task
+* 
+* PURPOSE : 
+*
+*   Take the next task waiting to be freed off of the calling core's deletion
+*   pending list, so that its memory can be reclaimed
+*
+* RETURN : 
+*
+*   A TCB in the OS_TASK_STATE_READY_TO_DELETE state, or NULL if the list is 
+*   empty
+*
+* NOTES: 
+*
+*   Only the deletion lock is held, and only long enough to unlink one task.
+*   Freeing the task is up to the caller
+*******************************************************************************/
+
+TCB_t* OS_schedule_pop_deleted_task(void)
+{
+    volatile DeletionList_t *deletion_list;
+    TCB_t *tcb;
+
+    _OS_schedule_lock(&OS_deletion_lock);
+    deletion_list = &OS_deletion_pending_list[xPortGetCoreID()];
+    tcb = deletion_list->head_ptr;
+    if(tcb != NULL) {
+        _OS_task_list_remove(tcb, deletion_list);
+        tcb->task_state = OS_TASK_STATE_READY_TO_DELETE;
+        OS_num_tasks_deleted--;
+    }
+    _OS_schedule_unlock(&OS_deletion_lock);
+    return tcb;
 }
 
 /*******************************************************************************
@@ -1411,34 +1822,240 @@ TickType_t OS_schedule_get_tick_count(){
 }
 
 /*******************************************************************************
-* OS __getreent
+* OS Schedule Get Expected Idle Time
 * 
 * PURPOSE : 
 *
-*   Get the reentrant structure
+*   Work out how many ticks the calling core can sleep through before a task
+*   needs to run. Used by the idle task to decide whether to suppress the tick
 * 
-* RETURN : 
+* RETURN :
 *
-*   The reentrant structure
+*   The number of ticks until the next delayed task wakes up, OS_MAX_DELAY if
+*   no task is delayed, or 0 if something other than idle wants to run
 *
 * NOTES:
 *
-*   User code need not worry about this odd bit of code. It just works
+*   Only meaningful when called from the idle task. Checks this core's own
+*   ready queue as well as the shared one, since pinned work keeps it awake
 *******************************************************************************/
 
-struct _reent* __getreent(void) {
-	//No lock needed because if this changes, we won't be running anymore.
-	TCB_t *currTask=OS_schedule_get_current_tcb();
-	if (currTask==NULL) {
-		//No task running. Return global struct.
-		return _GLOBAL_REENT;
-	} else {
-		//We have a task; return its reentrant struct.
-		return &currTask->xNewLib_reent;
-	}
-}
-
-/*******************************************************************************
+TickType_t OS_schedule_get_expected_idle_time(void)
+{
+    int core_ID = xPortGetCoreID();
+    TickType_t idle_time;
+
+    /* Another task is running or waiting to run at idle priority or higher */
+    if(_OS_get_current_TCB()->priority > OS_IDLE_PRIORITY ||
+            OS_schedule_CPU[core_ID].yield_pending == OS_TRUE ||
+            OS_pending_ticks != 0 ||
+            OS_pending_ready_list[core_ID].num_tasks != 0 ||
+            _OS_schedule_get_highest_prio(&OS_ready_queue[core_ID]) > OS_IDLE_PRIORITY ||
+            _OS_schedule_get_highest_prio(&OS_ready_queue[OS_READY_QUEUE_SHARED]) > OS_IDLE_PRIORITY ||
+            OS_ready_queue[core_ID].lists[OS_IDLE_PRIORITY].num_tasks + 
+            OS_ready_queue[OS_READY_QUEUE_SHARED].lists[OS_IDLE_PRIORITY].num_tasks > 1) {
+        return 0;
+    }
+
+    _OS_schedule_lock(&OS_delayed_lock);
+    if(OS_num_tasks_delayed == 0) {
+        idle_time = OS_MAX_DELAY;
+    }
+    else {
+        idle_time = OS_TICKS_UNTIL(OS_next_task_unblock_time, OS_tick_counter);
+    }
+    _OS_schedule_unlock(&OS_delayed_lock);
+    return idle_time;
+}
+
+/*******************************************************************************
+* OS Schedule Confirm Sleep Mode Status
+* 
+* PURPOSE : 
+*
+*   Called by the port with interrupts disabled, right before it stops the
+*   tick, to check that nothing became ready since the sleep was planned
+* 
+* RETURN :
+*
+*   OS_SLEEP_ABORT if the core should stay awake, OS_SLEEP_STANDARD otherwise
+*
+* NOTES:
+*******************************************************************************/
+
+OSSleepStatus_t OS_schedule_confirm_sleep_mode_status(void)
+{
+    int core_ID = xPortGetCoreID();
+
+    /* A task was readied by an interrupt while the scheduler was suspended */
+    if(OS_pending_ready_list[core_ID].num_tasks != 0) {
+        return OS_SLEEP_ABORT;
+    }
+    /* A context switch was requested while the scheduler was suspended */
+    if(OS_schedule_CPU[core_ID].yield_pending == OS_TRUE) {
+        return OS_SLEEP_ABORT;
+    }
+    /* A tick came in after the expected idle time was computed */
+    if(OS_pending_ticks != 0) {
+        return OS_SLEEP_ABORT;
+    }
+    return OS_SLEEP_STANDARD;
+}
+
+/*******************************************************************************
+* OS Schedule Step Tick
+*
+*   ticks = The number of ticks that went by while the tick was suppressed
+* 
+* PURPOSE : 
+*
+*   Catch the tick counter up after a tickless sleep in one step, instead of
+*   processing every tick we slept through
+* 
+* RETURN :
+*
+* NOTES:
+*
+*   No task can be due before the last tick slept through, so the wheel is 
+*   moved straight to the tick before it. The last tick is then processed as 
+*   a normal tick so any task due on it is woken (or held as a pending tick 
+*   if the scheduler is suspended). Must run on OS_TICK_CORE_ID, the only
+*   core that moves the tick counter
+*******************************************************************************/
+
+void OS_schedule_step_tick(TickType_t ticks)
+{
+    assert(xPortGetCoreID() == OS_TICK_CORE_ID);
+
+    if(ticks == 0) {
+        return;
+    }
+
+    _OS_schedule_lock(&OS_delayed_lock);
+    assert(OS_num_tasks_delayed == 0 || 
+            ticks <= OS_TICKS_UNTIL(OS_next_task_unblock_time, OS_tick_counter));
+    _OS_delay_wheel_advance(ticks - 1);
+    _OS_schedule_unlock(&OS_delayed_lock);
+
+    if(OS_schedule_process_tick() == OS_TRUE) {
+        OS_schedule_CPU[xPortGetCoreID()].yield_pending = OS_TRUE;
+    }
+}
+
+/*******************************************************************************
+* OS Schedule Get Lock Stats
+*
+*   ready_stats = An array of OS_NUM_READY_QUEUES entries filled with the stats
+*                 of each ready queue lock. The last entry is the shared queue
+*   delayed_stats = Filled with the stats of the delayed list lock
+*   suspended_stats = Filled with the stats of the suspended list lock
+*   deletion_stats = Filled with the stats of the deletion list lock
+* 
+* PURPOSE : 
+*
+*   Report how often each scheduler lock was taken and how often it was
+*   already held when we tried to take it. Any argument may be NULL
+* 
+* RETURN :
+*
+* NOTES:
+*
+*   Counters are only maintained when OS_SCHEDULE_LOCK_STATS is enabled.
+*   Otherwise all values read as zero. Contention is sampled before spinning
+*   so it is an estimate, not an exact count
+*******************************************************************************/
+
+void OS_schedule_get_lock_stats(SchedLockStats_t *ready_stats, SchedLockStats_t *delayed_stats, 
+        SchedLockStats_t *suspended_stats, SchedLockStats_t *deletion_stats)
+{
+#if OS_SCHEDULE_LOCK_STATS
+    int i;
+
+    if(ready_stats != NULL){
+        for(i = 0; i < OS_NUM_READY_QUEUES; ++i){
+            _OS_schedule_read_lock_stats(&OS_ready_lock[i], &ready_stats[i]);
+        }
+    }
+    _OS_schedule_read_lock_stats(&OS_delayed_lock, delayed_stats);
+    _OS_schedule_read_lock_stats(&OS_suspended_lock, suspended_stats);
+    _OS_schedule_read_lock_stats(&OS_deletion_lock, deletion_stats);
+#else
+    if(ready_stats != NULL){
+        memset(ready_stats, 0, sizeof(SchedLockStats_t) * OS_NUM_READY_QUEUES);
+    }
+    if(delayed_stats != NULL){
+        memset(delayed_stats, 0, sizeof(SchedLockStats_t));
+    }
+    if(suspended_stats != NULL){
+        memset(suspended_stats, 0, sizeof(SchedLockStats_t));
+    }
+    if(deletion_stats != NULL){
+        memset(deletion_stats, 0, sizeof(SchedLockStats_t));
+    }
+#endif
+}
+
+/*******************************************************************************
+* OS Schedule Reset Lock Stats
+* 
+* PURPOSE : 
+*
+*   Zero the acquisition and contention counters of every scheduler lock
+* 
+* RETURN :
+*
+* NOTES:
+*
+*   Does nothing unless OS_SCHEDULE_LOCK_STATS is enabled
+*******************************************************************************/
+
+void OS_schedule_reset_lock_stats(void)
+{
+#if OS_SCHEDULE_LOCK_STATS
+    int i;
+
+    for(i = 0; i < OS_NUM_READY_QUEUES; ++i){
+        OS_ready_lock[i].acquisitions = 0;
+        OS_ready_lock[i].contentions = 0;
+    }
+    OS_delayed_lock.acquisitions = 0;
+    OS_delayed_lock.contentions = 0;
+    OS_suspended_lock.acquisitions = 0;
+    OS_suspended_lock.contentions = 0;
+    OS_deletion_lock.acquisitions = 0;
+    OS_deletion_lock.contentions = 0;
+#endif
+}
+
+/*******************************************************************************
+* OS __getreent
+* 
+* PURPOSE : 
+*
+*   Get the reentrant structure
+* 
+* RETURN : 
+*
+*   The reentrant structure
+*
+* NOTES:
+*
+*   User code need not worry about this odd bit of code. It just works
+*******************************************************************************/
+
+struct _reent* __getreent(void) {
+	//No lock needed because if this changes, we won't be running anymore.
+	TCB_t *currTask=OS_schedule_get_current_tcb();
+	if (currTask==NULL) {
+		//No task running. Return global struct.
+		return _GLOBAL_REENT;
+	} else {
+		//We have a task; return its reentrant struct.
+		return &currTask->xNewLib_reent;
+	}
+}
+
+/*******************************************************************************
 * This next group of functions were necessary for integration with the existing
 * ESP-IDF codebase. They are based entirely off of equivalent FreeRTOS API calls.
 * They are mostly necessary for the semaphore, mutex, timer, and queue systems.
@@ -1449,44 +2066,54 @@ struct _reent* __getreent(void) {
 void * OS_schedule_increment_task_mutex_count(void)
 {
     TCB_t *cur_tcb;
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    unsigned state = portENTER_CRITICAL_NESTED();
     if(_OS_get_current_TCB() != NULL) {
         _OS_get_current_TCB()->mutexes_held++;
     }
     cur_tcb = _OS_get_current_TCB();
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    portEXIT_CRITICAL_NESTED(state);
     return cur_tcb;
 }
 
 void OS_set_timeout_state( TimeOut_t * const pxTimeOut )
 {
 	assert( pxTimeOut );
+    /* Both counters must come from the same side of a wraparound */
+    _OS_schedule_lock(&OS_delayed_lock);
 	pxTimeOut->xOverflowCount = OS_tick_overflow_counter;
 	pxTimeOut->xTimeOnEntering = OS_tick_counter;
+    _OS_schedule_unlock(&OS_delayed_lock);
 }
 
 OSBool_t OS_schedule_check_for_timeout( TimeOut_t * const timeout, TickType_t * const ticks_to_wait)
 {
     OSBool_t ret_val;
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    TickType_t elapsed;
+    _OS_schedule_lock(&OS_delayed_lock);
+
+    /* Unsigned subtraction gives the right answer across one wraparound */
+    elapsed = OS_tick_counter - timeout->xTimeOnEntering;
 
     if(*ticks_to_wait == OS_NO_TIMEOUT) {
         ret_val = OS_FALSE;
     }
-    if( ( OS_tick_overflow_counter != timeout->xOverflowCount ) && 
+    /* The counter wrapped and came back past our start time. We waited a full
+    wraparound or more, which is longer than any finite timeout */
+    else if( ( OS_tick_overflow_counter != timeout->xOverflowCount ) && 
         ( OS_tick_counter >= timeout->xTimeOnEntering ) ){
 		ret_val = OS_TRUE;
 	}
-	else if( ( OS_tick_counter - timeout->xTimeOnEntering ) < *ticks_to_wait) {
-		*ticks_to_wait -= ( OS_tick_counter - timeout->xTimeOnEntering );
+	else if( elapsed < *ticks_to_wait) {
+		*ticks_to_wait -= elapsed;
 		OS_set_timeout_state( timeout );
         ret_val = OS_FALSE;
 	}
 	else{
+        *ticks_to_wait = 0;
 		ret_val = OS_TRUE;
 	}
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock(&OS_delayed_lock);
     return ret_val;
 }
 
@@ -1521,9 +2148,8 @@ void OS_schedule_place_task_on_event_list(List_t * const pxEventList, const Tick
     TickType_t wakeup_time;
     assert( pxEventList );
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
-
     cur_tcb = _OS_get_current_TCB();
+    _OS_schedule_lock_task(cur_tcb);
 
     vListInsert( pxEventList, &(cur_tcb->xEventListItem ) );
     /* I (right now) believe it will be necessary to assume the task is ready */
@@ -1545,7 +2171,7 @@ void OS_schedule_place_task_on_event_list(List_t * const pxEventList, const Tick
         cur_tcb->task_state = OS_TASK_STATE_DELAYED;
     }
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(cur_tcb);
 }
 
 void OS_schedule_place_task_on_events_list_restricted(List_t * const pxEventList, const TickType_t ticks_to_wait)
@@ -1553,9 +2179,8 @@ void OS_schedule_place_task_on_events_list_restricted(List_t * const pxEventList
     TickType_t wakeup_time; 
     TCB_t *cur_tcb;
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
-
     cur_tcb = _OS_get_current_TCB();
+    _OS_schedule_lock_task(cur_tcb);
 
     vListInsertEnd( pxEventList, &( cur_tcb->xEventListItem ) );
     
@@ -1573,7 +2198,7 @@ void OS_schedule_place_task_on_events_list_restricted(List_t * const pxEventList
     _OS_delayed_list_insert(cur_tcb);
     cur_tcb->task_state = OS_TASK_STATE_DELAYED;
 
-	portEXIT_CRITICAL(&OS_schedule_mutex);
+	_OS_schedule_unlock_task(cur_tcb);
 }
 
 void OS_schedule_place_task_on_unordered_events_list(List_t *pxEventList, const TickType_t item_value, const TickType_t ticks_to_wait)
@@ -1583,9 +2208,8 @@ void OS_schedule_place_task_on_unordered_events_list(List_t *pxEventList, const
 
     assert(pxEventList);
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
-
     cur_tcb = _OS_get_current_TCB();
+    _OS_schedule_lock_task(cur_tcb);
 
     listSET_LIST_ITEM_VALUE( &( cur_tcb->xEventListItem ), item_value | taskEVENT_LIST_ITEM_VALUE_IN_USE );
     vListInsertEnd( pxEventList, &( cur_tcb->xEventListItem ) );
@@ -1608,17 +2232,16 @@ void OS_schedule_place_task_on_unordered_events_list(List_t *pxEventList, const
         cur_tcb->task_state = OS_TASK_STATE_DELAYED;
     }
 
-    portEXIT_CRITICAL(&OS_schedule_mutex);
+    _OS_schedule_unlock_task(cur_tcb);
 }
 
 int OS_schedule_remove_task_from_event_list(const List_t * const pxEventList)
 {
     TCB_t *unblocked_tcb = NULL;
     int ret_val;
-    OSBool_t task_can_be_ready;
-    int i, target_cpu;
 
-    portENTER_CRITICAL_ISR(&OS_schedule_mutex);
+    _OS_schedule_lock_from_ISR(&OS_delayed_lock);
+    _OS_schedule_lock_from_ISR(&OS_suspended_lock);
 	/* The event list is sorted in priority order, so the first in the list can
 	be removed as it is known to be the highest priority.  Remove the TCB from
 	the delayed list, and add it to the ready list.
@@ -1634,97 +2257,15 @@ int OS_schedule_remove_task_from_event_list(const List_t * const pxEventList)
 		assert( unblocked_tcb );
 		( void ) uxListRemove( &( unblocked_tcb->xEventListItem ) );
 	} else {
-		portEXIT_CRITICAL_ISR(&OS_schedule_mutex);
+        _OS_schedule_unlock_from_ISR(&OS_suspended_lock);
+        _OS_schedule_unlock_from_ISR(&OS_delayed_lock);
 		return pdFALSE;
 	}
 
-    /* Determine if the task can possibly be run on either CPU now, either because the scheduler
-	   the task is pinned to is running or because a scheduler is running on any CPU. */
-	task_can_be_ready = OS_FALSE;
-	if ( unblocked_tcb->core_ID == CORE_NO_AFFINITY ) {
-		target_cpu = xPortGetCoreID();
-		for (i = 0; i < portNUM_PROCESSORS; i++) {
-			if (OS_schedule_CPU[i].scheduler_suspended == OS_FALSE) {
-				task_can_be_ready = OS_TRUE;
-				break;
-			}
-		}
-	} else {
-		target_cpu = unblocked_tcb->core_ID;
-		task_can_be_ready = OS_schedule_CPU[target_cpu].scheduler_suspended == OS_FALSE;
-	}
+    ret_val = _OS_schedule_make_ready(unblocked_tcb);
 
-    switch(unblocked_tcb->task_state){
-        case OS_TASK_STATE_RUNNING:
-            assert(OS_FALSE);
-            break;
-        case OS_TASK_STATE_READY:
-            assert(0 == 1);
-            break;
-        case OS_TASK_STATE_DELAYED:
-            _OS_delayed_list_remove(unblocked_tcb);
-            break;
-        case OS_TASK_STATE_SUSPENDED:
-            _OS_suspended_list_remove(unblocked_tcb);
-            break;
-        case OS_TASK_STATE_PENDING_DELETION:
-            assert(1 == 0);
-            break;
-        case OS_TASK_STATE_READY_TO_DELETE:
-            assert(1 == 0);
-            break;
-        default:
-            assert(1 == 0); 
-    }
-
-    if( task_can_be_ready == OS_TRUE )
-	{
-        _OS_ready_list_insert(unblocked_tcb);
-        unblocked_tcb->task_state = OS_TASK_STATE_READY;
-	}
-	else
-	{
-		/* The delayed and ready lists cannot be accessed, so hold this task
-		pending until the scheduler is resumed on this CPU. */
-        _OS_pending_ready_list_insert(unblocked_tcb, target_cpu);
-        unblocked_tcb->task_state = OS_TASK_STATE_PENDING_READY;
-	}
-
-	if ( (unblocked_tcb->core_ID == xPortGetCoreID() || unblocked_tcb->core_ID == CORE_NO_AFFINITY) && unblocked_tcb->priority >= _OS_get_current_TCB()->priority )
-	{
-		/* Return true if the task removed from the event list has a higher
-		priority than the calling task.  This allows the calling task to know if
-		it should force a context switch now. */
-		ret_val = pdTRUE;
-
-		/* Mark that a yield is pending in case the user is not using the
-		"xHigherPriorityTaskWoken" parameter to an ISR safe FreeRTOS function. */
-		OS_schedule_CPU[xPortGetCoreID()].yield_pending = OS_TRUE;
-	}
-	else if ( unblocked_tcb->core_ID != xPortGetCoreID() )
-	{
-		_OS_schedule_yield_other_core(unblocked_tcb->core_ID, unblocked_tcb->priority);
-		ret_val = pdFALSE;
-	}
-	else
-	{
-		ret_val = pdFALSE;
-	}
-
-	#if( configUSE_TICKLESS_IDLE == 1 )
-	{
-		/* If a task is blocked on a kernel object then xNextTaskUnblockTime
-		might be set to the blocked task's time out time.  If the task is
-		unblocked for a reason other than a timeout xNextTaskUnblockTime is
-		normally left unchanged, because it is automatically get reset to a new
-		value when the tick count equals xNextTaskUnblockTime.  However if
-		tickless idling is used it might be more important to enter sleep mode
-		at the earliest possible time - so reset xNextTaskUnblockTime here to
-		ensure it is updated at the earliest possible time. */
-        _OS_update_next_task_unblock_time();
-	}
-	#endif
-	portEXIT_CRITICAL_ISR(&OS_schedule_mutex);
+    _OS_schedule_unlock_from_ISR(&OS_suspended_lock);
+    _OS_schedule_unlock_from_ISR(&OS_delayed_lock);
 
 	return ret_val;
 }
@@ -1734,13 +2275,13 @@ int OS_schedule_remove_task_from_unordered_events_list(ListItem_t * pxEventListI
     TCB_t *unblocked_tcb;
     int ret_val;
 
-    portENTER_CRITICAL(&OS_schedule_mutex);
     assert(OS_schedule_CPU[xPortGetCoreID()].scheduler_suspended != OS_FALSE);
 
-    listSET_LIST_ITEM_VALUE( pxEventListItem, item_value | taskEVENT_LIST_ITEM_VALUE_IN_USE );
-
     unblocked_tcb = ( TCB_t * ) listGET_LIST_ITEM_OWNER( pxEventListItem );
 	assert(unblocked_tcb);
+    _OS_schedule_lock_task(unblocked_tcb);
+
+    listSET_LIST_ITEM_VALUE( pxEventListItem, item_value | taskEVENT_LIST_ITEM_VALUE_IN_USE );
 	( void ) uxListRemove( pxEventListItem );
 
     switch(unblocked_tcb->task_state){
@@ -1790,20 +2331,20 @@ int OS_schedule_remove_task_from_unordered_events_list(ListItem_t * pxEventListI
 		ret_val = pdFALSE;
 	}
 
-	portEXIT_CRITICAL(&OS_schedule_mutex);
+	_OS_schedule_unlock_task(unblocked_tcb);
 	return ret_val;
 }
 
 TickType_t OS_schedule_reset_task_event_item_value(void)
 {
     TickType_t ret_val;
-    portENTER_CRITICAL(&OS_schedule_mutex);
+    unsigned state = portENTER_CRITICAL_NESTED();
     ret_val = listGET_LIST_ITEM_VALUE( &( _OS_get_current_TCB()->xEventListItem ) );
 
 	/* Reset the event list item to its normal value - so it can be used with
 	queues and semaphores. */
 	listSET_LIST_ITEM_VALUE( &( _OS_get_current_TCB()->xEventListItem ), ( ( TickType_t ) configMAX_PRIORITIES - ( TickType_t ) _OS_get_current_TCB()->priority ) ); /*lint !e961 MISRA exception as the casts are only redundant for some ports. */
-	portEXIT_CRITICAL(&OS_schedule_mutex);
+	portEXIT_CRITICAL_NESTED(state);
 
 	return ret_val;
 }
@@ -1814,140 +2355,321 @@ TickType_t OS_schedule_reset_task_event_item_value(void)
 
 /**
  * This updates the global variable keeping track of the next timeout.
- * Should get called in only three places:
- *  - When we cycle the overflow list
- *  - When we add a task to a delayed list
- *  - When we remove a task from the delayed list
+ * Only the first occupied slot of each level (in wheel order) can hold the
+ * earliest task of that level, so at most one slot per level is scanned.
+ * Should get called when:
+ *  - The slot holding the next timeout has been expired
+ *  - The task with the next timeout is removed from the wheel
  */
 static void _OS_update_next_task_unblock_time(void)
 {
-    /* If the list of delayed tasks is empty */
-    if(OS_delayed_list.head_ptr == NULL){
+    TickType_t now = OS_tick_counter;
+    TickType_t best_delta = OS_NO_TIMEOUT;
+    TickType_t delta;
+    uint32_t occupied;
+    int level, start, index;
+    TCB_t *tcb;
+
+    /* If the wheel is empty */
+    if(OS_num_tasks_delayed == 0){
         OS_next_task_unblock_time = OS_NO_TIMEOUT;
         return;
     }
-    OS_next_task_unblock_time = OS_delayed_list.head_ptr->delay_wakeup_time;
+
+    for(level = 0; level < OS_DELAY_WHEEL_LEVELS; ++level) {
+        occupied = OS_delay_wheel_occupied[level];
+        if(occupied == 0){
+            continue;
+        }
+
+        /* Rotate so bit 0 is the slot after the current one. The current slot
+        holds tasks a full turn away, so it comes last */
+        start = ((now >> OS_DELAY_WHEEL_SHIFT(level)) + 1) & OS_DELAY_WHEEL_SLOT_MASK;
+        if(start != 0){
+            occupied = (occupied >> start) | (occupied << (OS_DELAY_WHEEL_SLOTS - start));
+        }
+        index = (start + __builtin_ctz(occupied)) & OS_DELAY_WHEEL_SLOT_MASK;
+
+        /* Every task in a level 0 slot is due on the tick of that slot */
+        if(level == 0){
+            delta = ((index - now - 1) & OS_DELAY_WHEEL_SLOT_MASK) + 1;
+            if(delta < best_delta){
+                best_delta = delta;
+            }
+            continue;
+        }
+        for(tcb = OS_delay_wheel[level][index].head_ptr; tcb != NULL; tcb = tcb->next_ptr){
+            delta = OS_TICKS_UNTIL(tcb->delay_wakeup_time, now);
+            if(delta < best_delta){
+                best_delta = delta;
+            }
+        }
+    }
+
+    for(tcb = OS_delay_far_list.head_ptr; tcb != NULL; tcb = tcb->next_ptr){
+        delta = OS_TICKS_UNTIL(tcb->delay_wakeup_time, now);
+        if(delta < best_delta){
+            best_delta = delta;
+        }
+    }
+    OS_next_task_unblock_time = now + best_delta;
 }
 
 /**
- * Zeros out the bit map storing priorities that are in use
+ * Zeros out the bit maps storing priorities that are in use
  */
 static void _OS_bitmap_reset_prios(void)
 {
     int i;
-    for(i = 0; i < OS_PRIO_MAP_SIZE; ++i){
-        OS_ready_priorities_map[i] = (uint8_t)0;
+    int queue_index;
+    for(queue_index = 0; queue_index < OS_NUM_READY_QUEUES; ++queue_index){
+        for(i = 0; i < OS_PRIO_MAP_SIZE; ++i){
+            OS_ready_queue[queue_index].priorities_map[i] = (uint32_t)0;
+        }
+        OS_ready_queue[queue_index].priorities_summary = (uint32_t)0;
     }
 }
 
 /**
- * Return the highest priority that is currently assigned to any task
+ * Return the highest priority that is currently assigned to any task in the queue
+ * Runs in constant time regardless of how many priorities are in use
  */
-static int _OS_schedule_get_highest_prio(void)
+static int _OS_schedule_get_highest_prio(volatile ReadyQueue_t *queue)
 {
-    uint8_t val;
-    int leading_zeros = 0;
-    int map_index = -1;
-
-    while(OS_ready_priorities_map[++map_index] == (uint8_t)0 && map_index < OS_PRIO_MAP_SIZE);
+    int map_index;
+    uint32_t summary = queue->priorities_summary;
 
-    if(map_index == OS_PRIO_MAP_SIZE){
+    if(summary == (uint32_t)0){
         /* No priorities in use in the map */
         return 0;
     }
 
-    /* Count the leading zeros in the bit map index that contains a priority */
-    val = OS_ready_priorities_map[map_index];
-    while(!(val & (1 << 7))){
-        val = (val << 1);
-        ++leading_zeros;
+    map_index = OS_PRIO_MAP_HIGHEST_BIT(summary);
+    return (map_index * OS_PRIO_MAP_WORD_BITS) + 
+            OS_PRIO_MAP_HIGHEST_BIT(queue->priorities_map[map_index]);
+}
+
+/**
+ * Return the highest priority in use in the queue that is strictly lower than prio
+ * Returns 0 if there is none. Also runs in constant time
+ */
+static int _OS_schedule_get_highest_prio_below(volatile ReadyQueue_t *queue, int prio)
+{
+    int map_index = prio / OS_PRIO_MAP_WORD_BITS;
+    uint32_t word = queue->priorities_map[map_index] & 
+            (((uint32_t)1 << (prio % OS_PRIO_MAP_WORD_BITS)) - 1);
+    uint32_t summary;
+
+    /* A lower priority is in use within the same word */
+    if(word != (uint32_t)0){
+        return (map_index * OS_PRIO_MAP_WORD_BITS) + OS_PRIO_MAP_HIGHEST_BIT(word);
     }
 
-    return((OS_MAX_PRIORITIES) - ((map_index * 8) + leading_zeros));
+    /* Otherwise look at the words holding lower priorities */
+    summary = queue->priorities_summary & (((uint32_t)1 << map_index) - 1);
+    if(summary == (uint32_t)0){
+        return 0;
+    }
+    map_index = OS_PRIO_MAP_HIGHEST_BIT(summary);
+    return (map_index * OS_PRIO_MAP_WORD_BITS) + 
+            OS_PRIO_MAP_HIGHEST_BIT(queue->priorities_map[map_index]);
 }
 
 /**
  * Add an entry to the priority bitmap corresponding to the new priority
  * Does nothing if the bit is already set to 1
  */
-static void _OS_bitmap_add_prio(TaskPrio_t new_prio)
+static void _OS_bitmap_add_prio(volatile ReadyQueue_t *queue, TaskPrio_t new_prio)
 {
-    TaskPrio_t index = (TaskPrio_t)((OS_MAX_PRIORITIES - new_prio) / 8);
-    TaskPrio_t shift = (OS_MAX_PRIORITIES - new_prio) % 8;
+    int index = new_prio / OS_PRIO_MAP_WORD_BITS;
+    int shift = new_prio % OS_PRIO_MAP_WORD_BITS;
 
-    OS_ready_priorities_map[index] = OS_ready_priorities_map[index] | ((TaskPrio_t)128 >> shift);
+    queue->priorities_map[index] |= ((uint32_t)1 << shift);
+    queue->priorities_summary |= ((uint32_t)1 << index);
 }
 
 /**
  * Remove the entry in the bitmap corresponding to the given priority
  * Should only be done if no tasks use that priority anymore
  */
-static void _OS_bitmap_remove_prio(TaskPrio_t prio)
+static void _OS_bitmap_remove_prio(volatile ReadyQueue_t *queue, TaskPrio_t prio)
 {
-    TaskPrio_t index = (TaskPrio_t)((OS_MAX_PRIORITIES - prio) / 8);
-    TaskPrio_t shift = (OS_MAX_PRIORITIES - prio) % 8;
+    int index = prio / OS_PRIO_MAP_WORD_BITS;
+    int shift = prio % OS_PRIO_MAP_WORD_BITS;
 
-    OS_ready_priorities_map[index] = OS_ready_priorities_map[index] ^ ((TaskPrio_t)128 >> shift);
+    queue->priorities_map[index] &= ~((uint32_t)1 << shift);
+
+    /* Clear the summary bit once no priorities in this word are in use */
+    if(queue->priorities_map[index] == (uint32_t)0){
+        queue->priorities_summary &= ~((uint32_t)1 << index);
+    }
 }
 
 /**
- * Ensures that all entries in the ready list are reset
+ * Ensures that all entries in the ready queues are reset
  */
 static void _OS_ready_list_init(void)
 {
     int index;
-    for(index = 0; index < OS_MAX_PRIORITIES; ++index){
-        OS_ready_list[index].num_tasks = 0;
-        OS_ready_list[index].head_ptr = NULL;
-        OS_ready_list[index].tail_ptr = NULL;
+    int queue_index;
+    for(queue_index = 0; queue_index < OS_NUM_READY_QUEUES; ++queue_index){
+        for(index = 0; index < OS_MAX_PRIORITIES; ++index){
+            OS_ready_queue[queue_index].lists[index].num_tasks = 0;
+            OS_ready_queue[queue_index].lists[index].head_ptr = NULL;
+            OS_ready_queue[queue_index].lists[index].tail_ptr = NULL;
+        }
+    }
+    _OS_bitmap_reset_prios();
+}
+
+/**
+ * Move a delayed or suspended task to the ready list, or to its core's pending
+ * ready list if that core's scheduler is suspended. Yields the other core if
+ * needed. Caller must hold the delayed and suspended locks.
+ *
+ * Returns pdTRUE if the current core should yield
+ */
+static int _OS_schedule_make_ready(TCB_t *unblocked_tcb)
+{
+    int ret_val;
+    OSBool_t task_can_be_ready;
+    int i, target_cpu;
+
+    /* Determine if the task can possibly be run on either CPU now, either because the scheduler
+	   the task is pinned to is running or because a scheduler is running on any CPU. */
+	task_can_be_ready = OS_FALSE;
+	if ( unblocked_tcb->core_ID == CORE_NO_AFFINITY ) {
+		target_cpu = xPortGetCoreID();
+		for (i = 0; i < portNUM_PROCESSORS; i++) {
+			if (OS_schedule_CPU[i].scheduler_suspended == OS_FALSE) {
+				task_can_be_ready = OS_TRUE;
+				break;
+			}
+		}
+	} else {
+		target_cpu = unblocked_tcb->core_ID;
+		task_can_be_ready = OS_schedule_CPU[target_cpu].scheduler_suspended == OS_FALSE;
+	}
+
+    /* The target core's lock covers its pending ready list */
+    _OS_schedule_lock_from_ISR(&OS_ready_lock[target_cpu]);
+    if ( unblocked_tcb->core_ID == CORE_NO_AFFINITY ) {
+        _OS_schedule_lock_from_ISR(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
+    }
+
+    switch(unblocked_tcb->task_state){
+        case OS_TASK_STATE_RUNNING:
+            assert(OS_FALSE);
+            break;
+        case OS_TASK_STATE_READY:
+            assert(0 == 1);
+            break;
+        case OS_TASK_STATE_DELAYED:
+            _OS_delayed_list_remove(unblocked_tcb);
+            break;
+        case OS_TASK_STATE_SUSPENDED:
+            _OS_suspended_list_remove(unblocked_tcb);
+            break;
+        case OS_TASK_STATE_PENDING_DELETION:
+            assert(1 == 0);
+            break;
+        case OS_TASK_STATE_READY_TO_DELETE:
+            assert(1 == 0);
+            break;
+        default:
+            assert(1 == 0); 
+    }
+
+    if( task_can_be_ready == OS_TRUE )
+	{
+        _OS_ready_list_insert(unblocked_tcb);
+        unblocked_tcb->task_state = OS_TASK_STATE_READY;
+	}
+	else
+	{
+		/* The delayed and ready lists cannot be accessed, so hold this task
+		pending until the scheduler is resumed on this CPU. */
+        _OS_pending_ready_list_insert(unblocked_tcb, target_cpu);
+        unblocked_tcb->task_state = OS_TASK_STATE_PENDING_READY;
+	}
+
+	if ( (unblocked_tcb->core_ID == xPortGetCoreID() || unblocked_tcb->core_ID == CORE_NO_AFFINITY) && unblocked_tcb->priority >= _OS_get_current_TCB()->priority )
+	{
+		/* Return true if the task removed from the event list has a higher
+		priority than the calling task.  This allows the calling task to know if
+		it should force a context switch now. */
+		ret_val = pdTRUE;
+
+		/* Mark that a yield is pending in case the user is not using the
+		"xHigherPriorityTaskWoken" parameter to an ISR safe FreeRTOS function. */
+		OS_schedule_CPU[xPortGetCoreID()].yield_pending = OS_TRUE;
+	}
+	else if ( unblocked_tcb->core_ID != xPortGetCoreID() )
+	{
+		_OS_schedule_yield_other_core(unblocked_tcb->core_ID, unblocked_tcb->priority);
+		ret_val = pdFALSE;
+	}
+	else
+	{
+		ret_val = pdFALSE;
+	}
+
+	#if( configUSE_TICKLESS_IDLE == 1 )
+	{
+		/* If a task is blocked on a kernel object then xNextTaskUnblockTime
+		might be set to the blocked task's time out time.  If the task is
+		unblocked for a reason other than a timeout xNextTaskUnblockTime is
+		normally left unchanged, because it is automatically get reset to a new
+		value when the tick count equals xNextTaskUnblockTime.  However if
+		tickless idling is used it might be more important to enter sleep mode
+		at the earliest possible time - so reset xNextTaskUnblockTime here to
+		ensure it is updated at the earliest possible time. */
+        _OS_update_next_task_unblock_time();
+	}
+	#endif
+    if ( unblocked_tcb->core_ID == CORE_NO_AFFINITY ) {
+        _OS_schedule_unlock_from_ISR(&OS_ready_lock[OS_READY_QUEUE_SHARED]);
     }
+    _OS_schedule_unlock_from_ISR(&OS_ready_lock[target_cpu]);
+
+	return ret_val;
 }
 
 /**
- * Responsible for placing the tcb in the ready list
+ * Responsible for placing the tcb in the ready queue matching its affinity
  * Application code should not call! This is a helper for OS_add_task_to_ready_list
  */
 static void _OS_ready_list_insert(TCB_t *new_tcb)
 {
+    volatile ReadyQueue_t *queue = _OS_ready_queue_of(new_tcb);
     int prio = new_tcb->priority;
-    if(OS_ready_list[prio].num_tasks == 0){
-        _OS_bitmap_add_prio(prio);
+    if(queue->lists[prio].num_tasks == 0){
+        _OS_bitmap_add_prio(queue, prio);
     }
-    _OS_task_list_append(new_tcb, &(OS_ready_list[prio]));
+    _OS_task_list_append(new_tcb, &(queue->lists[prio]));
 }
 
 /**
- * Removes a tcb from the ready list
+ * Removes a tcb from its ready queue
  */
 static void _OS_ready_list_remove(TCB_t *tcb)
 {
     assert(tcb->task_state == OS_TASK_STATE_READY ||
             tcb->task_state == OS_TASK_STATE_RUNNING);
+    volatile ReadyQueue_t *queue = _OS_ready_queue_of(tcb);
     int prio = tcb->priority;
-    if(OS_ready_list[prio].num_tasks == 1) {
-        _OS_bitmap_remove_prio(prio);
+    if(queue->lists[prio].num_tasks == 1) {
+        _OS_bitmap_remove_prio(queue, prio);
     }
-    _OS_task_list_remove(tcb, &(OS_ready_list[prio]));
+    _OS_task_list_remove(tcb, &(queue->lists[prio]));
 }
 
 /**
  * Inserts a task into the deletion pending list
  */
-static void _OS_deletion_pending_list_insert(TCB_t *tcb)
+static void _OS_deletion_pending_list_insert(TCB_t *tcb, int core_ID)
 {
-    _OS_task_list_append(tcb, &(OS_deletion_pending_list));
-}
-
-/**
- * Empties out the deletion pending list and should destroy all the tasks
- */
-static void _OS_deletion_pending_list_empty()
-{
-    TCB_t * tcb = OS_deletion_pending_list.head_ptr;
-    while(OS_deletion_pending_list.num_tasks > 0){
-        assert(OS_FALSE);
-        /* TODO */
-    }
+    _OS_task_list_append(tcb, &(OS_deletion_pending_list[core_ID]));
 }
 
 /**
@@ -1958,49 +2680,24 @@ static void _OS_delayed_list_insert(TCB_t *tcb)
     assert(tcb->next_ptr == NULL);
     assert(tcb->prev_ptr == NULL);
 
-    TCB_t *tcb1;
-    TCB_t *tcb2;
+    TickType_t when = tcb->delay_wakeup_time;
 
     ++OS_num_tasks_delayed;
 
-    /* Update the task counter for this delayed list */
-    OS_delayed_list.num_tasks++;
-
-    /* First entry in the delayed list */
-    if(OS_delayed_list.head_ptr == NULL) {
-        OS_delayed_list.head_ptr = tcb;
-        OS_delayed_list.tail_ptr = tcb;
-        _OS_update_next_task_unblock_time();
-        return;
+    /* The slot for the current tick has already been expired. A task due now
+    gets woken on the next tick instead. Record that, so removing the task
+    compares against the time it really had */
+    if(when == OS_tick_counter) {
+        when = OS_tick_counter + 1;
+        tcb->delay_wakeup_time = when;
     }
+    _OS_delay_wheel_place(tcb, when);
+
     /* This task is the first one to get woken up */
-    if(OS_delayed_list.head_ptr->delay_wakeup_time >= tcb->delay_wakeup_time) {
-        tcb->prev_ptr = NULL;
-        tcb->next_ptr = OS_delayed_list.head_ptr;
-        OS_delayed_list.head_ptr->prev_ptr = tcb;
-        OS_delayed_list.head_ptr = tcb;
-        _OS_update_next_task_unblock_time();
-        return;
+    if(OS_num_tasks_delayed == 1 || 
+            OS_TICKS_UNTIL(when, OS_tick_counter) < OS_TICKS_UNTIL(OS_next_task_unblock_time, OS_tick_counter)) {
+        OS_next_task_unblock_time = when;
     }
-    /* This task is the last one to get woken up */
-    if(OS_delayed_list.tail_ptr->delay_wakeup_time <= tcb->delay_wakeup_time) {
-        tcb->next_ptr = NULL;
-        tcb->prev_ptr = OS_delayed_list.tail_ptr;
-        OS_delayed_list.tail_ptr->next_ptr = tcb;
-        OS_delayed_list.tail_ptr = tcb;
-        return;
-    }
-    /* Else, find the spot to place this task */
-    tcb1 = OS_delayed_list.head_ptr;
-    while(tcb1->delay_wakeup_time < tcb->delay_wakeup_time){
-        tcb1 = tcb1->next_ptr;
-    }
-    tcb2 = tcb1->prev_ptr;
-
-    tcb2->next_ptr = tcb;
-    tcb1->prev_ptr = tcb;
-    tcb->prev_ptr = tcb2;
-    tcb->next_ptr = tcb1;
 }
 
 /**
@@ -2010,10 +2707,13 @@ static void _OS_delayed_list_remove(TCB_t *tcb)
 {
     assert(tcb->task_state == OS_TASK_STATE_DELAYED);
     OS_num_tasks_delayed--;
-    if(tcb == OS_delayed_list.head_ptr) {
+    _OS_delay_wheel_unlink(tcb);
+
+    /* Leaving a stale (early) next timeout is harmless, so only recompute when
+    the task that set it is the one leaving */
+    if(tcb->delay_wakeup_time == OS_next_task_unblock_time) {
         _OS_update_next_task_unblock_time();
     }
-    _OS_task_list_remove(tcb, &OS_delayed_list);
 }
 
 /**
@@ -2034,31 +2734,17 @@ static void _OS_suspended_list_remove(TCB_t *tcb)
 }
 
 /**
- * Wake up the next task on the delayed list.
- * This only deals with the main delayed list, we won't ever wakeup from the overflow list.
+ * Wake up a task whose slot on the delay wheel has expired.
  * 
  * Returns True if a context switch is required after the wakeup. False otherwise.
  */
-static OSBool_t _OS_delayed_list_wakeup_next_task(void)
+static OSBool_t _OS_delayed_list_wakeup_task(TCB_t *woken_task)
 {    
     OSBool_t context_switch_required = OS_FALSE;
-    TCB_t *woken_task = OS_delayed_list.head_ptr;
     assert(woken_task != NULL);
 
     --OS_num_tasks_delayed;
-
-    /* If this is the only entry on the delayed list */
-    if(OS_delayed_list.num_tasks == 1){
-        OS_delayed_list.head_ptr = NULL;
-        OS_delayed_list.tail_ptr = NULL;
-        OS_delayed_list.num_tasks = 0;
-    } 
-    else {
-        OS_delayed_list.head_ptr = woken_task->next_ptr;
-        assert(OS_delayed_list.head_ptr);
-        OS_delayed_list.head_ptr->prev_ptr = NULL;
-        OS_delayed_list.num_tasks--;
-    }
+    _OS_delay_wheel_unlink(woken_task);
 
     /* Does the woken task have a higher priority than the running task? */
     if(woken_task->priority >= _OS_get_current_TCB()->priority){
@@ -2066,17 +2752,213 @@ static OSBool_t _OS_delayed_list_wakeup_next_task(void)
     }
 
     /* place task on the ready list */
-    woken_task->next_ptr = NULL;
-    woken_task->prev_ptr = NULL;
+    _OS_schedule_acquire(_OS_ready_lock_of(woken_task));
     woken_task->task_state = OS_TASK_STATE_READY;
     _OS_ready_list_insert(woken_task);
+    _OS_schedule_release(_OS_ready_lock_of(woken_task));
 
-    /* Update the time of the next wakeup to occur in the delayed list */
-    _OS_update_next_task_unblock_time();
+    return context_switch_required;
+}
+
+/**
+ * Put a task in the wheel slot that will be expired (or cascaded) on tick 'when'.
+ * 'when' must not be before the current tick
+ */
+static void _OS_delay_wheel_place(TCB_t *tcb, TickType_t when)
+{
+    TickType_t delta = OS_TICKS_UNTIL(when, OS_tick_counter);
+    volatile DelayedList_t *slot;
+    int level, index;
+
+    if(delta >= OS_DELAY_WHEEL_RANGE) {
+        slot = &OS_delay_far_list;
+    }
+    else {
+        /* The lowest level whose slots are wide enough for this delay */
+        level = (31 - __builtin_clz(delta | 1)) / OS_DELAY_WHEEL_SLOT_BITS;
+        index = (when >> OS_DELAY_WHEEL_SHIFT(level)) & OS_DELAY_WHEEL_SLOT_MASK;
+        slot = &OS_delay_wheel[level][index];
+        OS_delay_wheel_occupied[level] |= ((uint32_t)1 << index);
+    }
+    _OS_task_list_append(tcb, slot);
+    tcb->delay_slot = slot;
+}
+
+/**
+ * Take a task out of whichever wheel slot it is in. O(1)
+ */
+static void _OS_delay_wheel_unlink(TCB_t *tcb)
+{
+    volatile DelayedList_t *slot = tcb->delay_slot;
+
+    assert(slot != NULL);
+    _OS_task_list_remove(tcb, slot);
+    tcb->delay_slot = NULL;
 
+    if(slot->num_tasks == 0) {
+        _OS_delay_wheel_mark_empty(slot);
+    }
+}
+
+/**
+ * Clear the occupied bit of an empty wheel slot. Does nothing for the far list
+ */
+static void _OS_delay_wheel_mark_empty(volatile DelayedList_t *slot)
+{
+    int offset;
+
+    if(slot == &OS_delay_far_list) {
+        return;
+    }
+    offset = slot - &OS_delay_wheel[0][0];
+    OS_delay_wheel_occupied[offset >> OS_DELAY_WHEEL_SLOT_BITS] &= 
+            ~((uint32_t)1 << (offset & OS_DELAY_WHEEL_SLOT_MASK));
+}
+
+/**
+ * Empty a slot and re-place each of its tasks relative to the current tick.
+ * Tasks that came due in the last 'ticks' ticks go into the slot for the 
+ * current tick. The slot is detached first so tasks landing back in it are 
+ * not seen twice
+ */
+static void _OS_delay_wheel_cascade(volatile DelayedList_t *slot, TickType_t ticks)
+{
+    TCB_t *tcb = slot->head_ptr;
+    TCB_t *next_tcb;
+
+    if(tcb == NULL) {
+        return;
+    }
+
+    slot->head_ptr = NULL;
+    slot->tail_ptr = NULL;
+    slot->num_tasks = 0;
+    _OS_delay_wheel_mark_empty(slot);
+
+    while(tcb != NULL) {
+        next_tcb = tcb->next_ptr;
+        tcb->next_ptr = NULL;
+        tcb->prev_ptr = NULL;
+        if(OS_TICKS_UNTIL(OS_tick_counter, tcb->delay_wakeup_time) <= ticks) {
+            _OS_delay_wheel_place(tcb, OS_tick_counter);
+        }
+        else {
+            _OS_delay_wheel_place(tcb, tcb->delay_wakeup_time);
+        }
+        tcb = next_tcb;
+    }
+}
+
+/**
+ * Move the tick counter forward by 'ticks' and bring the wheel up to date.
+ * Every slot passed over is visited once: level 0 slots are all due and get
+ * merged into the slot for the new tick, upper level slots are cascaded down.
+ * For a single tick this only cascades levels whose lower digits wrapped.
+ * Caller must hold OS_delayed_lock and then expire the current slot
+ */
+static void _OS_delay_wheel_advance(TickType_t ticks)
+{
+    TickType_t old_tick = OS_tick_counter;
+    TickType_t new_tick = old_tick + ticks;
+    TickType_t steps, i;
+    int level, shift;
+
+    if(ticks == 0) {
+        return;
+    }
+
+    /* The wheel only compares times relative to the current tick, so a 
+    wraparound needs no special handling beyond counting it for timeouts */
+    OS_tick_counter = new_tick;
+    if(new_tick < old_tick) {
+        ++OS_tick_overflow_counter;
+    }
+
+    /* Gather the level 0 slots we skipped. Done first, since tasks cascaded 
+    down below must not land in a slot we are yet to gather */
+    steps = (ticks > OS_DELAY_WHEEL_SLOTS) ? OS_DELAY_WHEEL_SLOTS : ticks;
+    for(i = 1; i < steps; ++i) {
+        _OS_delay_wheel_cascade(&OS_delay_wheel[0][(old_tick + i) & OS_DELAY_WHEEL_SLOT_MASK], ticks);
+    }
+
+    if(ticks >= OS_DELAY_WHEEL_RANGE || 
+            (new_tick >> OS_DELAY_WHEEL_SHIFT(OS_DELAY_WHEEL_LEVELS)) != 
+            (old_tick >> OS_DELAY_WHEEL_SHIFT(OS_DELAY_WHEEL_LEVELS))) {
+        _OS_delay_wheel_cascade(&OS_delay_far_list, ticks);
+    }
+
+    /* Top level first so tasks falling through several levels are handled in one pass */
+    for(level = OS_DELAY_WHEEL_LEVELS - 1; level > 0; --level) {
+        shift = OS_DELAY_WHEEL_SHIFT(level);
+        steps = ((new_tick >> shift) - (old_tick >> shift)) & (OS_NO_TIMEOUT >> shift);
+        if(steps > OS_DELAY_WHEEL_SLOTS) {
+            steps = OS_DELAY_WHEEL_SLOTS;
+        }
+        for(i = 1; i <= steps; ++i) {
+            _OS_delay_wheel_cascade(
+                &OS_delay_wheel[level][((old_tick >> shift) + i) & OS_DELAY_WHEEL_SLOT_MASK], ticks);
+        }
+    }
+
+    /* A next timeout we jumped past is stale. Expiring only recomputes it when
+    the current slot has tasks or the timeout is the current tick, so a stale
+    one left here would stay in the past and tickless idle would oversleep */
+    if(OS_TICKS_UNTIL(OS_next_task_unblock_time, old_tick) < ticks) {
+        _OS_update_next_task_unblock_time();
+    }
+}
+
+/**
+ * Wake up every task in the level 0 slot of the current tick. All of them are due.
+ * Caller must hold OS_delayed_lock.
+ * 
+ * Returns True if a context switch is required after the wakeups. False otherwise.
+ */
+static OSBool_t _OS_delay_wheel_expire(void)
+{
+    OSBool_t context_switch_required = OS_FALSE;
+    volatile DelayedList_t *due_slot = &OS_delay_wheel[0][OS_tick_counter & OS_DELAY_WHEEL_SLOT_MASK];
+    TCB_t *woken_task;
+
+    if(due_slot->head_ptr == NULL && OS_next_task_unblock_time != OS_tick_counter) {
+        return context_switch_required;
+    }
+
+    while(due_slot->head_ptr != NULL) {
+        woken_task = due_slot->head_ptr;
+
+        /* Remove the task from an event list if it is on one */
+        if( listLIST_ITEM_CONTAINER( &(woken_task->xEventListItem ) ) != NULL ){
+            ( void ) uxListRemove( &(woken_task->xEventListItem ) );
+            context_switch_required = OS_TRUE;
+        }
+
+        /* Remove the task from a waiting list if it is on one. A kernel object's
+        waitlist is guarded by the object's mux, so the task leaves it itself */
+        if(woken_task->block_record.waitlist != NULL && woken_task->block_record.waitlist_mux == NULL){
+            _OS_waitlist_remove(woken_task);
+        }
+
+        /* Wake up the task */
+        if(_OS_delayed_list_wakeup_task(woken_task) == OS_TRUE) {
+            context_switch_required = OS_TRUE;
+        }
+    }
+    _OS_update_next_task_unblock_time();
     return context_switch_required;
 }
 
+/**
+ * True if the current task shares its priority with another ready task it
+ * should be time sliced with
+ */
+static OSBool_t _OS_schedule_round_robin_due(void)
+{
+    TaskPrio_t cur_prio = _OS_get_current_TCB()->priority;
+    return (OS_ready_queue[xPortGetCoreID()].lists[cur_prio].num_tasks + 
+            OS_ready_queue[OS_READY_QUEUE_SHARED].lists[cur_prio].num_tasks > 1) ? OS_TRUE : OS_FALSE;
+}
+
 /**
  * Removes from the head of the pending ready list.
  * Adds that task to the ready list
@@ -2121,5 +3003,13 @@ static void _OS_pending_ready_list_insert(TCB_t *tcb, int core_ID)
     _OS_task_list_append(tcb, &(OS_pending_ready_list[core_ID]));
 }
 
-
-
+#if OS_SCHEDULE_LOCK_STATS
+/** Copy the counters out of a single lock */
+static void _OS_schedule_read_lock_stats(SchedLock_t *lock, SchedLockStats_t *stats)
+{
+    if(stats != NULL){
+        stats->acquisitions = lock->acquisitions;
+        stats->contentions = lock->contentions;
+    }
+}
+#endif
@@ -10,6 +10,25 @@
 #include "schedule.h"
 #include "verios_util.h"
 #include "sem.h"
+#include "queue_set.h"
+
+/*******************************************************************************
+* STATIC FUNCTION DECLARATIONS
+*******************************************************************************/
+
+static void _OS_sync_spin_init(SyncSpin_t *spin);
+
+static void _OS_sync_spin_done(SyncSpin_t *spin, OSBool_t success);
+
+static OSBool_t _OS_sync_other_core_busy(void);
+
+static OSBool_t _OS_sync_running_elsewhere(TCB_t *tcb);
+
+static OSBool_t _OS_sem_try_decrement(Semaphore_t *sem);
+
+static OSBool_t _OS_sem_spin(Semaphore_t *sem);
+
+static OSBool_t _OS_mux_spin(Mutex_t *mux, TCB_t *cur_tcb);
 
 /*******************************************************************************
 * Semaphore Create (API FUNCTION)
@@ -32,6 +51,10 @@ int OS_sem_create(Sem_t * sem_ptr, int value)
 {
     Semaphore_t *sem;
 
+    if(value < 0 || value > OS_SEM_MAX_VALUE) {
+        return OS_ERROR_INVALID_SEM_VALUE;
+    }
+
     /* Allocate the semaphore */
     sem = malloc(sizeof(Semaphore_t));
     if(sem == NULL) {
@@ -39,7 +62,11 @@ int OS_sem_create(Sem_t * sem_ptr, int value)
     }
 
     /* Initialize the semapore fields */
-    sem->value = value;
+    sem->state = (uint32_t)value << OS_SEM_COUNT_SHIFT;
+    sem->queue_set = NULL;
+    sem->set_max_count = 0;
+    sem->handoff = OS_FALSE;
+    _OS_sync_spin_init(&(sem->spin));
     _OS_list_header_init(&(sem->waiters));
     vPortCPUInitializeMutex(&sem->mux);
 
@@ -74,6 +101,10 @@ int OS_sem_delete(Sem_t *sem)
     }
 
     portENTER_CRITICAL(&((*sem_ptr)->mux));
+    if((*sem_ptr)->queue_set != NULL) {
+        _OS_queue_set_remove_member((*sem_ptr)->queue_set, *sem_ptr, (*sem_ptr)->set_max_count);
+        (*sem_ptr)->queue_set = NULL;
+    }
     OS_schedule_waitlist_empty(&((*sem_ptr)->waiters));
     portEXIT_CRITICAL(&((*sem_ptr)->mux));
     
@@ -98,42 +129,164 @@ int OS_sem_delete(Sem_t *sem)
 *
 * NOTES: 
 *
+*   Same as OS_sem_take_timeout with OS_NO_TIMEOUT
 *******************************************************************************/
 
 int OS_sem_take(Sem_t semaphore)
 {
-    TCB_t *tcb = OS_schedule_get_current_tcb();
+    return OS_sem_take_timeout(semaphore, OS_NO_TIMEOUT);
+}
+
+/*******************************************************************************
+* Semaphore Take Timeout (API FUNCTION)
+*
+*   semaphore = The semaphore to take (down operation)
+*   timeout = The most ticks to wait. 0 never blocks, OS_NO_TIMEOUT waits forever
+* 
+* PURPOSE : 
+*
+*   Perform a take on a semaphore, blocking for at most timeout ticks if the 
+*   value is currently 0. The task waits on the delayed list so the timeout
+*   wakes it without a release
+* 
+* RETURN :
+*
+*   Return OS_ERROR_SEM_UNAVAILABLE if timeout was 0 and the value was 0,
+*   OS_ERROR_TIMER_EXPIRED if the timeout passed, another error message, or 
+*   0 (OS_NO_ERROR) if the semaphore was taken
+*
+* NOTES: 
+*
+*   Without hand-off, a task woken by a release can lose the unit to a task 
+*   that takes it first. It then blocks again for whatever is left of the 
+*   timeout
+*******************************************************************************/
+
+int OS_sem_take_timeout(Sem_t semaphore, TickType_t timeout)
+{
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
     Semaphore_t *sem = (struct OSSemaphore *)semaphore;
+    TimeOut_t time_out;
+    OSBool_t waited = OS_FALSE;
+    uint32_t state, new_state;
+    int ret_val;
 
     if(sem == NULL) {
         return OS_ERROR_INVALID_SEM;
     }
 
-    while (OS_TRUE) {
-        portENTER_CRITICAL(&(sem->mux));
-        
-        /* Add the message if there is room on the queue */
-        if (sem->value > 0)
-        {
-            sem->value--;
+    /* Fast path. A unit is free and a single compare-and-set takes it */
+    if(_OS_sem_try_decrement(sem) == OS_TRUE) {
+        return OS_NO_ERROR;
+    }
+    if(timeout == 0) {
+        return OS_ERROR_SEM_UNAVAILABLE;
+    }
 
-            portEXIT_CRITICAL(&(sem->mux));
-            tcb->is_blocked = OS_FALSE;
-            return OS_NO_ERROR;
+    /* Give a release on the other core a chance before we pay for blocking */
+    if(_OS_sem_spin(sem) == OS_TRUE && _OS_sem_try_decrement(sem) == OS_TRUE) {
+        return OS_NO_ERROR;
+    }
+
+    portENTER_CRITICAL(&(sem->mux));
+    while(OS_TRUE) {
+        state = sem->state;
+        if(OS_SEM_COUNT(state) > 0) {
+            new_state = state - OS_SEM_COUNT_ONE;
+            uxPortCompareSet(&(sem->state), state, &new_state);
+            if(new_state != state) {
+                continue;
+            }
+            break;
         }
 
-        /* We were unable to take the semaphore */
+        /* Track the deadline so a stolen wakeup only costs the ticks it used */
+        if(waited == OS_FALSE) {
+            OS_set_timeout_state(&time_out);
+        }
+        else if(OS_schedule_check_for_timeout(&time_out, &timeout) == OS_TRUE) {
+            if(sem->waiters.num_tasks == 0) {
+                (void) _OS_sem_update_state(sem, OS_SEM_WAITERS, 0, 0);
+            }
+            portEXIT_CRITICAL(&(sem->mux));
+            return OS_ERROR_TIMER_EXPIRED;
+        }
 
-        /* Add the task to a waitlist so that it can be woken up once the sem is released */
-        _OS_waitlist_append(tcb, &(sem->waiters));
-        tcb->is_blocked = OS_TRUE;
+        /* Flag that we are waiting, so releases take the slow path. Once set, 
+        a release can't finish without our mux */
+        if((state & OS_SEM_WAITERS) == 0) {
+            new_state = state | OS_SEM_WAITERS;
+            uxPortCompareSet(&(sem->state), state, &new_state);
+            if(new_state != state) {
+                continue;
+            }
+        }
 
+        /* Leave the ready list before dropping the mux so the release can't be lost */
+        _OS_waitlist_append(cur_tcb, &(sem->waiters), &(sem->mux));
+        sem->spin.stats.blocks++;
+        ret_val = OS_schedule_block_current_task(timeout);
+        if(ret_val != OS_NO_ERROR) {
+            _OS_waitlist_remove(cur_tcb);
+            if(sem->waiters.num_tasks == 0) {
+                (void) _OS_sem_update_state(sem, OS_SEM_WAITERS, 0, 0);
+            }
+            portEXIT_CRITICAL(&(sem->mux));
+            return ret_val;
+        }
         portEXIT_CRITICAL(&(sem->mux));
 
-        OS_schedule_suspend_task(tcb);
+        portYIELD_WITHIN_API();
 
+        /* If the timeout woke us we are still on the waitlist */
+        portENTER_CRITICAL(&(sem->mux));
+        if(cur_tcb->block_record.waitlist != NULL) {
+            _OS_waitlist_remove(cur_tcb);
+            if(sem->waiters.num_tasks == 0) {
+                (void) _OS_sem_update_state(sem, OS_SEM_WAITERS, 0, 0);
+            }
+        }
+        else if(cur_tcb->block_record.granted == OS_TRUE) {
+            /* The release handed its unit straight to us */
+            break;
+        }
+        waited = OS_TRUE;
+    }
+    portEXIT_CRITICAL(&(sem->mux));
+
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Semaphore Try Take (API FUNCTION)
+*
+*   semaphore = The semaphore to take (down operation)
+* 
+* PURPOSE : 
+*
+*   Take a semaphore only if it is available right now, without blocking
+* 
+* RETURN :
+*
+*   Return OS_ERROR_SEM_UNAVAILABLE if the value was 0, another error message, 
+*   or 0 (OS_NO_ERROR) if the semaphore was taken
+*
+* NOTES: 
+*
+*   Use this to take a semaphore that OS_queue_set_select reported as ready
+*******************************************************************************/
+
+int OS_sem_try_take(Sem_t semaphore)
+{
+    Semaphore_t *sem = (struct OSSemaphore *)semaphore;
+
+    if(sem == NULL) {
+        return OS_ERROR_INVALID_SEM;
+    }
+
+    if(_OS_sem_try_decrement(sem) == OS_FALSE) {
+        return OS_ERROR_SEM_UNAVAILABLE;
     }
-    tcb->is_blocked = OS_FALSE;
     return OS_NO_ERROR;
 }
 
@@ -154,22 +307,63 @@ int OS_sem_take(Sem_t semaphore)
 *
 * NOTES: 
 *
+*   A semaphore in a queue set can't count more than the max_count it was 
+*   added with. Such a release fails with OS_ERROR_QUEUE_SET_FULL
 *******************************************************************************/
 
 int OS_sem_release(Sem_t semaphore)
 {
     TCB_t *woken_task = NULL;
     struct OSSemaphore *sem = (struct OSSemaphore *)semaphore;
+    uint32_t state, new_state;
+    uint32_t clear = 0;
 
     if(sem == NULL) {
         return OS_ERROR_INVALID_SEM;
     }
 
+    /* Fast path. Nobody is waiting and no set needs telling, so just count
+    the unit */
+    state = sem->state;
+    while((state & OS_SEM_FLAGS) == 0) {
+        new_state = state + OS_SEM_COUNT_ONE;
+        uxPortCompareSet(&(sem->state), state, &new_state);
+        if(new_state == state) {
+            return OS_NO_ERROR;
+        }
+        state = new_state;
+    }
+
     portENTER_CRITICAL(&(sem->mux));
-    sem->value++;
+
+    /* A unit counted while in a set takes one of the ready slots the set 
+    reserved for this semaphore. The count can only drop while we hold the mux */
+    if(sem->queue_set != NULL && (sem->waiters.num_tasks == 0 || sem->handoff == OS_FALSE) &&
+            OS_SEM_COUNT(sem->state) >= sem->set_max_count) {
+        portEXIT_CRITICAL(&(sem->mux));
+        return OS_ERROR_QUEUE_SET_FULL;
+    }
+
     if(sem->waiters.num_tasks != 0) {
         woken_task = _OS_waitlist_pop_head(&(sem->waiters));
     }
+
+    /* Waiters can also leave on their own, for example when deleted, so drop
+    the flag whenever the waitlist is empty rather than only after a pop */
+    if(sem->waiters.num_tasks == 0) {
+        clear = OS_SEM_WAITERS;
+    }
+    if(woken_task != NULL && sem->handoff == OS_TRUE) {
+        /* The unit goes to the waiter, so nothing else can take it first */
+        woken_task->block_record.granted = OS_TRUE;
+        (void) _OS_sem_update_state(sem, clear, 0, 0);
+    }
+    else {
+        (void) _OS_sem_update_state(sem, clear, 0, OS_SEM_COUNT_ONE);
+        if(sem->queue_set != NULL) {
+            _OS_queue_set_post(sem->queue_set, sem, 1);
+        }
+    }
     portEXIT_CRITICAL(&(sem->mux));
     if(woken_task != NULL) {
         OS_schedule_resume_task(woken_task);
@@ -178,6 +372,146 @@ int OS_sem_release(Sem_t semaphore)
     return OS_NO_ERROR;
 }
 
+/*******************************************************************************
+* Semaphore Set Handoff (API FUNCTION)
+*
+*   semaphore = The semaphore to configure
+*   handoff = OS_TRUE to hand released units straight to waiters
+* 
+* PURPOSE : 
+*
+*   In hand-off mode a release with tasks waiting gives its unit directly to
+*   the highest priority waiter instead of raising the value. A third task
+*   can no longer take the unit before the woken task runs, so a waiter never 
+*   wakes just to block again
+* 
+* RETURN :
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*
+*   A handed off unit is never posted to the semaphore's queue set, since no
+*   other task could take it
+*******************************************************************************/
+
+int OS_sem_set_handoff(Sem_t semaphore, OSBool_t handoff)
+{
+    Semaphore_t *sem = (Semaphore_t *)semaphore;
+
+    if(sem == NULL) {
+        return OS_ERROR_INVALID_SEM;
+    }
+
+    portENTER_CRITICAL(&(sem->mux));
+    sem->handoff = handoff;
+    portEXIT_CRITICAL(&(sem->mux));
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Semaphore Set Spin (API FUNCTION)
+*
+*   semaphore = The semaphore to configure
+*   max_cycles = The longest a take may spin, in CPU cycles. 0 disables spinning
+* 
+* PURPOSE : 
+*
+*   Turn on adaptive spin-then-block waiting. A take that finds the semaphore
+*   unavailable spins while a task on another core could release it, and only
+*   blocks once the spin budget runs out. Short holds on the other core then 
+*   cost no context switches
+* 
+* RETURN :
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*
+*   Spinning never helps on a single core, where it is skipped
+*******************************************************************************/
+
+int OS_sem_set_spin(Sem_t semaphore, uint32_t max_cycles)
+{
+    Semaphore_t *sem = (Semaphore_t *)semaphore;
+
+    if(sem == NULL) {
+        return OS_ERROR_INVALID_SEM;
+    }
+
+    sem->spin.max_cycles = max_cycles;
+    sem->spin.budget = max_cycles;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Semaphore Get Spin Stats (API FUNCTION)
+*
+*   semaphore = The semaphore to report on
+*   stats = Filled with the semaphore's spin counters
+* 
+* PURPOSE : 
+*
+*   Report how often takes spun, how many spins succeeded and how many takes
+*   had to block, to help choose the spin limit
+* 
+* RETURN :
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*
+*   The counters aren't updated atomically with each other, so they are 
+*   approximate while the semaphore is in use
+*******************************************************************************/
+
+int OS_sem_get_spin_stats(Sem_t semaphore, SyncSpinStats_t *stats)
+{
+    Semaphore_t *sem = (Semaphore_t *)semaphore;
+
+    if(sem == NULL || stats == NULL) {
+        return OS_ERROR_INVALID_SEM;
+    }
+
+    *stats = sem->spin.stats;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Semaphore Update State
+*
+*   sem = The semaphore to update
+*   clear = OS_SEM_* flags to clear
+*   set = OS_SEM_* flags to set
+*   add = Added to the state word, as a multiple of OS_SEM_COUNT_ONE
+* 
+* PURPOSE : 
+*
+*   Atomically change the flags and count of a semaphore's state word
+* 
+* RETURN :
+*
+*   The state word before the update
+*
+* NOTES: 
+*
+*   The caller must hold the semaphore's mux when changing flags
+*******************************************************************************/
+
+uint32_t _OS_sem_update_state(Semaphore_t *sem, uint32_t clear, uint32_t set, uint32_t add)
+{
+    uint32_t state, new_state;
+
+    while(OS_TRUE) {
+        state = sem->state;
+        new_state = ((state & ~clear) | set) + add;
+        uxPortCompareSet(&(sem->state), state, &new_state);
+        if(new_state == state) {
+            return state;
+        }
+    }
+}
+
 /*******************************************************************************
 * Mutex Create (API FUNCTION)
 *
@@ -194,9 +528,27 @@ int OS_sem_release(Sem_t semaphore)
 * NOTES: 
 *******************************************************************************/
 
-inline int OS_mux_create(Mux_t *mux_ptr)
+int OS_mux_create(Mux_t *mux_ptr)
 {
-    return OS_sem_create(mux_ptr, 1);
+    Mutex_t *mutex;
+
+    if(mux_ptr == NULL) {
+        return OS_ERROR_INVALID_MUTEX;
+    }
+
+    mutex = malloc(sizeof(Mutex_t));
+    if(mutex == NULL) {
+        return OS_ERROR_MUTEX_ALLOC;
+    }
+
+    mutex->owner = 0;
+    mutex->recursion = 0;
+    _OS_sync_spin_init(&(mutex->spin));
+    _OS_list_header_init(&(mutex->waiters));
+    vPortCPUInitializeMutex(&mutex->mux);
+
+    *mux_ptr = (void *)mutex;
+    return OS_NO_ERROR;
 }
 
 /*******************************************************************************
@@ -215,20 +567,34 @@ inline int OS_mux_create(Mux_t *mux_ptr)
 * NOTES: 
 *******************************************************************************/
 
-inline int OS_mux_delete(Mux_t *mux_ptr)
+int OS_mux_delete(Mux_t *mux_ptr)
 {
-    return OS_sem_delete(mux_ptr);
+    Mutex_t *mutex;
+
+    if(mux_ptr == NULL || *mux_ptr == NULL) {
+        return OS_ERROR_INVALID_MUTEX;
+    }
+    mutex = (Mutex_t *)*mux_ptr;
+
+    portENTER_CRITICAL(&(mutex->mux));
+    OS_schedule_waitlist_empty(&(mutex->waiters));
+    portEXIT_CRITICAL(&(mutex->mux));
+
+    free(mutex);
+    *mux_ptr = NULL;
+    return OS_NO_ERROR;
 }
 
 /*******************************************************************************
 * Mutex Take (API FUNCTION)
 *
-*   mutex = The mutex to take (down operation)
+*   mutex = The mutex to take (lock operation)
 * 
 * PURPOSE : 
 *
-*   Perform a take ('down', 'wait', etc...) on a mutex. This operation is
-*   blocking if the semaphore value is currently 0 
+*   Lock a mutex, blocking while another task owns it. While blocked, the 
+*   owner inherits our priority if it is lower, so a medium priority task 
+*   can't hold us up by preempting the owner
 * 
 * RETURN :
 *
@@ -236,22 +602,146 @@ inline int OS_mux_delete(Mux_t *mux_ptr)
 *
 * NOTES: 
 *
+*   The owner can take the mutex again. It is released once it has been 
+*   released as many times as it was taken
+*******************************************************************************/
+
+int OS_mux_take(Mux_t mutex)
+{
+    Mutex_t *mux = (Mutex_t *)mutex;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    uint32_t owner;
+    uint32_t new_owner;
+    int ret_val;
+
+    if(mux == NULL) {
+        return OS_ERROR_INVALID_MUTEX;
+    }
+
+    /* Fast path. The mutex is free and a single compare-and-set takes it */
+    new_owner = (uint32_t)cur_tcb;
+    uxPortCompareSet(&(mux->owner), 0, &new_owner);
+    if(new_owner == 0) {
+        /* Only ever changed by the task itself */
+        cur_tcb->mutexes_held++;
+        return OS_NO_ERROR;
+    }
+
+    if(OS_MUTEX_OWNER(new_owner) == cur_tcb) {
+        mux->recursion++;
+        return OS_NO_ERROR;
+    }
+
+    /* The owner is likely to release soon if it is running on the other core */
+    if(_OS_mux_spin(mux, cur_tcb) == OS_TRUE) {
+        cur_tcb->mutexes_held++;
+        return OS_NO_ERROR;
+    }
+
+    portENTER_CRITICAL(&(mux->mux));
+    while(OS_TRUE) {
+        owner = mux->owner;
+
+        /* Released since we last looked, or handed to us while we slept */
+        if(owner == 0) {
+            new_owner = (uint32_t)cur_tcb;
+            uxPortCompareSet(&(mux->owner), 0, &new_owner);
+            if(new_owner != 0) {
+                continue;
+            }
+            break;
+        }
+        if(OS_MUTEX_OWNER(owner) == cur_tcb) {
+            break;
+        }
+
+        /* Flag that we are waiting, so the owner's release takes the slow 
+        path. Once set, the owner can't release without our mux */
+        if((owner & OS_MUTEX_WAITERS) == 0) {
+            new_owner = owner | OS_MUTEX_WAITERS;
+            uxPortCompareSet(&(mux->owner), owner, &new_owner);
+            if(new_owner != owner) {
+                continue;
+            }
+        }
+
+        OS_schedule_raise_priority_mutex_holder(OS_MUTEX_OWNER(owner));
+        mux->spin.stats.blocks++;
+
+        /* Leave the ready list before dropping the mux so the hand-off can't be lost */
+        _OS_waitlist_append(cur_tcb, &(mux->waiters), &(mux->mux));
+        ret_val = OS_schedule_block_current_task(OS_NO_TIMEOUT);
+        if(ret_val != OS_NO_ERROR) {
+            _OS_waitlist_remove(cur_tcb);
+            if(mux->waiters.num_tasks == 0) {
+                mux->owner &= ~OS_MUTEX_WAITERS;
+            }
+            portEXIT_CRITICAL(&(mux->mux));
+            return ret_val;
+        }
+        portEXIT_CRITICAL(&(mux->mux));
+
+        portYIELD_WITHIN_API();
+
+        portENTER_CRITICAL(&(mux->mux));
+    }
+    portEXIT_CRITICAL(&(mux->mux));
+
+    cur_tcb->mutexes_held++;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Mutex Try Take (API FUNCTION)
+*
+*   mutex = The mutex to take (lock operation)
+* 
+* PURPOSE : 
+*
+*   Lock a mutex only if it is free (or already ours), without blocking
+* 
+* RETURN :
+*
+*   Return OS_ERROR_SEM_UNAVAILABLE if another task owns the mutex, another 
+*   error message, or 0 (OS_NO_ERROR) if the mutex was taken
+*
+* NOTES: 
 *******************************************************************************/
 
-inline int OS_mux_take(Mux_t mutex){
-    return OS_sem_take(mutex);
+int OS_mux_try_take(Mux_t mutex)
+{
+    Mutex_t *mux = (Mutex_t *)mutex;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    uint32_t new_owner;
+
+    if(mux == NULL) {
+        return OS_ERROR_INVALID_MUTEX;
+    }
+
+    new_owner = (uint32_t)cur_tcb;
+    uxPortCompareSet(&(mux->owner), 0, &new_owner);
+    if(new_owner == 0) {
+        cur_tcb->mutexes_held++;
+        return OS_NO_ERROR;
+    }
+
+    if(OS_MUTEX_OWNER(new_owner) == cur_tcb) {
+        mux->recursion++;
+        return OS_NO_ERROR;
+    }
+    return OS_ERROR_SEM_UNAVAILABLE;
 }
 
 /*******************************************************************************
 * Mutex Release (API FUNCTION)
 *
-*   mutex = The mutex to release (up operation)
+*   mutex = The mutex to release (unlock operation)
 * 
 * PURPOSE : 
 *
-*   Perform a release ('up', 'post', etc...) on a mutex. This operation is
-*   non-blocking and will wake up the next task waiting on the mtuex if there
-*   is one
+*   Unlock a mutex. If tasks are waiting, ownership is handed straight to the
+*   highest priority one, and any priority we inherited while holding it is 
+*   given up
 * 
 * RETURN :
 *
@@ -259,7 +749,293 @@ inline int OS_mux_take(Mux_t mutex){
 *
 * NOTES: 
 *
+*   Only the owner can release a mutex
 *******************************************************************************/
-inline int OS_mux_release(Mux_t mutex){
-    return OS_sem_release(mutex);
+
+int OS_mux_release(Mux_t mutex)
+{
+    Mutex_t *mux = (Mutex_t *)mutex;
+    TCB_t *cur_tcb = OS_schedule_get_current_tcb();
+    TCB_t *next_owner = NULL;
+    uint32_t owner;
+    uint32_t new_owner;
+    OSBool_t yield_required;
+
+    if(mux == NULL) {
+        return OS_ERROR_INVALID_MUTEX;
+    }
+
+    owner = mux->owner;
+    if(OS_MUTEX_OWNER(owner) != cur_tcb) {
+        return OS_ERROR_MUTEX_NOT_OWNER;
+    }
+
+    if(mux->recursion != 0) {
+        mux->recursion--;
+        return OS_NO_ERROR;
+    }
+
+    /* Fast path. Nobody is waiting, so a single compare-and-set frees it */
+    if((owner & OS_MUTEX_WAITERS) == 0) {
+        new_owner = 0;
+        uxPortCompareSet(&(mux->owner), owner, &new_owner);
+        if(new_owner == owner) {
+            /* A waiter on another mutex we hold may have raised us */
+            if(cur_tcb->priority != cur_tcb->base_priority) {
+                yield_required = OS_schedule_revert_priority_mutex_holder(cur_tcb);
+                if(yield_required == OS_TRUE) {
+                    portYIELD_WITHIN_API();
+                }
+            }
+            else {
+                cur_tcb->mutexes_held--;
+            }
+            return OS_NO_ERROR;
+        }
+    }
+
+    /* Hand the mutex to the highest priority waiter. The waitlist is in 
+    priority order, so none of the remaining waiters outrank the new owner */
+    portENTER_CRITICAL(&(mux->mux));
+    if(mux->waiters.num_tasks != 0) {
+        next_owner = _OS_waitlist_pop_head(&(mux->waiters));
+        __atomic_store_n(&(mux->owner), (uint32_t)next_owner | 
+                ((mux->waiters.num_tasks != 0) ? OS_MUTEX_WAITERS : 0), __ATOMIC_RELEASE);
+    }
+    else {
+        __atomic_store_n(&(mux->owner), 0, __ATOMIC_RELEASE);
+    }
+    yield_required = OS_schedule_revert_priority_mutex_holder(cur_tcb);
+    portEXIT_CRITICAL(&(mux->mux));
+
+    if(next_owner != NULL) {
+        OS_schedule_resume_task(next_owner);
+    }
+    if(yield_required == OS_TRUE) {
+        portYIELD_WITHIN_API();
+    }
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Mutex Set Spin (API FUNCTION)
+*
+*   mutex = The mutex to configure
+*   max_cycles = The longest a take may spin, in CPU cycles. 0 disables spinning
+* 
+* PURPOSE : 
+*
+*   Turn on adaptive spin-then-block waiting. A take spins while the owner is 
+*   running on another core, and only blocks once the owner stops running or
+*   the spin budget runs out
+* 
+* RETURN :
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*******************************************************************************/
+
+int OS_mux_set_spin(Mux_t mutex, uint32_t max_cycles)
+{
+    Mutex_t *mux = (Mutex_t *)mutex;
+
+    if(mux == NULL) {
+        return OS_ERROR_INVALID_MUTEX;
+    }
+
+    mux->spin.max_cycles = max_cycles;
+    mux->spin.budget = max_cycles;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* Mutex Get Spin Stats (API FUNCTION)
+*
+*   mutex = The mutex to report on
+*   stats = Filled with the mutex's spin counters
+* 
+* PURPOSE : 
+*
+*   Report how often takes spun, how many spins succeeded and how many takes
+*   had to block
+* 
+* RETURN :
+*
+*   Return an error code or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*
+*   The counters are approximate while the mutex is in use
+*******************************************************************************/
+
+int OS_mux_get_spin_stats(Mux_t mutex, SyncSpinStats_t *stats)
+{
+    Mutex_t *mux = (Mutex_t *)mutex;
+
+    if(mux == NULL || stats == NULL) {
+        return OS_ERROR_INVALID_MUTEX;
+    }
+
+    *stats = mux->spin.stats;
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* STATIC FUNCTION DEFINITIONS
+*******************************************************************************/
+
+/**
+ * Spinning starts off. See OS_sem_set_spin and OS_mux_set_spin
+ */
+static void _OS_sync_spin_init(SyncSpin_t *spin)
+{
+    spin->max_cycles = 0;
+    spin->budget = 0;
+    memset(&(spin->stats), 0, sizeof(SyncSpinStats_t));
+}
+
+/**
+ * Record the outcome of a spin and adapt the budget to it. Racing updates 
+ * from two cores only make the budget or counters slightly off
+ */
+static void _OS_sync_spin_done(SyncSpin_t *spin, OSBool_t success)
+{
+    uint32_t budget = spin->budget;
+
+    if(success == OS_TRUE) {
+        __atomic_fetch_add(&(spin->stats.spin_successes), 1, __ATOMIC_RELAXED);
+        budget = (budget > spin->max_cycles / 2) ? spin->max_cycles : budget * 2;
+    }
+    else {
+        budget = budget / 2;
+        if(budget < OS_SYNC_SPIN_MIN_CYCLES) {
+            budget = (spin->max_cycles < OS_SYNC_SPIN_MIN_CYCLES) ? 
+                    spin->max_cycles : OS_SYNC_SPIN_MIN_CYCLES;
+        }
+    }
+    spin->budget = budget;
+}
+
+/**
+ * True if another core is running something other than its idle task, so 
+ * there is a task that could release what we are waiting for
+ */
+static OSBool_t _OS_sync_other_core_busy(void)
+{
+    int core_ID;
+    TCB_t *running;
+
+    for(core_ID = 0; core_ID < portNUM_PROCESSORS; ++core_ID) {
+        if(core_ID == (int)xPortGetCoreID()) {
+            continue;
+        }
+        running = OS_schedule_get_current_tcb_from_core(core_ID);
+        if(running != NULL && running != OS_schedule_get_idle_tcb(core_ID)) {
+            return OS_TRUE;
+        }
+    }
+    return OS_FALSE;
+}
+
+/**
+ * True if tcb is the task running on another core right now
+ */
+static OSBool_t _OS_sync_running_elsewhere(TCB_t *tcb)
+{
+    int core_ID;
+
+    for(core_ID = 0; core_ID < portNUM_PROCESSORS; ++core_ID) {
+        if(core_ID != (int)xPortGetCoreID() && 
+                OS_schedule_get_current_tcb_from_core(core_ID) == tcb) {
+            return OS_TRUE;
+        }
+    }
+    return OS_FALSE;
+}
+
+/**
+ * Take a unit with a compare-and-set if the count is above 0. Returns false
+ * if there was none
+ */
+static OSBool_t _OS_sem_try_decrement(Semaphore_t *sem)
+{
+    uint32_t state = sem->state;
+    uint32_t new_state;
+
+    while(OS_SEM_COUNT(state) > 0) {
+        new_state = state - OS_SEM_COUNT_ONE;
+        uxPortCompareSet(&(sem->state), state, &new_state);
+        if(new_state == state) {
+            return OS_TRUE;
+        }
+        state = new_state;
+    }
+    return OS_FALSE;
+}
+
+/**
+ * Spin until the semaphore has a unit, the other cores go idle or the budget
+ * runs out. Returns true if a unit showed up. Doesn't take it
+ */
+static OSBool_t _OS_sem_spin(Semaphore_t *sem)
+{
+    uint32_t budget = sem->spin.budget;
+    uint32_t start;
+
+    if(budget == 0 || _OS_sync_other_core_busy() == OS_FALSE) {
+        return OS_FALSE;
+    }
+
+    __atomic_fetch_add(&(sem->spin.stats.spins), 1, __ATOMIC_RELAXED);
+    start = xthal_get_ccount();
+    do {
+        if(OS_SEM_COUNT(sem->state) > 0) {
+            _OS_sync_spin_done(&(sem->spin), OS_TRUE);
+            return OS_TRUE;
+        }
+    } while(xthal_get_ccount() - start < budget && _OS_sync_other_core_busy() == OS_TRUE);
+
+    _OS_sync_spin_done(&(sem->spin), OS_FALSE);
+    return OS_FALSE;
+}
+
+/**
+ * Spin while the mutex's owner runs on another core, taking the mutex if it
+ * is released. Gives up as soon as tasks are queued, since the mutex will be
+ * handed to them. Returns true if we now own the mutex
+ */
+static OSBool_t _OS_mux_spin(Mutex_t *mux, TCB_t *cur_tcb)
+{
+    uint32_t budget = mux->spin.budget;
+    uint32_t owner = mux->owner;
+    uint32_t new_owner;
+    uint32_t start;
+
+    if(budget == 0 || (owner & OS_MUTEX_WAITERS) != 0 || 
+            _OS_sync_running_elsewhere(OS_MUTEX_OWNER(owner)) == OS_FALSE) {
+        return OS_FALSE;
+    }
+
+    __atomic_fetch_add(&(mux->spin.stats.spins), 1, __ATOMIC_RELAXED);
+    start = xthal_get_ccount();
+    do {
+        owner = mux->owner;
+        if(owner == 0) {
+            new_owner = (uint32_t)cur_tcb;
+            uxPortCompareSet(&(mux->owner), 0, &new_owner);
+            if(new_owner == 0) {
+                _OS_sync_spin_done(&(mux->spin), OS_TRUE);
+                return OS_TRUE;
+            }
+            continue;
+        }
+        if((owner & OS_MUTEX_WAITERS) != 0 || 
+                _OS_sync_running_elsewhere(OS_MUTEX_OWNER(owner)) == OS_FALSE) {
+            break;
+        }
+    } while(xthal_get_ccount() - start < budget);
+
+    _OS_sync_spin_done(&(mux->spin), OS_FALSE);
+    return OS_FALSE;
 }
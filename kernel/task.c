@@ -16,6 +16,8 @@ task.h is included from an application file. */
 #include "task.h"
 #include "schedule.h"
 #include "msg_queue.h"
+#include "task_pool.h"
+#include "verios_util.h"
 #include "StackMacros.h"
 #include "portmacro.h"
 #include "portmacro_priv.h"
@@ -36,14 +38,15 @@ privileged Vs unprivileged linkage and placement. */
 * TASK CRITICAL STATE VARIABLES
 *******************************************************************************/
 
-/* Maps index representing a task ID (tid) to its corresponding tcb */
-PRIVILEGED_DATA static volatile TCB_t ** OS_tid_table = NULL;
+/* Maps the index part of a task ID (tid) to its slot, OS_TID_CHUNK_SIZE slots
+per chunk. Chunks are never moved, so lookups can read them without a lock */
+PRIVILEGED_DATA static TidSlot_t * volatile OS_tid_chunks[OS_TID_MAX_CHUNKS] = {NULL};
 
-/* The current maximum capacity of the tid table */
-PRIVILEGED_DATA static volatile int OS_tid_table_size = 0;
+/* The lowest tid table index that has never been handed out */
+PRIVILEGED_DATA static int OS_tid_next_index = 0;
 
-/* A counter of how many tasks have ever been created. Never decremented */
-PRIVILEGED_DATA static volatile int OS_task_counter = 0;
+/* Head of the list of released tid table slots, or -1 if there are none */
+PRIVILEGED_DATA static int OS_tid_free_head = -1;
 
 /* Mutex for controling global task status events such as the tid table */
 PRIVILEGED_DATA static portMUX_TYPE OS_task_mutex = portMUX_INITIALIZER_UNLOCKED;
@@ -61,9 +64,17 @@ static void _OS_task_init_stack(TCB_t *tcb, int stack_size, StackType_t *stack_a
 
 static void _OS_task_delete_TLS(TCB_t *tcb);
 
+static int _OS_task_notify_update(TCB_t *tcb, uint32_t value, OSNotifyAction_t action);
+
 static void _OS_task_delete_TCB(TCB_t *tcb);
 
-static void _OS_task_init_tid(TCB_t *task_tcb);
+static TidSlot_t * _OS_task_tid_slot(Tid_t tid);
+
+static int _OS_task_init_tid(TCB_t *task_tcb);
+
+static void _OS_task_release_tid(TCB_t *task_tcb);
+
+static int _OS_task_start(TCB_t *task_tcb, int msg_queue_size, Tid_t *task_tid);
 
 /*******************************************************************************
 * OS Task Create
@@ -106,41 +117,89 @@ int OS_task_create(TaskFunc_t task_func, void *task_arg, const char * const task
         return OS_ERROR_INVALID_STKSIZE;
     }
 
-    /* Allocate Stack first so that TCB does not interact with stack memory */
-	task_stack = ( StackType_t * ) pvPortMallocStackMem( ( ( ( size_t ) stack_size ) * sizeof( StackType_t ) ) );
+    /* Allocate Stack first so that TCB does not interact with stack memory.
+    Both come from the task pools, which only touch the heap when empty */
+    task_stack = _OS_task_pool_alloc_stack(stack_size);
     if(task_stack == NULL) {
         return OS_ERROR_STACK_ALLOC;
     }
 
-    task_tcb = ( TCB_t * ) pvPortMallocTcbMem( sizeof( TCB_t ) );
+    task_tcb = _OS_task_pool_alloc_tcb();
     if(task_tcb == NULL){
-        /* Allocating TCB failed. Free the stack and error out */
-        vPortFree(task_stack);
+        /* Allocating TCB failed. Return the stack and error out */
+        _OS_task_pool_free_stack(task_stack, stack_size);
         return OS_ERROR_TCB_ALLOC;
     }
 
     _OS_task_init_stack(task_tcb, stack_size, task_stack, task_func, task_arg, prio);
     _OS_task_init_tcb(task_tcb, task_name, prio, stack_size, OS_FALSE, NULL, core_ID);
-    
-    /* Get the task added to the tid table and set the task id */
-    portENTER_CRITICAL(&OS_task_mutex);
-    _OS_task_init_tid(task_tcb);
-    portEXIT_CRITICAL(&OS_task_mutex);
-    if(task_tid != NULL){ 
-        *task_tid = task_tcb->tid;
+
+    ret_val = _OS_task_start(task_tcb, msg_queue_size, task_tid);
+    if(ret_val == OS_ERROR_TID_ALLOC) {
+        /* The task never became visible, so give its memory straight back */
+        _OS_task_pool_free_tcb(task_tcb);
+        _OS_task_pool_free_stack(task_stack, stack_size);
     }
-    
-    /* Handle message queue */
-    if(msg_queue_size > 0) {
-        _OS_msg_queue_init(&(task_tcb->msg_queue), msg_queue_size);
-    } 
+    return ret_val;
+}
 
-    ret_val = OS_schedule_add_task(task_tcb);
-    if(ret_val != OS_NO_ERROR) {
-        return ret_val;
+/*******************************************************************************
+* OS Task Create Static
+*
+*   task_func = The function representing a new task
+*   task_arg = The argument passed to the task function
+*   task_name = The name of the task for debugging purposes. Can be NULL
+*   prio = The priority of the task. Less than OS_MAX_PRIORITIES
+*   stack_size = The size of stack_buffer measured in WORDS
+*   stack_buffer = Caller owned memory of at least stack_size words for the stack
+*   tcb_buffer = Caller owned memory for the task's TCB
+*   msg_queu_size = The size of the IPC message queue. Use 0 or negative for no queue
+*   core_ID = The ID of the core to place this task on
+*   task_tid = Pointer to space for the new task's ID. Can be null.
+* 
+* PURPOSE : 
+*   
+*   Create a new task in memory provided by the caller, without touching the
+*   heap. Creation time does not depend on the state of the allocator
+* 
+* RETURN :
+*   
+*   Return an error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*
+*   After the task is deleted the buffers still belong to the kernel until
+*   OS_task_get_tcb(tid) returns NULL, after which they may be reused
+*
+*   tcb_buffer must be a real TCB_t. A FreeRTOS StaticTask_t is too small to
+*   hold one, see OS_STATIC_TASK_WRAPPERS
+*******************************************************************************/
+
+int OS_task_create_static(TaskFunc_t task_func, void *task_arg, const char * const task_name, 
+            TaskPrio_t prio, int stack_size, StackType_t *stack_buffer, TCB_t *tcb_buffer,
+            int msg_queue_size, int core_ID, Tid_t *task_tid)
+{
+    /* Priority 0 is reserved for the Idle task */
+    if(prio == (TaskPrio_t)0 && strcmp(task_name, OS_IDLE_NAME) != 0) {
+        return OS_ERROR_RESERVED_PRIORITY;
     }
 
-    return OS_NO_ERROR;
+    /* Make sure the stack size is valid */
+    if(stack_size <= 0) {
+        return OS_ERROR_INVALID_STKSIZE;
+    }
+
+    if(stack_buffer == NULL) {
+        return OS_ERROR_STACK_ALLOC;
+    }
+    if(tcb_buffer == NULL) {
+        return OS_ERROR_TCB_ALLOC;
+    }
+
+    _OS_task_init_stack(tcb_buffer, stack_size, stack_buffer, task_func, task_arg, prio);
+    _OS_task_init_tcb(tcb_buffer, task_name, prio, stack_size, OS_TRUE, NULL, core_ID);
+
+    return _OS_task_start(tcb_buffer, msg_queue_size, task_tid);
 }
 
 /*******************************************************************************
@@ -159,12 +218,17 @@ int OS_task_create(TaskFunc_t task_func, void *task_arg, const char * const task
 *   Return an error code, or 0 (OS_NO_ERROR) if no error occured
 *
 * NOTES: 
+*
+*   A task blocked on a kernel object is taken off the object's waitlist under
+*   the object's mux, which is held until the scheduler has let go of the task
 *******************************************************************************/
 
 int OS_task_delete(Tid_t tid)
 {
     int ret_val;
     TCB_t *tcb;
+    OSBool_t reclaim;
+    portMUX_TYPE *waitlist_mux;
 
     /* Determine which tcb is to be deleted */
     tcb = OS_task_get_tcb(tid);
@@ -177,20 +241,75 @@ int OS_task_delete(Tid_t tid)
         return OS_ERROR_IDLE_DELETE;
     }
 
-    /* Remove this task from the scheduler */
-    ret_val = OS_schedule_remove_task(tcb);
+    /* Remove this task from the scheduler. Retry if the task moved on to 
+    another object's waitlist before we got hold of the mux */
+    do {
+        waitlist_mux = tcb->block_record.waitlist_mux;
+        if(waitlist_mux != NULL) {
+            portENTER_CRITICAL(waitlist_mux);
+            if(tcb->block_record.waitlist_mux == waitlist_mux) {
+                _OS_waitlist_remove(tcb);
+            }
+        }
+        ret_val = OS_schedule_remove_task(tcb, &reclaim);
+        if(waitlist_mux != NULL) {
+            portEXIT_CRITICAL(waitlist_mux);
+        }
+    } while(ret_val == OS_ERROR_BLOCKED_TASK);
     
     /* Only get here if the task was deleted from another context */
     if(ret_val != OS_NO_ERROR) {
         return ret_val;
     }
-    assert(tcb->task_state == OS_TASK_STATE_READY_TO_DELETE);
+
+    /* The task is still running or belongs to another core. Idle frees it,
+    possibly already, so the tcb must not be touched again */
+    if(reclaim == OS_FALSE) {
+        return OS_NO_ERROR;
+    }
     _OS_task_delete_TLS(tcb);
     _OS_task_delete_TCB(tcb);
 
     return OS_NO_ERROR;
 }
 
+/*******************************************************************************
+* OS Task Reclaim Deleted
+*
+*   max_tasks = The most tasks to free in this call
+* 
+* PURPOSE :
+*
+*   Free the resources of tasks that were deleted while they were running or 
+*   while they belonged to this core. Called by the idle task of each core
+* 
+* RETURN : 
+*
+*   The number of tasks that were freed
+*
+* NOTES: 
+*
+*   The scheduler is only locked while each task is unlinked from the deletion
+*   list. TLS callbacks and frees run with interrupts enabled
+*******************************************************************************/
+
+int OS_task_reclaim_deleted(int max_tasks)
+{
+    int num_reclaimed = 0;
+    TCB_t *tcb;
+
+    while(num_reclaimed < max_tasks) {
+        tcb = OS_schedule_pop_deleted_task();
+        if(tcb == NULL) {
+            break;
+        }
+        _OS_task_delete_TLS(tcb);
+        _OS_task_delete_TCB(tcb);
+        ++num_reclaimed;
+    }
+    return num_reclaimed;
+}
+
 /*******************************************************************************
 * OS Task Join
 *
@@ -378,7 +497,7 @@ int OS_task_send_msg(Tid_t tid, TickType_t timeout, const void * const data)
         return OS_ERROR_NO_TASK_QUEUE;
     }
 
-    ret_val = OS_msg_queue_post(&(tcb->msg_queue), timeout, data);
+    ret_val = OS_msg_queue_send(&(tcb->msg_queue), timeout, data);
     return ret_val;
 }
 
@@ -406,7 +525,264 @@ int OS_task_receive_msg(TickType_t timeout, void ** data)
     cur_tcb = OS_schedule_get_current_tcb();
     assert(cur_tcb);
 
-    ret_val = OS_msg_queue_pend(&(cur_tcb->msg_queue), timeout, data);
+    ret_val = OS_msg_queue_receive(&(cur_tcb->msg_queue), timeout, data);
+    return ret_val;
+}
+
+/*******************************************************************************
+* OS Task Notify
+*
+*   tid = The ID of the task to notify
+*   value = Used to update the task's notification value, depending on action
+*   action = How the notification value is updated
+* 
+* PURPOSE : 
+*
+*   Send a direct to task notification, waking the task if it is waiting on
+*   one. Cheaper than a message since nothing is allocated or queued
+* 
+* RETURN :
+*
+*   Return an error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*
+*   OS_NOTIFY_NO_OVERWRITE fails with OS_ERROR_NOTIFY_PENDING if the task has
+*   not consumed its previous notification yet
+*******************************************************************************/
+
+int OS_task_notify(Tid_t tid, uint32_t value, OSNotifyAction_t action)
+{
+    TCB_t *tcb = OS_task_get_tcb(tid);
+    if(tcb == NULL) {
+        return OS_ERROR_INVALID_TID;
+    }
+    return _OS_task_notify(tcb, value, action, NULL);
+}
+
+/*******************************************************************************
+* OS Task Notify From ISR
+*
+*   tid = The ID of the task to notify
+*   value = Used to update the task's notification value, depending on action
+*   action = How the notification value is updated
+*   higher_prio_woken = Set to OS_TRUE if the notification woke a task that 
+*                       should preempt the interrupted one. Can be NULL
+* 
+* PURPOSE : 
+*
+*   Same as OS_task_notify, but safe to call from an ISR
+* 
+* RETURN :
+*
+*   Return an error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*******************************************************************************/
+
+int OS_task_notify_from_ISR(Tid_t tid, uint32_t value, OSNotifyAction_t action, OSBool_t *higher_prio_woken)
+{
+    TCB_t *tcb = OS_task_get_tcb(tid);
+    if(tcb == NULL) {
+        return OS_ERROR_INVALID_TID;
+    }
+    return _OS_task_notify_from_ISR(tcb, value, action, NULL, higher_prio_woken);
+}
+
+/*******************************************************************************
+* OS Task Notify Wait
+*
+*   clear_on_entry = Bits of the notification value to clear before waiting
+*   clear_on_exit = Bits of the notification value to clear once notified
+*   value = Receives the notification value before clear_on_exit is applied. 
+*           Can be NULL
+*   timeout = The most ticks to wait. OS_NO_TIMEOUT to wait forever
+* 
+* PURPOSE : 
+*
+*   Wait for a notification to be sent to the current task
+* 
+* RETURN :
+*
+*   0 (OS_NO_ERROR) if a notification was received, otherwise
+*   OS_ERROR_TIMER_EXPIRED or another error code
+*
+* NOTES: 
+*
+*   Returns straight away if a notification is already pending
+*******************************************************************************/
+
+int OS_task_notify_wait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t timeout)
+{
+    TCB_t *tcb = OS_schedule_get_current_tcb();
+    int ret_val;
+
+    portENTER_CRITICAL(&(tcb->task_state_mux));
+    if(tcb->notify_state != OS_NOTIFY_STATE_PENDING) {
+        tcb->notify_value &= ~clear_on_entry;
+
+        if(timeout != 0) {
+            /* Leave the ready list while still holding our state mux, so a
+            notifier either sees us waiting and wakes us, or ran before us */
+            tcb->notify_state = OS_NOTIFY_STATE_WAITING;
+            ret_val = OS_schedule_block_current_task(timeout);
+            if(ret_val != OS_NO_ERROR) {
+                tcb->notify_state = OS_NOTIFY_STATE_NONE;
+                portEXIT_CRITICAL(&(tcb->task_state_mux));
+                return ret_val;
+            }
+            portEXIT_CRITICAL(&(tcb->task_state_mux));
+            portYIELD_WITHIN_API();
+            portENTER_CRITICAL(&(tcb->task_state_mux));
+        }
+    }
+
+    if(value != NULL) {
+        *value = tcb->notify_value;
+    }
+
+    /* We were either notified, or woke up from the timeout without one */
+    if(tcb->notify_state == OS_NOTIFY_STATE_PENDING) {
+        tcb->notify_value &= ~clear_on_exit;
+        ret_val = OS_NO_ERROR;
+    }
+    else {
+        ret_val = OS_ERROR_TIMER_EXPIRED;
+    }
+    tcb->notify_state = OS_NOTIFY_STATE_NONE;
+    portEXIT_CRITICAL(&(tcb->task_state_mux));
+
+    return ret_val;
+}
+
+/*******************************************************************************
+* OS Task Notify Take
+*
+*   clear_on_exit = OS_TRUE to zero the notification value once taken, OS_FALSE
+*                   to decrement it
+*   timeout = The most ticks to wait. OS_NO_TIMEOUT to wait forever
+* 
+* PURPOSE : 
+*
+*   Use the notification value as a counting semaphore. Waits for the value
+*   to be non-zero, then takes from it
+* 
+* RETURN :
+*
+*   The notification value before it was cleared or decremented. 0 if the 
+*   timeout expired
+*
+* NOTES: 
+*******************************************************************************/
+
+uint32_t OS_task_notify_take(OSBool_t clear_on_exit, TickType_t timeout)
+{
+    TCB_t *tcb = OS_schedule_get_current_tcb();
+    uint32_t count;
+
+    portENTER_CRITICAL(&(tcb->task_state_mux));
+    if(tcb->notify_value == 0 && timeout != 0) {
+        tcb->notify_state = OS_NOTIFY_STATE_WAITING;
+        if(OS_schedule_block_current_task(timeout) == OS_NO_ERROR) {
+            portEXIT_CRITICAL(&(tcb->task_state_mux));
+            portYIELD_WITHIN_API();
+            portENTER_CRITICAL(&(tcb->task_state_mux));
+        }
+    }
+
+    count = tcb->notify_value;
+    if(count != 0) {
+        tcb->notify_value = (clear_on_exit == OS_TRUE) ? 0 : count - 1;
+    }
+    tcb->notify_state = OS_NOTIFY_STATE_NONE;
+    portEXIT_CRITICAL(&(tcb->task_state_mux));
+
+    return count;
+}
+
+/*******************************************************************************
+* _OS Task Notify
+*
+*   tcb = The task to notify
+*   value = Used to update the task's notification value, depending on action
+*   action = How the notification value is updated
+*   prev_value = Receives the notification value before the update. Can be NULL
+* 
+* PURPOSE : 
+*
+*   OS_task_notify for kernel code and wrappers that already hold the TCB
+* 
+* RETURN :
+*
+*   Return an error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*******************************************************************************/
+
+int _OS_task_notify(TCB_t *tcb, uint32_t value, OSNotifyAction_t action, uint32_t *prev_value)
+{
+    OSNotifyState_t prev_state;
+    OSBool_t yield_required = OS_FALSE;
+    int ret_val;
+
+    portENTER_CRITICAL(&(tcb->task_state_mux));
+    if(prev_value != NULL) {
+        *prev_value = tcb->notify_value;
+    }
+    prev_state = tcb->notify_state;
+    ret_val = _OS_task_notify_update(tcb, value, action);
+    if(ret_val == OS_NO_ERROR && prev_state == OS_NOTIFY_STATE_WAITING) {
+        yield_required = OS_schedule_unblock_task(tcb);
+    }
+    portEXIT_CRITICAL(&(tcb->task_state_mux));
+
+    if(yield_required == OS_TRUE) {
+        portYIELD_WITHIN_API();
+    }
+    return ret_val;
+}
+
+/*******************************************************************************
+* _OS Task Notify From ISR
+*
+*   tcb = The task to notify
+*   value = Used to update the task's notification value, depending on action
+*   action = How the notification value is updated
+*   prev_value = Receives the notification value before the update. Can be NULL
+*   higher_prio_woken = Set to OS_TRUE if the interrupted task should be
+*                       preempted. Can be NULL
+* 
+* PURPOSE : 
+*
+*   OS_task_notify_from_ISR for kernel code and wrappers that already hold 
+*   the TCB
+* 
+* RETURN :
+*
+*   Return an error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES: 
+*******************************************************************************/
+
+int _OS_task_notify_from_ISR(TCB_t *tcb, uint32_t value, OSNotifyAction_t action, 
+            uint32_t *prev_value, OSBool_t *higher_prio_woken)
+{
+    OSNotifyState_t prev_state;
+    int ret_val;
+
+    portENTER_CRITICAL_ISR(&(tcb->task_state_mux));
+    if(prev_value != NULL) {
+        *prev_value = tcb->notify_value;
+    }
+    prev_state = tcb->notify_state;
+    ret_val = _OS_task_notify_update(tcb, value, action);
+    if(ret_val == OS_NO_ERROR && prev_state == OS_NOTIFY_STATE_WAITING) {
+        if(OS_schedule_unblock_task(tcb) == OS_TRUE && higher_prio_woken != NULL) {
+            *higher_prio_woken = OS_TRUE;
+        }
+    }
+    portEXIT_CRITICAL_ISR(&(tcb->task_state_mux));
+
     return ret_val;
 }
 
@@ -428,19 +804,94 @@ int OS_task_receive_msg(TickType_t timeout, void ** data)
 
 TCB_t * OS_task_get_tcb(Tid_t tid)
 {
-    if(tid >= OS_task_counter || tid < OS_CURRENT_TASK) {
-        return NULL;
-    }
+    TidSlot_t *slot;
+    TCB_t *tcb;
+
     if(tid == OS_CURRENT_TASK){
        return OS_schedule_get_current_tcb(); 
     }
-    return OS_tid_table[tid];
+
+    slot = _OS_task_tid_slot(tid);
+    if(slot == NULL) {
+        return NULL;
+    }
+
+    /* Lock free read. The slot publishes its tid after its tcb and retracts
+    it before the tcb changes, so a tid that still matches after the tcb is
+    read means the tcb belongs to this tid */
+    if(slot->tid != tid) {
+        return NULL;
+    }
+    tcb = (TCB_t *)slot->tcb;
+    if(slot->tid != tid) {
+        return NULL;
+    }
+    return tcb;
 }
 
 /*******************************************************************************
 * STATIC FUNCTION DEFINITIONS
 *******************************************************************************/
 
+/**
+ * Give an initialized TCB its tid and message queue, then hand it to the scheduler
+ */
+static int _OS_task_start(TCB_t *task_tcb, int msg_queue_size, Tid_t *task_tid)
+{
+    int ret_val;
+
+    /* Get the task added to the tid table and set the task id */
+    ret_val = _OS_task_init_tid(task_tcb);
+    if(ret_val != OS_NO_ERROR) {
+        return ret_val;
+    }
+    if(task_tid != NULL){ 
+        *task_tid = task_tcb->tid;
+    }
+    
+    /* Handle message queue. A size of 0 marks the task as having no queue, and
+    must be set explicitly since pooled and static TCBs hold stale data */
+    _OS_msg_queue_init(&(task_tcb->msg_queue), (msg_queue_size > 0) ? msg_queue_size : 0);
+
+    ret_val = OS_schedule_add_task(task_tcb);
+    if(ret_val != OS_NO_ERROR) {
+        return ret_val;
+    }
+
+    return OS_NO_ERROR;
+}
+
+/**
+ * Apply a notification action to a task's notification value and mark the
+ * notification pending. Caller must hold the task's task_state_mux
+ */
+static int _OS_task_notify_update(TCB_t *tcb, uint32_t value, OSNotifyAction_t action)
+{
+    switch(action) {
+        case OS_NOTIFY_NO_ACTION:
+            break;
+        case OS_NOTIFY_SET_BITS:
+            tcb->notify_value |= value;
+            break;
+        case OS_NOTIFY_INCREMENT:
+            tcb->notify_value++;
+            break;
+        case OS_NOTIFY_OVERWRITE:
+            tcb->notify_value = value;
+            break;
+        case OS_NOTIFY_NO_OVERWRITE:
+            if(tcb->notify_state == OS_NOTIFY_STATE_PENDING) {
+                return OS_ERROR_NOTIFY_PENDING;
+            }
+            tcb->notify_value = value;
+            break;
+        default:
+            return OS_ERROR_INVALID_NOTIFY_ACTION;
+    }
+    tcb->notify_state = OS_NOTIFY_STATE_PENDING;
+    return OS_NO_ERROR;
+}
+
 /**
  * Delete Thread-Local-Storage pointers if any exist for the given task
  */
@@ -464,19 +915,23 @@ static void _OS_task_delete_TCB(TCB_t *tcb)
     vPortReleaseTaskMPUSettings( &(tcb->MPU_settings) );
     /* TODO: Clean up anything else? Message Queues? */
 
-    /* If the task is dynamically allocated */
-    if(tcb->is_static == OS_FALSE) {
-        /* Free the stack and TCB itself */
-        vPortFreeAligned(tcb->stack_start);
-		free(tcb);
-    }
+    /* Joiners were woken when the task was removed from the scheduler */
     if(tcb->join_waitlist != NULL){
         free(tcb->join_waitlist);
+        tcb->join_waitlist = NULL;
     }
-    /* Stack is statically allocated */
-    else {
-        /* TODO: just the stack or tcb static? or are both? Handle these cases */
+
+    /* Stop the tid from resolving to this TCB before it is freed. For static
+    tasks this is also the signal that the caller may reuse its buffers */
+    _OS_task_release_tid(tcb);
+
+    /* If the task is dynamically allocated */
+    if(tcb->is_static == OS_FALSE) {
+        /* Return the stack and TCB itself to the task pools */
+        _OS_task_pool_free_stack(tcb->stack_start, tcb->stack_size);
+        _OS_task_pool_free_tcb(tcb);
     }
+    /* The caller owns both the stack and TCB buffers, so nothing to free */
 }
 
 static void _OS_task_init_tcb(TCB_t *tcb, const char * const task_name, TaskPrio_t prio, int stack_size, 
@@ -488,23 +943,27 @@ static void _OS_task_init_tcb(TCB_t *tcb, const char * const task_name, TaskPrio
     tcb->priority = prio;
     tcb->base_priority = prio;
     tcb->core_ID = core_ID;
+    tcb->stack_size = stack_size;
     tcb->mutexes_held = 0;
     tcb->delay_wakeup_time = 0;
+    tcb->delay_slot = NULL;
     
     /* Initialize list parameters to null for now */
     tcb->next_ptr = NULL;
     tcb->prev_ptr = NULL;
 
     /* Initialize waitlist/blocking data */
-    tcb->is_blocked = OS_FALSE;
-    tcb->block_record.timeout_remaining = 0;
     tcb->block_record.waitlist = NULL;
     tcb->block_record.waitlist_next_ptr = NULL;
     tcb->block_record.waitlist_prev_ptr = NULL;
+    tcb->block_record.waitlist_mux = NULL;
 
     /* Initialize join waitlist to null for now */
     tcb->join_waitlist = NULL;
 
+    tcb->notify_value = 0;
+    tcb->notify_state = OS_NOTIFY_STATE_NONE;
+
     /* Take care of event list systems as we are reliant on FreeRTOS for
         Semaphores/queues/timers */
     vListInitialiseItem( &(tcb->xEventListItem ) );
@@ -558,18 +1017,107 @@ static void _OS_task_init_stack(TCB_t *tcb, int stack_size, StackType_t *stack_a
     tcb->stack_top = pxPortInitialiseStack(stack_top, task_func, task_arg, run_privileged);
 }
 
-static void _OS_task_init_tid(TCB_t *task_tcb)
+/**
+ * Find the tid table slot a tid indexes into.
+ * Returns NULL if the tid is out of range or its chunk doesn't exist yet
+ */
+static TidSlot_t * _OS_task_tid_slot(Tid_t tid)
 {
-    if(OS_tid_table == NULL) {
-        OS_tid_table = calloc(OS_TID_TABLE_INITIAL_SIZE, sizeof(TCB_t *));
-        OS_tid_table_size = OS_TID_TABLE_INITIAL_SIZE;
+    TidSlot_t *chunk;
+    int index;
+
+    if(tid < 0) {
+        return NULL;
     }
-    else if(OS_tid_table_size == OS_task_counter){
-        OS_tid_table_size *= 2;
-        realloc(OS_tid_table, OS_tid_table_size * sizeof(TCB_t *));
+    index = tid & OS_TID_INDEX_MASK;
+    chunk = OS_tid_chunks[index >> OS_TID_CHUNK_BITS];
+    if(chunk == NULL) {
+        return NULL;
     }
-    task_tcb->tid = OS_task_counter;
-    OS_tid_table[task_tcb->tid] = task_tcb;
-    ++OS_task_counter;
+    return &chunk[index & OS_TID_CHUNK_MASK];
+}
+
+/**
+ * Give a task a tid, recycling a released slot if there is one.
+ * The table grows by a chunk at a time and existing chunks never move
+ */
+static int _OS_task_init_tid(TCB_t *task_tcb)
+{
+    TidSlot_t *slot;
+    TidSlot_t *chunk = NULL;
+    int index;
+    int i;
+
+    portENTER_CRITICAL(&OS_task_mutex);
+    while(OS_TRUE) {
+        if(OS_tid_free_head >= 0) {
+            index = OS_tid_free_head;
+            slot = &OS_tid_chunks[index >> OS_TID_CHUNK_BITS][index & OS_TID_CHUNK_MASK];
+            OS_tid_free_head = slot->next_free;
+            break;
+        }
+        if(OS_tid_next_index > OS_TID_INDEX_MASK) {
+            portEXIT_CRITICAL(&OS_task_mutex);
+            free(chunk);
+            return OS_ERROR_TID_ALLOC;
+        }
+        index = OS_tid_next_index;
+
+        /* First slot of a new chunk. Publish the one we filled in, unless a
+        chunk is already there */
+        if(OS_tid_chunks[index >> OS_TID_CHUNK_BITS] == NULL && chunk != NULL) {
+            OS_tid_chunks[index >> OS_TID_CHUNK_BITS] = chunk;
+            chunk = NULL;
+        }
+        if(OS_tid_chunks[index >> OS_TID_CHUNK_BITS] != NULL) {
+            slot = &OS_tid_chunks[index >> OS_TID_CHUNK_BITS][index & OS_TID_CHUNK_MASK];
+            ++OS_tid_next_index;
+            break;
+        }
+
+        /* Never hold the lock across a heap call. Build the chunk outside it 
+        and look again, since another task may have grown the table meanwhile */
+        portEXIT_CRITICAL(&OS_task_mutex);
+        chunk = calloc(OS_TID_CHUNK_SIZE, sizeof(TidSlot_t));
+        if(chunk == NULL) {
+            return OS_ERROR_TID_ALLOC;
+        }
+        for(i = 0; i < OS_TID_CHUNK_SIZE; ++i) {
+            chunk[i].tid = OS_TID_FREE;
+            chunk[i].next_free = -1;
+        }
+        portENTER_CRITICAL(&OS_task_mutex);
+    }
+
+    /* Publish the tcb before the tid so lock free readers never pair them wrong */
+    task_tcb->tid = OS_TID_MAKE(index, slot->generation);
+    slot->tcb = task_tcb;
+    slot->tid = task_tcb->tid;
+    portEXIT_CRITICAL(&OS_task_mutex);
+
+    /* Another task published its chunk first */
+    free(chunk);
+    return OS_NO_ERROR;
+}
+
+/**
+ * Retire a task's tid and put its slot on the free list. The slot's generation
+ * is bumped so the old tid never resolves again
+ */
+static void _OS_task_release_tid(TCB_t *task_tcb)
+{
+    TidSlot_t *slot;
+
+    portENTER_CRITICAL(&OS_task_mutex);
+    slot = _OS_task_tid_slot(task_tcb->tid);
+    if(slot != NULL && slot->tid == task_tcb->tid) {
+        /* Retract the tid before clearing the tcb */
+        slot->tid = OS_TID_FREE;
+        slot->tcb = NULL;
+        slot->generation = (slot->generation + 1) & OS_TID_GENERATION_MASK;
+        slot->next_free = OS_tid_free_head;
+        OS_tid_free_head = task_tcb->tid & OS_TID_INDEX_MASK;
+    }
+    portEXIT_CRITICAL(&OS_task_mutex);
 }
 
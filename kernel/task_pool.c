@@ -0,0 +1,361 @@
+/* Standard includes. */
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+
+/* Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from redefining
+all the API functions to use the MPU wrappers.  That should only be done when
+task.h is included from an application file. */
+#define MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+#include "esp_newlib.h"
+#include "esp_compiler.h"
+
+/* FreeRTOS includes. */
+#include "FreeRTOS_old.h"
+#include "verios.h"
+#include "task.h"
+#include "task_pool.h"
+#include "portmacro.h"
+#include "portmacro_priv.h"
+
+/*******************************************************************************
+* TASK POOL CRITICAL STATE VARIABLES
+*******************************************************************************/
+
+/* Free TCBs for use/reuse. Works similar to 'slab allocation' */
+PRIVILEGED_DATA static TaskPoolList_t OS_tcb_pool = {0, 0, NULL};
+
+/* Free stacks for use/reuse. Index N holds stacks of OS_TASK_POOL_MIN_STACK_SIZE << N */
+PRIVILEGED_DATA static TaskPoolList_t OS_stack_pool[OS_TASK_POOL_NUM_STACK_CLASSES] = {{0, 0, NULL}};
+
+/* A counter of stacks too large to be pooled */
+PRIVILEGED_DATA static volatile int OS_stack_heap_allocs = 0;
+
+/* Mutex for the pool free lists. Never held across a heap call */
+PRIVILEGED_DATA static portMUX_TYPE OS_task_pool_mutex = portMUX_INITIALIZER_UNLOCKED;
+
+/*******************************************************************************
+* STATIC FUNCTION DECLARATIONS
+*******************************************************************************/
+
+static int _OS_task_pool_stack_class(int stack_size);
+
+static void _OS_task_pool_push(TaskPoolList_t *pool, void *block);
+
+static void * _OS_task_pool_pop(TaskPoolList_t *pool);
+
+static int _OS_task_pool_grow_tcbs(int num_tcbs);
+
+static int _OS_task_pool_grow_stacks(int stack_class, int num_stacks);
+
+/*******************************************************************************
+* OS Task Pool Prewarm
+*
+*   num_tcbs = The number of TCBs to make available
+*   stack_size = The size of the stacks to make available, measured in WORDS
+*   num_stacks = The number of stacks of stack_size to make available
+*
+* PURPOSE :
+*
+*   Fill the TCB and stack pools ahead of time (usually at boot), so that
+*   creating and deleting tasks later never has to touch the heap
+*
+* RETURN :
+*
+*   Return an error code, or 0 (OS_NO_ERROR) if no error occured
+*
+* NOTES:
+*
+*   Can be called once per stack size that the application uses. Pools only
+*   grow up to the requested counts, so calling this again is harmless
+*******************************************************************************/
+
+int OS_task_pool_prewarm(int num_tcbs, int stack_size, int num_stacks)
+{
+    int stack_class;
+    int missing;
+
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    missing = num_tcbs - OS_tcb_pool.num_free;
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+
+    if(missing > 0 && _OS_task_pool_grow_tcbs(missing) != OS_NO_ERROR) {
+        return OS_ERROR_TCB_ALLOC;
+    }
+
+    if(num_stacks <= 0) {
+        return OS_NO_ERROR;
+    }
+
+    stack_class = _OS_task_pool_stack_class(stack_size);
+    if(stack_size <= 0 || stack_class < 0) {
+        return OS_ERROR_INVALID_STKSIZE;
+    }
+
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    missing = num_stacks - OS_stack_pool[stack_class].num_free;
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+
+    if(missing > 0 && _OS_task_pool_grow_stacks(stack_class, missing) != OS_NO_ERROR) {
+        return OS_ERROR_STACK_ALLOC;
+    }
+    return OS_NO_ERROR;
+}
+
+/*******************************************************************************
+* OS Task Pool Get Stats
+*
+*   stats = Filled with the current state of every pool
+*
+* PURPOSE :
+*
+*   Report how many TCBs and stacks are cached and how many were ever made, to
+*   help size the calls to OS_task_pool_prewarm
+*
+* RETURN :
+*
+* NOTES:
+*******************************************************************************/
+
+void OS_task_pool_get_stats(TaskPoolStats_t *stats)
+{
+    int i;
+
+    if(stats == NULL) {
+        return;
+    }
+
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    stats->tcbs_free = OS_tcb_pool.num_free;
+    stats->tcbs_total = OS_tcb_pool.num_total;
+    for(i = 0; i < OS_TASK_POOL_NUM_STACK_CLASSES; ++i) {
+        stats->stacks_free[i] = OS_stack_pool[i].num_free;
+        stats->stacks_total[i] = OS_stack_pool[i].num_total;
+    }
+    stats->stack_heap_allocs = OS_stack_heap_allocs;
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+}
+
+/*******************************************************************************
+* OS Task Pool Alloc TCB
+*
+* PURPOSE :
+*
+*   Get a TCB from the pool, growing the pool by a slab if it is empty
+*
+* RETURN :
+*
+*   A TCB, or NULL if the pool was empty and the heap is out of memory
+*
+* NOTES:
+*******************************************************************************/
+
+TCB_t * _OS_task_pool_alloc_tcb(void)
+{
+    TCB_t *tcb;
+
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    tcb = (TCB_t *)_OS_task_pool_pop(&OS_tcb_pool);
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+
+    /* Our pool is empty so we have to allocate another slab of TCBs */
+    while(tcb == NULL) {
+        if(_OS_task_pool_grow_tcbs(OS_TASK_POOL_TCB_SLAB_SIZE) != OS_NO_ERROR) {
+            return NULL;
+        }
+        portENTER_CRITICAL(&OS_task_pool_mutex);
+        tcb = (TCB_t *)_OS_task_pool_pop(&OS_tcb_pool);
+        portEXIT_CRITICAL(&OS_task_pool_mutex);
+    }
+    return tcb;
+}
+
+/*******************************************************************************
+* OS Task Pool Free TCB
+*
+*   tcb = A TCB that came from _OS_task_pool_alloc_tcb
+*
+* PURPOSE :
+*
+*   Return a TCB to the pool for reuse. TCBs are never given back to the heap
+*
+* RETURN :
+*
+* NOTES:
+*******************************************************************************/
+
+void _OS_task_pool_free_tcb(TCB_t *tcb)
+{
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    _OS_task_pool_push(&OS_tcb_pool, tcb);
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+}
+
+/*******************************************************************************
+* OS Task Pool Alloc Stack
+*
+*   stack_size = The size of the stack measured in WORDS
+*
+* PURPOSE :
+*
+*   Get a stack of at least stack_size from the pool of its size class. The
+*   pool is grown by one stack if it is empty
+*
+* RETURN :
+*
+*   A stack, or NULL if the heap is out of memory
+*
+* NOTES:
+*
+*   Stacks larger than OS_TASK_POOL_MAX_STACK_SIZE bypass the pool
+*******************************************************************************/
+
+StackType_t * _OS_task_pool_alloc_stack(int stack_size)
+{
+    int stack_class = _OS_task_pool_stack_class(stack_size);
+    StackType_t *stack;
+
+    if(stack_class < 0) {
+        portENTER_CRITICAL(&OS_task_pool_mutex);
+        OS_stack_heap_allocs++;
+        portEXIT_CRITICAL(&OS_task_pool_mutex);
+        return ( StackType_t * ) pvPortMallocStackMem( ( ( ( size_t ) stack_size ) * sizeof( StackType_t ) ) );
+    }
+
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    stack = (StackType_t *)_OS_task_pool_pop(&OS_stack_pool[stack_class]);
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+
+    while(stack == NULL) {
+        if(_OS_task_pool_grow_stacks(stack_class, 1) != OS_NO_ERROR) {
+            return NULL;
+        }
+        portENTER_CRITICAL(&OS_task_pool_mutex);
+        stack = (StackType_t *)_OS_task_pool_pop(&OS_stack_pool[stack_class]);
+        portEXIT_CRITICAL(&OS_task_pool_mutex);
+    }
+    return stack;
+}
+
+/*******************************************************************************
+* OS Task Pool Free Stack
+*
+*   stack = A stack that came from _OS_task_pool_alloc_stack
+*   stack_size = The size the stack was requested with
+*
+* PURPOSE :
+*
+*   Return a stack to the pool of its size class for reuse
+*
+* RETURN :
+*
+* NOTES:
+*******************************************************************************/
+
+void _OS_task_pool_free_stack(StackType_t *stack, int stack_size)
+{
+    int stack_class = _OS_task_pool_stack_class(stack_size);
+
+    if(stack_class < 0) {
+        vPortFreeAligned(stack);
+        return;
+    }
+
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    _OS_task_pool_push(&OS_stack_pool[stack_class], stack);
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+}
+
+/*******************************************************************************
+* STATIC FUNCTION DEFINITIONS
+*******************************************************************************/
+
+/**
+ * Find the smallest stack class that fits stack_size.
+ * Returns -1 if the stack is too large to be pooled
+ */
+static int _OS_task_pool_stack_class(int stack_size)
+{
+    int stack_class = 0;
+
+    while((OS_TASK_POOL_MIN_STACK_SIZE << stack_class) < stack_size) {
+        if(++stack_class == OS_TASK_POOL_NUM_STACK_CLASSES) {
+            return -1;
+        }
+    }
+    return stack_class;
+}
+
+/**
+ * Add a free block to the head of a pool. Caller must hold OS_task_pool_mutex
+ */
+static void _OS_task_pool_push(TaskPoolList_t *pool, void *block)
+{
+    TaskPoolBlock_t *free_block = (TaskPoolBlock_t *)block;
+
+    free_block->next_ptr = pool->head_ptr;
+    pool->head_ptr = free_block;
+    pool->num_free++;
+}
+
+/**
+ * Take a free block from the head of a pool. Caller must hold OS_task_pool_mutex.
+ * Returns NULL if the pool is empty
+ */
+static void * _OS_task_pool_pop(TaskPoolList_t *pool)
+{
+    TaskPoolBlock_t *free_block = pool->head_ptr;
+
+    if(free_block != NULL) {
+        pool->head_ptr = free_block->next_ptr;
+        pool->num_free--;
+    }
+    return free_block;
+}
+
+/**
+ * Allocate a slab of num_tcbs TCBs with a single heap call and add them to
+ * the TCB pool
+ */
+static int _OS_task_pool_grow_tcbs(int num_tcbs)
+{
+    TCB_t *slab;
+    int i;
+
+    slab = ( TCB_t * ) pvPortMallocTcbMem( sizeof( TCB_t ) * ( size_t ) num_tcbs );
+    if(slab == NULL) {
+        return OS_ERROR_TCB_ALLOC;
+    }
+
+    portENTER_CRITICAL(&OS_task_pool_mutex);
+    for(i = 0; i < num_tcbs; ++i) {
+        _OS_task_pool_push(&OS_tcb_pool, &slab[i]);
+    }
+    OS_tcb_pool.num_total += num_tcbs;
+    portEXIT_CRITICAL(&OS_task_pool_mutex);
+    return OS_NO_ERROR;
+}
+
+/**
+ * Allocate num_stacks stacks of the given class and add them to its pool.
+ * Stacks are allocated one at a time so a large class doesn't need a huge
+ * contiguous region
+ */
+static int _OS_task_pool_grow_stacks(int stack_class, int num_stacks)
+{
+    size_t stack_bytes = ( ( size_t ) OS_TASK_POOL_MIN_STACK_SIZE << stack_class ) * sizeof( StackType_t );
+    StackType_t *stack;
+    int i;
+
+    for(i = 0; i < num_stacks; ++i) {
+        stack = ( StackType_t * ) pvPortMallocStackMem( stack_bytes );
+        if(stack == NULL) {
+            return OS_ERROR_STACK_ALLOC;
+        }
+        portENTER_CRITICAL(&OS_task_pool_mutex);
+        _OS_task_pool_push(&OS_stack_pool[stack_class], stack);
+        OS_stack_pool[stack_class].num_total++;
+        portEXIT_CRITICAL(&OS_task_pool_mutex);
+    }
+    return OS_NO_ERROR;
+}
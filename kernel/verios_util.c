@@ -22,6 +22,8 @@
 *
 *   tcb = Pointer to the tcb that is getting added to a waitlist
 *   waitlist = A pointer to the waitlist to add the task to
+*   waitlist_mux = The mux of the kernel object guarding the waitlist, or NULL
+*                  if the scheduler locks guard it
 * 
 * PURPOSE : 
 *
@@ -32,9 +34,12 @@
 *   
 *
 * NOTES: 
+*
+*   A task on a waitlist guarded by an object's mux must remove itself when its
+*   block times out. The scheduler only dequeues from unguarded waitlists
 *******************************************************************************/
 
-void _OS_waitlist_append(TCB_t *tcb, WaitList_t *waitlist)
+void _OS_waitlist_append(TCB_t *tcb, WaitList_t *waitlist, portMUX_TYPE *waitlist_mux)
 {
     TCB_t *tcb1;
     TCB_t *tcb2;
@@ -42,6 +47,8 @@ void _OS_waitlist_append(TCB_t *tcb, WaitList_t *waitlist)
     /* Update the task counter for this delayed list */
     waitlist->num_tasks++;
     tcb->block_record.waitlist = waitlist;
+    tcb->block_record.waitlist_mux = waitlist_mux;
+    tcb->block_record.granted = OS_FALSE;
 
     /* First entry in the waitlist */
     if(waitlist->head_ptr == NULL) {
@@ -55,6 +62,7 @@ void _OS_waitlist_append(TCB_t *tcb, WaitList_t *waitlist)
     if(waitlist->head_ptr->priority < tcb->priority) {
         tcb->block_record.waitlist_next_ptr = waitlist->head_ptr;
         tcb->block_record.waitlist_prev_ptr = NULL;
+        waitlist->head_ptr->block_record.waitlist_prev_ptr = tcb;
         waitlist->head_ptr = tcb;
         return;
     }
@@ -74,6 +82,7 @@ void _OS_waitlist_append(TCB_t *tcb, WaitList_t *waitlist)
         tcb1 = tcb1->block_record.waitlist_next_ptr;
     }
     tcb2->block_record.waitlist_next_ptr = tcb;
+    tcb1->block_record.waitlist_prev_ptr = tcb;
     tcb->block_record.waitlist_prev_ptr = tcb2;
     tcb->block_record.waitlist_next_ptr = tcb1;
 }
@@ -126,6 +135,7 @@ void _OS_waitlist_remove(TCB_t *tcb)
     tcb->block_record.waitlist_next_ptr = NULL;
     tcb->block_record.waitlist_prev_ptr = NULL;
     tcb->block_record.waitlist = NULL;
+    tcb->block_record.waitlist_mux = NULL;
 }
 
 /*******************************************************************************
@@ -160,12 +170,14 @@ TCB_t * _OS_waitlist_pop_head(WaitList_t *waitlist)
     }
     else {
         waitlist->head_ptr = waitlist->head_ptr->block_record.waitlist_next_ptr;
+        waitlist->head_ptr->block_record.waitlist_prev_ptr = NULL;
         waitlist->num_tasks--;
     }
     /* This task is no longer on a waitlist */
     head->block_record.waitlist = NULL;
     head->block_record.waitlist_next_ptr = NULL;
     head->block_record.waitlist_prev_ptr = NULL;
+    head->block_record.waitlist_mux = NULL;
 
     return head;
 }